@@ -0,0 +1,88 @@
+#include <benchmark/benchmark.h>
+
+#include "../src/utils/DataFitting.h"
+#include <Eigen/Dense>
+#include <random>
+
+using namespace Eigen;
+
+/**
+ * The original per column implementation of ugr::util::gaussianND, kept as a baseline
+ */
+template<typename MeansDerived, typename CovDerived, typename SamplesDerived>
+static VectorXf gaussianNDPerColumn(
+	const MatrixBase<MeansDerived>& means,
+	const MatrixBase<CovDerived>& cov,
+	const MatrixBase<SamplesDerived>& pos)
+{
+	const int NDimensions = means.rows();
+	VectorXf out(pos.cols());
+	const double norm = std::pow(SQRT2PI, -NDimensions) * std::pow(std::abs(cov.determinant()), -0.5);
+	for (int i = 0; i < pos.cols(); ++i)
+	{
+		const double quadform = (pos.col(i) - means).transpose() * cov.inverse() * (pos.col(i) - means);
+		const double halfNegQuadform = -0.5 * quadform;
+		out(i) = halfNegQuadform < -102 ? 0 : norm * std::exp(halfNegQuadform);
+	}
+	return out;
+}
+
+class GaussianFixture : public benchmark::Fixture
+{
+ public:
+	void SetUp(const benchmark::State& state) override
+	{
+		const auto n = state.range(0);
+		std::default_random_engine generator(42);
+		std::uniform_real_distribution<float> posDist(-30, 30);
+		pos.resize(2, n);
+		for (Index i = 0; i < n; ++i)
+		{
+			pos(0, i) = posDist(generator);
+			pos(1, i) = posDist(generator);
+		}
+		out.resize(n);
+
+		means << 10, -5;
+		cov << 9, -4,
+			-4, 6;
+	}
+
+	Matrix<float, 2, Dynamic, RowMajor> pos;
+	VectorXf out;
+	Vector2f means;
+	Matrix2f cov;
+};
+
+BENCHMARK_DEFINE_F(GaussianFixture, PerColumn)(benchmark::State& state)
+{
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(gaussianNDPerColumn(means, cov, pos));
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_DEFINE_F(GaussianFixture, GaussianND)(benchmark::State& state)
+{
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(ugr::util::gaussianND(means, cov, pos));
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_DEFINE_F(GaussianFixture, Gaussian2DPDF)(benchmark::State& state)
+{
+	for (auto _ : state)
+	{
+		ugr::util::gaussian2DPDF(means, cov, pos, out);
+		benchmark::DoNotOptimize(out.data());
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_REGISTER_F(GaussianFixture, PerColumn)->Arg(10000)->Arg(100000)->Arg(1000000);
+BENCHMARK_REGISTER_F(GaussianFixture, GaussianND)->Arg(10000)->Arg(100000)->Arg(1000000);
+BENCHMARK_REGISTER_F(GaussianFixture, Gaussian2DPDF)->Arg(10000)->Arg(100000)->Arg(1000000);
@@ -0,0 +1,85 @@
+#include <benchmark/benchmark.h>
+
+#include "uasgroundrisk/risk_analysis/RiskMap.h"
+#include <memory>
+#include <omp.h>
+
+using namespace ugr::risk;
+
+/**
+ * Strike map generation over a synthetic population. The population density and building heights are
+ * filled directly and the maps have no OSM layers, so no OSM data is read when the risk map evaluates
+ * them. The map is built once and shared between all benchmark runs.
+ */
+class StrikeMapFixture : public benchmark::Fixture
+{
+ public:
+	void SetUp(const benchmark::State& state) override
+	{
+		if (riskMap)
+		{
+			return;
+		}
+
+		aircraft.state.position << 0, 0, 120;
+		aircraft.state.velocity << 20, 0, 0;
+		aircraft.mass = 50;
+		aircraft.length = 5;
+		aircraft.width = 5;
+		aircraft.failureProb = 8e-3;
+		aircraft.addDescentModel<GlideDescentModel>(21, 15);
+		aircraft.addDescentModel<BallisticDescentModel>(25 * 0.3, 0.8);
+
+		// A missing file fails any OSM query rather than falling back to Overpass
+		const auto noOSMData = ugr::mapping::osm::OSMDataSource::file("");
+
+		// A populated square in the middle of the map, in people/km^2
+		ugr::mapping::PopulationMap population(bounds, resolution);
+		population.setDataSource(noOSMData);
+		population.add("Population Density", 0);
+		const auto size = population.getSize();
+		population.get("Population Density").block(size.x() / 4, size.y() / 4, size.x() / 2, size.y() / 2)
+			.setConstant(1e3);
+
+		WeatherMap weather(bounds, resolution);
+		weather.addConstantWind(5, 90);
+		weather.eval();
+
+		ObstacleMap obstacleMap(bounds, resolution);
+		obstacleMap.setDataSource(noOSMData);
+		obstacleMap.add("Building Height", 0);
+
+		riskMap = std::make_unique<RiskMap>(population, aircraft, obstacleMap, weather);
+		riskMap->SetSeed(1234);
+		// Benchmark the per cell Monte Carlo path, not the convolution shortcut
+		riskMap->SetConvolutionEnabled(false);
+	}
+
+	static std::unique_ptr<RiskMap> riskMap;
+	static AircraftModel aircraft;
+	const std::array<float, 4> bounds{ 50.9065510f, -1.4500237f, 50.9517765f, -1.3419628f };
+	const int resolution = 40;
+};
+
+std::unique_ptr<RiskMap> StrikeMapFixture::riskMap;
+AircraftModel StrikeMapFixture::aircraft;
+
+BENCHMARK_DEFINE_F(StrikeMapFixture, GenerateStrikeMap)(benchmark::State& state)
+{
+	const int maxThreads = omp_get_max_threads();
+	omp_set_num_threads(static_cast<int>(state.range(0)));
+	for (auto _ : state)
+	{
+		riskMap->generateMap({ RiskType::STRIKE });
+	}
+	omp_set_num_threads(maxThreads);
+
+	const auto size = riskMap->getSize();
+	state.SetItemsProcessed(state.iterations() * size.x() * size.y());
+	state.counters["threads"] = static_cast<double>(state.range(0));
+}
+
+BENCHMARK_REGISTER_F(StrikeMapFixture, GenerateStrikeMap)
+	->RangeMultiplier(2)->Range(1, 64)
+	->UseRealTime()
+	->Unit(benchmark::kMillisecond);
@@ -7,6 +7,8 @@ class UasgroundriskConan(ConanFile):
     author = "Aliaksei Pilko <A.Pilko@soton.ac.uk>"
     license = "Proprietary"
     settings = "os", "compiler", "arch", "build_type"
+    options = {"with_netcdf": [True, False]}
+    default_options = {"with_netcdf": False}
     generators = "CMakeToolchain", "CMakeDeps"
     exports_sources = "CMakeLists.txt", "src/*"
 
@@ -14,11 +16,13 @@ class UasgroundriskConan(ConanFile):
         self.requires("eigen/[>3.3.9]")
         self.requires("boost/1.81.0")
         self.requires("geos/3.13.0")
-        self.requires("shapelib/1.5.0")
         self.requires("proj/9.5.0")
         self.requires("openssl/3.4.1")
         self.requires("cpr/1.11.2")
         self.requires("expat/2.7.1")
+        self.requires("zlib/[>=1.2.11 <2]")
         self.requires("fast-cpp-csv-parser/cci.20211104")
         self.requires("rapidjson/cci.20220822")
         self.requires("spdlog/[>=1.10.0]")
+        if self.options.with_netcdf:
+            self.requires("netcdf/4.8.1")
@@ -0,0 +1,169 @@
+#ifndef GEOMETRYARENA_H
+#define GEOMETRYARENA_H
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "GridMap.h"
+#include "Rasteriser.h"
+#include "TiledLayer.h"
+#include "TypeDefs.h"
+
+namespace ugr
+{
+	namespace gridmap
+	{
+		/**
+		 * @brief Polygons collected to be rasterised together in parallel.
+		 *
+		 * Each geometry is a record of its rings in continuous local coordinates and its attributes,
+		 * with the vertices of every geometry in one contiguous buffer, so collecting a geometry only
+		 * appends to a few vectors. Rings of a geometry are filled with the even-odd rule.
+		 *
+		 * #rasterise first scans the geometries across threads, then writes the cells they cover in
+		 * bands of rows, with each band written by a single thread. Within a band geometries are
+		 * written in the order they were added, so every cell sees the same sequence of writes as
+		 * rasterising the geometries serially, and the result does not depend on the number of threads.
+		 *
+		 * @tparam TAttributes the values written for each geometry
+		*/
+		template <typename TAttributes>
+		class GeometryArena
+		{
+		public:
+			// The rows in each band of cells written by one thread, when no layer is tiled
+			static constexpr int DefaultBandSize = 32;
+
+			/**
+			 * Start a new geometry, which has the rings added until the next geometry is started
+			 * @param attributes the values written for the geometry
+			*/
+			void beginGeometry(TAttributes attributes)
+			{
+				records.push_back({ ringStarts.size(), std::move(attributes) });
+			}
+
+			/**
+			 * Start a new ring of the current geometry, which has the vertices added until the next ring
+			 * or geometry is started
+			*/
+			void beginRing()
+			{
+				ringStarts.push_back(vertices.size());
+			}
+
+			void addVertex(const Vector& vertex)
+			{
+				vertices.push_back(vertex);
+			}
+
+			size_t size() const { return records.size(); }
+
+			bool empty() const { return records.empty(); }
+
+			/**
+			 * Remove all geometries, keeping the memory allocated for reuse
+			*/
+			void clear()
+			{
+				records.clear();
+				ringStarts.clear();
+				vertices.clear();
+			}
+
+			/**
+			 * Make layers of a gridmap safe to write from the threads of #rasterise
+			 * @param gridMap the gridmap to write to
+			 * @param layers the layers that will be written
+			 * @return the band size to rasterise with, so bands never share the tiles of a tiled layer
+			*/
+			static int prepareLayers(GridMap& gridMap, const std::vector<LayerHandle>& layers)
+			{
+				int bandSize = DefaultBandSize;
+				for (const auto& layer : layers)
+				{
+					gridMap.makeWritable(layer);
+					if (gridMap.isTiled(layer))
+					{
+						bandSize = TiledLayer::TileSize;
+					}
+				}
+				return bandSize;
+			}
+
+			/**
+			 * Rasterise every geometry
+			 * @param size the size of the gridmap
+			 * @param mode how cells are sampled
+			 * @param bandSize the number of rows written by each thread at a time
+			 * @param write called as write(attributes, index, coverage) for every cell covered by each
+			 * geometry. It is called concurrently for cells in different bands, so must only write to
+			 * the cell at the index
+			*/
+			template <typename F>
+			void rasterise(const Size& size, const Rasteriser::SampleMode mode, const int bandSize, F&& write) const
+			{
+				// Scan each geometry into spans, which are ordered by x
+				std::vector<std::vector<Rasteriser::Span>> spans(records.size());
+				const long nRecords = static_cast<long>(records.size());
+#pragma omp parallel
+				{
+					Rasteriser rasteriser(size);
+#pragma omp for schedule(dynamic, 16)
+					for (long i = 0; i < nRecords; ++i)
+					{
+						rasteriser.clear();
+						const size_t ringEnd = i + 1 < nRecords ? records[i + 1].firstRing : ringStarts.size();
+						for (size_t ring = records[i].firstRing; ring < ringEnd; ++ring)
+						{
+							const size_t vertexEnd = ring + 1 < ringStarts.size() ? ringStarts[ring + 1] : vertices.size();
+							if (vertexEnd - ringStarts[ring] >= 3)
+							{
+								rasteriser.addRing(&vertices[ringStarts[ring]], vertexEnd - ringStarts[ring]);
+							}
+						}
+						spans[i] = rasteriser.rasterise(mode);
+					}
+				}
+
+				// Write the spans of every geometry in each band in order
+				const int nBands = (size.x() + bandSize - 1) / bandSize;
+#pragma omp parallel for schedule(dynamic)
+				for (int band = 0; band < nBands; ++band)
+				{
+					const int xStart = band * bandSize;
+					const int xEnd = std::min(size.x(), xStart + bandSize);
+					for (size_t i = 0; i < records.size(); ++i)
+					{
+						const auto& recordSpans = spans[i];
+						if (recordSpans.empty() || recordSpans.back().x < xStart || recordSpans.front().x >= xEnd)
+						{
+							continue;
+						}
+						auto span = std::lower_bound(recordSpans.begin(), recordSpans.end(), xStart,
+						                             [](const Rasteriser::Span& s, const int x) { return s.x < x; });
+						for (; span != recordSpans.end() && span->x < xEnd; ++span)
+						{
+							for (int y = span->yStart; y < span->yEnd; ++y)
+							{
+								write(records[i].attributes, Index(span->x, y), span->coverage);
+							}
+						}
+					}
+				}
+			}
+
+		private:
+			struct Record
+			{
+				size_t firstRing;
+				TAttributes attributes;
+			};
+
+			std::vector<Record> records;
+			// The index of the first vertex of each ring
+			std::vector<size_t> ringStarts;
+			std::vector<Vector> vertices;
+		};
+	}
+}
+#endif // GEOMETRYARENA_H
@@ -1,9 +1,19 @@
 #ifndef GRIDMAP_H
 #define GRIDMAP_H
+#include <array>
+#include <cassert>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
 #include <unordered_map>
 #include <Eigen/Dense>
 #include <vector>
+#include "TiledLayer.h"
 #include "TypeDefs.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 namespace ugr
@@ -13,50 +23,94 @@ namespace ugr
 		// using namespace Eigen;
 
 		/**
-		 * @brief A container for multiple labelled matrices of the same size
+		 * @brief An interned reference to a GridMap layer, returned by GridMap#getHandle.
 		 *
-		 * Loosely based on grid_map: https://github.com/ANYbotics/grid_map
-		 * But the catkin build system is atrocious when not already using ROS...
+		 * Accessing layers by handle is O(1) and avoids building and hashing layer name strings,
+		 * so handles should be resolved once outside of any per cell loops.
+		 * Handles are only valid for the GridMap that issued them, or copies of it.
 		*/
-		class GridMap
+		class LayerHandle
 		{
 		public:
-			EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+			LayerHandle() = default;
 
-			GridMap() = default;
-
-			GridMap(const GridMap& other) = default;
+			bool isValid() const
+			{
+				return id >= 0;
+			}
 
-			GridMap(GridMap&& other) noexcept
-				: geometrySet(other.geometrySet),
-				  sizeX(other.sizeX),
-				  sizeY(other.sizeY),
-				  layers(std::move(other.layers))
+			bool operator==(const LayerHandle& other) const
 			{
+				return id == other.id;
 			}
 
-			GridMap& operator=(const GridMap& other)
+			bool operator!=(const LayerHandle& other) const
 			{
-				if (this == &other)
-					return *this;
-				geometrySet = other.geometrySet;
-				sizeX = other.sizeX;
-				sizeY = other.sizeY;
-				layers = other.layers;
-				return *this;
+				return id != other.id;
 			}
 
-			GridMap& operator=(GridMap&& other) noexcept
+		private:
+			friend class GridMap;
+
+			explicit LayerHandle(const int id) : id(id)
 			{
-				if (this == &other)
-					return *this;
-				geometrySet = other.geometrySet;
-				sizeX = other.sizeX;
-				sizeY = other.sizeY;
-				layers = std::move(other.layers);
-				return *this;
 			}
 
+			int id = -1;
+		};
+
+		/**
+		 * @brief Geospatial metadata stored in binary gridmap files.
+		 * This is left empty for gridmaps without a geospatial reference.
+		*/
+		struct GridMapFileMetadata
+		{
+			// The (S,W,N,E) bounds in the world projection
+			std::array<float, 4> bounds{};
+			float resolution = 0;
+			std::string worldSrs;
+			std::string projectionSrs;
+		};
+
+		/**
+		 * @brief A container for multiple labelled matrices of the same size
+		 *
+		 * Loosely based on grid_map: https://github.com/ANYbotics/grid_map
+		 * But the catkin build system is atrocious when not already using ROS...
+		 *
+		 * Layer storage is reference counted and copy-on-write. Copying a GridMap or adding a layer
+		 * with #addShared does not copy any layer data; a shared layer is only copied the first time
+		 * it is accessed mutably through one of its owners. Read only access through a const GridMap
+		 * or #view never copies.
+		 *
+		 * Once a mutable reference to a layer has been returned, by #get, #at, operator[] or
+		 * #makeWritable, that layer is copied eagerly whenever the map is copied, so the reference
+		 * keeps writing to this map only and stays valid. #addShared still shares such layers, so
+		 * writes through references held on the source are seen by every map sharing the layer;
+		 * layers should only be shared once they are fully written.
+		 *
+		 * Layers can also be stored as a TiledLayer with #addTiled, which only allocates memory for
+		 * tiles that have been written to. Tiled layers are accessed transparently through #at and
+		 * the iterators, but have no dense matrix so #get, #view and operator[] throw for them.
+		 *
+		 * Layers of gridmaps opened with #openBinary are read only views of a memory mapped file.
+		 * They can be read with #at and #view without loading or copying the file, and are copied
+		 * into memory on the first mutable access. Const #get throws for them as there is no matrix.
+		*/
+		class GridMap
+		{
+		public:
+			EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+			GridMap() = default;
+
+			// Copies share layer storage with the original, except for layers that mutable references
+			// have been taken to, see the class documentation
+			GridMap(const GridMap& other);
+			GridMap(GridMap&& other) noexcept = default;
+			GridMap& operator=(const GridMap& other);
+			GridMap& operator=(GridMap&& other) noexcept = default;
+
 			virtual ~GridMap() = default;
 
 			/**
@@ -81,6 +135,7 @@ namespace ugr
 			 * @param layerData matrix of value, matching size of gridmap
 			*/
 			void add(const std::string& layerName, const Matrix& layerData);
+			void add(const std::string& layerName, Matrix&& layerData);
 
 
 			/**
@@ -92,17 +147,136 @@ namespace ugr
 
 
 			/**
-			 * @brief Return the data for a layer
+			 * @brief Add a layer to the gridmap that shares its data with a layer of another gridmap.
+			 * No data is copied until either map modifies the layer.
+			 * @param layerName name of the layer to add
+			 * @param source the gridmap to share the layer from, matching the size of this gridmap
+			 * @param sourceLayerName name of the layer in the source gridmap
+			 * @throws std::out_of_range if the source layer does not exist
+			*/
+			void addShared(const std::string& layerName, const GridMap& source, const std::string& sourceLayerName);
+
+
+			/**
+			 * @brief Add a tiled layer to the gridmap, which only allocates memory for tiles that are
+			 * written to. Cells in unwritten tiles read as the fill value.
+			 * @param layerName name of layer to add
+			 * @param fillValue value of unwritten cells
+			*/
+			void addTiled(const std::string& layerName, double fillValue);
+
+
+			/**
+			 * @brief Test if a layer is stored as tiles
+			 * @param layerName name of the layer
+			 * @return whether the layer was added with #addTiled
+			*/
+			bool isTiled(const std::string& layerName) const;
+
+			bool isTiled(const LayerHandle handle) const
+			{
+				return tiledLayers[handle.id] != nullptr;
+			}
+
+
+			/**
+			 * @brief Test if a layer is still a read only view of a memory mapped file
+			 * @param layerName name of the layer
+			 * @return whether the layer is mapped
+			*/
+			bool isMapped(const std::string& layerName) const;
+
+			bool isMapped(const LayerHandle handle) const
+			{
+				return mappedLayers[handle.id] != nullptr;
+			}
+
+
+			/**
+			 * @brief Return the storage of a tiled layer. Mutable access copies the layer first if it is shared.
+			 * @param layerName name of the tiled layer
+			 * @throws std::logic_error if the layer is not tiled
+			*/
+			const TiledLayer& getTiled(const std::string& layerName) const;
+			TiledLayer& getTiled(const std::string& layerName);
+
+
+			/**
+			 * @brief Return the handle of a layer for fast repeated access
+			 * @param layerName name of the layer
+			 * @return the layer handle
+			 * @throws std::out_of_range if the layer does not exist
+			*/
+			LayerHandle getHandle(const std::string& layerName) const;
+
+			/**
+			 * @brief Copy a layer first if it is shared or mapped, as mutable access does, so it can then
+			 * be written with #at from several threads. This must be called before any parallel writes,
+			 * as #at would otherwise copy the layer from whichever thread reaches it first. Threads must
+			 * write disjoint cells, and disjoint tiles of a tiled layer, as tiles are allocated on their
+			 * first write. The layer must not be shared with #addShared again until the writes are done.
+			 * @param handle the layer to write
+			*/
+			void makeWritable(const LayerHandle handle)
+			{
+				if (tiledLayers[handle.id])
+				{
+					mutableTiledLayer(handle.id);
+				}
+				else
+				{
+					mutableLayer(handle.id);
+				}
+			}
+
+			/**
+			 * @brief Return the data for a layer. Mutable access copies the layer first if it is shared.
+			 * The returned reference stays valid when the map is copied, as the copy then gets its own
+			 * copy of the layer, see the class documentation.
+			 * Layers mapped from a file have no matrix until they are written, so read only code that
+			 * may be given a map from #openBinary should read layers with #view instead.
 			 * @param layerName name of layer to get
 			 * @return the matrix of layer values
+			 * @throws std::logic_error if the layer is tiled, or mapped for const access
 			*/
-			Matrix get(const std::string& layerName) const;
+			const Matrix& get(const std::string& layerName) const;
 			Matrix& get(const std::string& layerName);
 			const Matrix& operator[](const std::string& layerName) const;
 			Matrix& operator[](const std::string& layerName);
 
+			const Matrix& operator[](const LayerHandle handle) const
+			{
+				return denseLayer(handle.id);
+			}
+
+			Matrix& operator[](const LayerHandle handle)
+			{
+				return mutableLayer(handle.id);
+			}
+
 			/**
-			 * @brief Return the value of the coefficient at x,y on the given layer
+			 * @brief Return a read only view of the data for a layer.
+			 * This never copies the layer, even when called on a non-const gridmap.
+			 * @param layerName name of layer to view
+			 * @return the view of the layer values
+			 * @throws std::logic_error if the layer is tiled
+			*/
+			ConstMatrixMap view(const std::string& layerName) const;
+
+			ConstMatrixMap view(const LayerHandle handle) const
+			{
+				if (const GridMapDataType* mapped = mappedLayers[handle.id].get())
+				{
+					return { mapped, sizeX, sizeY };
+				}
+				const Matrix& data = denseLayer(handle.id);
+				return { data.data(), data.rows(), data.cols() };
+			}
+
+			/**
+			 * @brief Return the value of the coefficient at x,y on the given layer.
+			 * Mutable access copies the layer first if it is shared, like #get. To write a layer from
+			 * several threads, call #makeWritable on it first.
 			 * @param layerName layer to use
 			 * @param i x index
 			 * @param j y index
@@ -113,6 +287,39 @@ namespace ugr
 			GridMapDataType at(const std::string& layerName, const Index& idx) const;
 			GridMapDataType& at(const std::string& layerName, const Index& idx);
 
+			GridMapDataType at(const LayerHandle handle, const int i, const int j) const
+			{
+				if (const Matrix* dense = layers[handle.id].get())
+				{
+					return (*dense)(i, j);
+				}
+				// Read through a const pointer, so that reading never allocates tiles
+				if (const TiledLayer* tiled = tiledLayers[handle.id].get())
+				{
+					return tiled->at(i, j);
+				}
+				return mappedLayers[handle.id].get()[static_cast<size_t>(i) * sizeY + j];
+			}
+
+			GridMapDataType& at(const LayerHandle handle, const int i, const int j)
+			{
+#ifdef _OPENMP
+				assert((!omp_in_parallel() || isWritable(handle.id)) &&
+					"Call GridMap::makeWritable before writing a layer from several threads");
+#endif
+				return tiledLayers[handle.id] ? mutableTiledLayer(handle.id).at(i, j) : mutableLayer(handle.id)(i, j);
+			}
+
+			GridMapDataType at(const LayerHandle handle, const Index& idx) const
+			{
+				return at(handle, idx(0), idx(1));
+			}
+
+			GridMapDataType& at(const LayerHandle handle, const Index& idx)
+			{
+				return at(handle, idx(0), idx(1));
+			}
+
 			Size getSize() const;
 
 
@@ -124,13 +331,189 @@ namespace ugr
 			bool isInBounds(const Index& localCoord) const;
 
 
+			/**
+			 * @brief Write the gridmap to a NetCDF-4 file, with each layer as a chunked and deflate
+			 * compressed variable. Georeferenced gridmaps also get CF latitude and longitude coordinates.
+			 * Layers are written one at a time, so at most one layer is copied in memory.
+			 * @param path the path of the file to write
+			 * @throws std::ios_base::failure if the file cannot be written
+			 * @throws std::runtime_error if built without NetCDF support
+			*/
 			void writeToNetCDF(const std::string& path) const;
 
+
+			/**
+			 * @brief Read a gridmap written with #writeToNetCDF
+			 * @param path the path of the file to read
+			 * @return the gridmap, with a layer for each float variable over the grid
+			 * @throws std::ios_base::failure if the file cannot be read
+			 * @throws std::runtime_error if built without NetCDF support
+			*/
+			static GridMap readFromNetCDF(const std::string& path);
+
+
+			/**
+			 * @brief Read the geospatial metadata of a gridmap written with #writeToNetCDF
+			 * @param path the path of the file to read
+			 * @return the metadata, which is empty for non geospatial gridmaps
+			 * @throws std::ios_base::failure if the file cannot be read
+			 * @throws std::runtime_error if built without NetCDF support
+			*/
+			static GridMapFileMetadata readNetCDFMetadata(const std::string& path);
+
+
+			/**
+			 * @brief Write the gridmap to a file in the native binary format, which can be opened
+			 * without parsing or copying with #openBinary. Layer data is stored in page aligned
+			 * blocks of row-major values after a header of the geometry, metadata and layer names.
+			 * @param path the path of the file to write
+			 * @throws std::ios_base::failure if the file cannot be written
+			*/
+			void writeBinary(const std::string& path) const;
+
+
+			/**
+			 * @brief Open a gridmap written with #writeBinary by memory mapping its layers
+			 * @param path the path of the file to open
+			 * @return the gridmap, with layers mapped read only from the file
+			 * @throws std::ios_base::failure if the file cannot be opened or is not a valid gridmap file
+			*/
+			static GridMap openBinary(const std::string& path);
+
+
+			/**
+			 * @brief Read the geospatial metadata of a gridmap written with #writeBinary
+			 * @param path the path of the file to read
+			 * @return the metadata, which is empty for non geospatial gridmaps
+			 * @throws std::ios_base::failure if the file cannot be opened or is not a valid gridmap file
+			*/
+			static GridMapFileMetadata readBinaryMetadata(const std::string& path);
+
 		protected:
 			bool geometrySet = false;
-			int sizeX, sizeY;
+			int sizeX = 0, sizeY = 0;
+
+			// Layers are indexed by handle ID. Each layer is heap allocated, so references to existing
+			// layers stay valid when adding more, and may be shared with other gridmaps.
+			// Exactly one of the dense, tiled and mapped storage is set for each layer. Mapped layers
+			// point into a memory mapped file, which they keep open.
+			std::vector<std::shared_ptr<Matrix>> layers;
+			std::vector<std::shared_ptr<TiledLayer>> tiledLayers;
+			std::vector<std::shared_ptr<const GridMapDataType>> mappedLayers;
+			std::unordered_map<std::string, int> layerIds;
+			std::vector<std::string> layerNames;
+			// Set once a mutable reference to a layer has been returned, so that copies of the map copy
+			// that layer rather than sharing it. Not a vector<bool> so that flags are separate objects.
+			std::vector<char> referencedLayers;
 
-			std::unordered_map<std::string, Matrix> layers;
+			/**
+			 * @brief Add a layer with the given storage if it does not already exist
+			 * @throws std::out_of_range if the geometry is not set
+			*/
+			void insert(const std::string& layerName, std::shared_ptr<Matrix> layerData,
+				std::shared_ptr<TiledLayer> tiledLayerData = nullptr,
+				std::shared_ptr<const GridMapDataType> mappedLayerData = nullptr);
+
+			/**
+			 * @brief Return the metadata to store when writing binary files
+			*/
+			virtual GridMapFileMetadata getFileMetadata() const
+			{
+				return {};
+			}
+
+			/**
+			 * @brief Return the world position of a cell in lon lat order for georeferenced output,
+			 * or nothing if the gridmap has no geospatial reference
+			*/
+			virtual std::optional<Position> cellWorldPosition(const int x, const int y) const
+			{
+				return std::nullopt;
+			}
+
+			/**
+			 * @brief Add the layers of a NetCDF gridmap file.
+			 * If the geometry is not already set it is taken from the file.
+			 * @throws std::ios_base::failure if the file is invalid or its geometry does not match
+			*/
+			void readNetCDFLayers(const std::string& path);
+
+			/**
+			 * @brief Add the layers of a binary gridmap file as read only views of the memory mapped file.
+			 * If the geometry is not already set it is taken from the file.
+			 * @throws std::ios_base::failure if the file is invalid or its geometry does not match
+			*/
+			void mapBinaryLayers(const std::string& path);
+
+			/**
+			 * @brief Return the dense storage of a layer
+			 * @throws std::logic_error if the layer is tiled or mapped
+			*/
+			const Matrix& denseLayer(const int id) const
+			{
+				if (!layers[id])
+				{
+					throw std::logic_error("GridMap layer " + layerNames[id] + " is " +
+						(tiledLayers[id] ? "tiled" : "memory mapped") + " and has no dense matrix");
+				}
+				return *layers[id];
+			}
+
+			/**
+			 * @brief Return a layer for writing, first copying it if it is shared with another gridmap
+			 * or mapped from a file, and mark it as referenced
+			*/
+			Matrix& mutableLayer(const int id)
+			{
+				if (mappedLayers[id])
+				{
+					layers[id] = std::make_shared<Matrix>(ConstMatrixMap(mappedLayers[id].get(), sizeX, sizeY));
+					mappedLayers[id].reset();
+				}
+				denseLayer(id);
+				auto& data = layers[id];
+				if (data.use_count() > 1)
+				{
+					data = std::make_shared<Matrix>(*data);
+				}
+				// Only written once, so that threads writing a layer after #makeWritable do not race
+				if (!referencedLayers[id])
+				{
+					referencedLayers[id] = 1;
+				}
+				return *data;
+			}
+
+			TiledLayer& mutableTiledLayer(const int id)
+			{
+				auto& data = tiledLayers[id];
+				if (data.use_count() > 1)
+				{
+					// Tiles are themselves copy-on-write, so this only copies the tile pointers
+					data = std::make_shared<TiledLayer>(*data);
+				}
+				if (!referencedLayers[id])
+				{
+					referencedLayers[id] = 1;
+				}
+				return *data;
+			}
+
+			/**
+			 * @brief Return whether a layer can be written without copying it or marking it referenced
+			*/
+			bool isWritable(const int id) const
+			{
+				return referencedLayers[id] &&
+					(tiledLayers[id] ? tiledLayers[id].use_count() : layers[id].use_count()) == 1;
+			}
+
+			/**
+			 * @brief Return the layer for a name
+			 * @throws std::out_of_range if the layer does not exist
+			*/
+			const Matrix& layer(const std::string& layerName) const;
+			Matrix& layer(const std::string& layerName);
 		};
 	}
 }
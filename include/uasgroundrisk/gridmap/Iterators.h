@@ -1,8 +1,10 @@
 #ifndef ITERATORS_H
 #define ITERATORS_H
 
-#include "../../../src/utils/GeometryOperations.h"
 #include <memory>
+#include <vector>
+
+#include "uasgroundrisk/gridmap/Rasteriser.h"
 
 #include "uasgroundrisk/map_gen/GeospatialGridMap.h"
 
@@ -73,62 +75,96 @@ namespace ugr
             bool _isPastEnd;
         };
 
+        /**
+         * Iterates the cells of a gridmap with centres inside a polygon. The polygon is rasterised up
+         * front, then its cells are walked span by span.
+         */
         class PolygonIterator
         {
         private:
-            void setup(const GridMap& gridmap, const Polygon& poly)
+            void setup(const Rasteriser& rasteriser, const Rasteriser::SampleMode mode)
             {
-                polygon = poly;
-                const auto polyBounds = util::getPolygonBounds<int>(polygon);
-                boundSize = {polyBounds[3] - polyBounds[1], polyBounds[2] - polyBounds[0]};
-
-                // ReSharper disable once CppSmartPointerVsMakeFunction
-                // Can't forward args through make function
-                boundsIter = std::shared_ptr<SubmapIterator>(
-                    new SubmapIterator(gridmap, {polyBounds[1], polyBounds[0]}, boundSize));
+                spans = rasteriser.rasterise(mode);
+                if (!spans.empty())
+                {
+                    currIndex = {spans.front().x, spans.front().yStart};
+                }
+            }
+
+            static std::vector<Vector> toLocal(const mapping::GeospatialGridMap& gridmap, const GeoPolygon& polygon)
+            {
+                std::vector<Vector> localPolygon;
+                localPolygon.reserve(polygon.size());
+                for (const auto& point : polygon)
+                {
+                    localPolygon.emplace_back(gridmap.world2LocalContinuous(point));
+                }
+                return localPolygon;
             }
 
         public:
-            PolygonIterator(const GridMap& gridmap, const Polygon& polygon)
+            /**
+             * @param mode whether to iterate the cells with centres inside the polygon, or every cell
+             * the polygon covers along with the fraction covered
+             */
+            PolygonIterator(const GridMap& gridmap, const Polygon& polygon,
+                            const Rasteriser::SampleMode mode = Rasteriser::SampleMode::CENTRE)
             {
-                setup(gridmap, polygon);
+                Rasteriser rasteriser(gridmap.getSize());
+                rasteriser.addRing(polygon);
+                setup(rasteriser, mode);
             }
 
 
-            PolygonIterator(const mapping::GeospatialGridMap& gridmap, const GeoPolygon& polygon)
+            PolygonIterator(const mapping::GeospatialGridMap& gridmap, const GeoPolygon& polygon,
+                            const Rasteriser::SampleMode mode = Rasteriser::SampleMode::CENTRE)
             {
-                Polygon localPolygon;
-                localPolygon.reserve(polygon.size());
-                for (const auto& point : polygon)
+                Rasteriser rasteriser(gridmap.getSize());
+                rasteriser.addRing(toLocal(gridmap, polygon));
+                setup(rasteriser, mode);
+            }
+
+            /**
+             * Iterate the cells inside polygons with holes
+             * @param gridmap the gridmap to iterate
+             * @param rings the outer and inner rings of one or more polygons, which are filled with the
+             * even-odd rule
+             * @param mode how cells are sampled
+             */
+            PolygonIterator(const mapping::GeospatialGridMap& gridmap, const std::vector<GeoPolygon>& rings,
+                            const Rasteriser::SampleMode mode = Rasteriser::SampleMode::CENTRE)
+            {
+                Rasteriser rasteriser(gridmap.getSize());
+                for (const auto& ring : rings)
                 {
-                    localPolygon.emplace_back(gridmap.world2Local(point));
+                    rasteriser.addRing(toLocal(gridmap, ring));
                 }
-                setup(gridmap, localPolygon);
+                setup(rasteriser, mode);
             }
 
-            const Index& operator *() const { return *(*boundsIter); }
+            const Index& operator *() const { return currIndex; }
+
+            /**
+             * The fraction of the current cell covered by the polygon, which is always 1 when sampling
+             * cell centres
+             */
+            float coverage() const { return spans[spanIdx].coverage; }
 
             PolygonIterator& operator ++()
             {
-                do
+                if (++currIndex[1] >= spans[spanIdx].yEnd && ++spanIdx < spans.size())
                 {
-                    ++(*boundsIter);
-                    if (isPastEnd())
-                    {
-                        break;
-                    }
+                    currIndex = {spans[spanIdx].x, spans[spanIdx].yStart};
                 }
-                while (!util::isInsidePolygon(polygon, **boundsIter));
-
                 return *this;
             }
 
-            bool isPastEnd() const { return boundsIter->isPastEnd(); }
+            bool isPastEnd() const { return spanIdx >= spans.size(); }
 
         protected:
-            Polygon polygon;
-            std::shared_ptr<SubmapIterator> boundsIter;
-            Size boundSize;
+            std::vector<Rasteriser::Span> spans;
+            size_t spanIdx = 0;
+            Index currIndex;
         };
     }
 }
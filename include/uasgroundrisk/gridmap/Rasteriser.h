@@ -0,0 +1,106 @@
+#ifndef RASTERISER_H
+#define RASTERISER_H
+#include <vector>
+#include "TypeDefs.h"
+
+namespace ugr
+{
+	namespace gridmap
+	{
+		/**
+		 * @brief A scanline polygon rasteriser for gridmaps.
+		 *
+		 * Rings are given in continuous local coordinates, where the cell at index (x, y) covers
+		 * [x, x + 1) x [y, y + 1). Rings are filled with the even-odd rule, so holes and multipolygons
+		 * are rasterised by adding all of their rings. Rings are implicitly closed.
+		 *
+		 * Each row of constant x is scanned against an edge table of the rings, and runs of cells along
+		 * y are emitted directly, matching the row major layout of gridmap matrices. The cost is
+		 * proportional to the edges crossing each row plus the number of cells filled, rather than
+		 * the area of the bounding box times the number of vertices.
+		 *
+		 * Coverage is computed exactly in one pass over the edges crossing each row, by accumulating
+		 * the signed area each edge sweeps in the cells it passes through. Coverage of cells where an
+		 * outer and inner ring overlap with the same orientation is approximate.
+		*/
+		class Rasteriser
+		{
+		public:
+			enum class SampleMode
+			{
+				// A cell is filled if its centre is inside the polygon
+				CENTRE,
+				// Every cell the polygon touches is filled, with the exact fraction of the cell covered
+				COVERAGE
+			};
+
+			/**
+			 * A run of cells in row x, from yStart up to but excluding yEnd, with the same coverage
+			*/
+			struct Span
+			{
+				int x;
+				int yStart;
+				int yEnd;
+				float coverage;
+			};
+
+			/**
+			 * @param size the size of the gridmap, spans are clipped to it
+			*/
+			explicit Rasteriser(const Size& size);
+
+			/**
+			 * Add a ring in continuous local coordinates
+			 * @param ring the vertices of the ring
+			*/
+			void addRing(const std::vector<Vector>& ring);
+
+			/**
+			 * Add a ring in continuous local coordinates from contiguous vertices
+			 * @param vertices the first vertex of the ring
+			 * @param count the number of vertices
+			*/
+			void addRing(const Vector* vertices, size_t count);
+
+			/**
+			 * Add a ring of cell indices. Cells are sampled at their index rather than their centre,
+			 * so a cell is inside if its index is inside the polygon with these vertices
+			 * @param ring the vertices of the ring
+			*/
+			void addRing(const Polygon& ring);
+
+			/**
+			 * Remove all rings
+			*/
+			void clear();
+
+			bool empty() const { return edges.empty(); }
+
+			/**
+			 * Rasterise the rings added so far
+			 * @param mode how cells are sampled
+			 * @return spans of filled cells, ordered by x then y. Spans have a coverage of 1 when
+			 * sampling cell centres
+			*/
+			std::vector<Span> rasterise(SampleMode mode = SampleMode::CENTRE) const;
+
+		private:
+			// An edge with its endpoints ordered by x, and whether they were swapped
+			struct Edge
+			{
+				double x0, y0, x1, y1;
+				double direction;
+			};
+
+			Size size;
+			std::vector<Edge> edges;
+
+			void addEdge(const Vector& a, const Vector& b);
+
+			std::vector<Span> rasteriseCentres() const;
+			std::vector<Span> rasteriseCoverage() const;
+		};
+	}
+}
+#endif // RASTERISER_H
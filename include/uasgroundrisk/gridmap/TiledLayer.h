@@ -0,0 +1,126 @@
+#ifndef TILEDLAYER_H
+#define TILEDLAYER_H
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "TypeDefs.h"
+
+namespace ugr
+{
+	namespace gridmap
+	{
+		/**
+		 * @brief A layer stored as fixed size square tiles, which are only allocated once written to.
+		 *
+		 * Cells in tiles that have not been allocated read as the fill value, so mostly constant layers
+		 * only use memory where they differ from it. Tiles are reference counted and copy-on-write,
+		 * so copies of a layer share tile data until either modifies a tile.
+		*/
+		class TiledLayer
+		{
+		public:
+			// The x and y size of each tile
+			static constexpr int TileSize = 256;
+
+			/**
+			 * @param sizeX the x size of the layer
+			 * @param sizeY the y size of the layer
+			 * @param fillValue the value of cells in unallocated tiles
+			*/
+			TiledLayer(int sizeX, int sizeY, GridMapDataType fillValue = 0);
+
+			/**
+			 * @brief Return the value of the cell at x,y without allocating its tile
+			*/
+			GridMapDataType at(const int i, const int j) const
+			{
+				const auto& tile = tiles[tileIndex(i, j)];
+				return tile ? (*tile)(i % TileSize, j % TileSize) : fillValue;
+			}
+
+			/**
+			 * @brief Return a reference to the cell at x,y, allocating or copying its tile if needed
+			*/
+			GridMapDataType& at(const int i, const int j)
+			{
+				auto& tile = tiles[tileIndex(i, j)];
+				if (!tile)
+				{
+					tile = std::make_shared<Matrix>(Matrix::Constant(TileSize, TileSize, fillValue));
+				}
+				else if (tile.use_count() > 1)
+				{
+					tile = std::make_shared<Matrix>(*tile);
+				}
+				return (*tile)(i % TileSize, j % TileSize);
+			}
+
+			/**
+			 * @brief Set every cell to a value, releasing all tiles
+			*/
+			void setConstant(GridMapDataType value);
+
+			/**
+			 * @brief Give this layer its own copy of every allocated tile, so that references into the
+			 * tiles of the layer it was copied from do not write to it
+			*/
+			void copyTiles();
+
+			/**
+			 * @brief Return the layer as a dense matrix
+			*/
+			Matrix toDense() const;
+
+			/**
+			 * @brief Set each cell of a dense matrix of the same size to the max of itself and this layer
+			*/
+			void cwiseMaxInto(Matrix& dense) const;
+
+			GridMapDataType getFillValue() const
+			{
+				return fillValue;
+			}
+
+			Size getSize() const
+			{
+				return { sizeX, sizeY };
+			}
+
+			/**
+			 * @brief Return the number of tiles that have been allocated
+			*/
+			size_t getAllocatedTiles() const;
+
+		protected:
+			int sizeX, sizeY;
+			int tilesX, tilesY;
+			GridMapDataType fillValue;
+			// Tiles in row-major order, null where not allocated. Edge tiles are full size for simplicity
+			std::vector<std::shared_ptr<Matrix>> tiles;
+
+			int tileIndex(const int i, const int j) const
+			{
+				return (i / TileSize) * tilesY + j / TileSize;
+			}
+
+			/**
+			 * @brief Call f(tile, block) for every tile, where tile is null if not allocated and block is the
+			 * matching block of a dense matrix the size of the layer
+			*/
+			template <typename F>
+			void forEachTile(Matrix& dense, F f) const
+			{
+				for (int tx = 0; tx < tilesX; ++tx)
+				{
+					for (int ty = 0; ty < tilesY; ++ty)
+					{
+						const int rows = std::min(TileSize, sizeX - tx * TileSize);
+						const int cols = std::min(TileSize, sizeY - ty * TileSize);
+						f(tiles[tx * tilesY + ty].get(), dense.block(tx * TileSize, ty * TileSize, rows, cols));
+					}
+				}
+			}
+		};
+	}
+}
+#endif // TILEDLAYER_H
@@ -12,6 +12,8 @@ namespace ugr
         typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::AutoAlign | Eigen::RowMajor> Matrix;
         // The Scalar data type of the Matrix
         typedef Matrix::Scalar GridMapDataType;
+        // A read only view of Matrix data owned elsewhere
+        typedef Eigen::Map<const Matrix> ConstMatrixMap;
 
         // A Geospatial position in world coordinates in lon lat or xy order
         typedef Eigen::Vector2d Position;
@@ -8,6 +8,7 @@
 #define UASGROUNDRISK_SRC_MAP_GEN_GEOSPATIALGRIDMAP_H_
 
 #include <array>
+#include <string>
 #include <proj.h>
 
 #include "uasgroundrisk/gridmap/GridMap.h"
@@ -36,6 +37,25 @@ namespace ugr
 
 			std::array<float, 4> getBounds() const { return bounds; }
 			float getResolution() const { return xyRes; }
+			const std::string& getWorldSrs() const { return worldSrs; }
+			const std::string& getProjectionSrs() const { return projectionSrs; }
+
+			/**
+			 * @brief Open a geospatial gridmap written with GridMap#writeBinary by memory mapping its layers
+			 * @param path the path of the file to open
+			 * @return the gridmap, with layers mapped read only from the file
+			 * @throws std::ios_base::failure if the file cannot be opened or is not a valid geospatial gridmap file
+			*/
+			static GeospatialGridMap openBinary(const std::string& path);
+
+			/**
+			 * @brief Read a geospatial gridmap written with GridMap#writeToNetCDF
+			 * @param path the path of the file to read
+			 * @return the gridmap
+			 * @throws std::ios_base::failure if the file cannot be read or has no geospatial reference
+			 * @throws std::runtime_error if built without NetCDF support
+			*/
+			static GeospatialGridMap readFromNetCDF(const std::string& path);
 
 			/**
 			 * @brief Return the value of the coefficient at x,y on the given layer
@@ -64,6 +84,14 @@ namespace ugr
 			*/
 			Index world2Local(double lon, double lat) const;
 
+			/**
+			 * @brief Reproject world (EPSG:4326) coordinates to continuous local coordinates, where the cell
+			 * at each index covers [x, x + 1) x [y, y + 1)
+			 * @param worldCoord the world coordinates to reproject
+			 * @return the local coordinates
+			*/
+			Vector world2LocalContinuous(const Position& worldCoord) const;
+
 
 			/**
 			 * @brief Reproject local indices to world (EPSG:4326) coordinates
@@ -85,10 +113,16 @@ namespace ugr
 		protected:
 			void setBounds(std::array<float, 4> boundsArr, float resolution);
 
+			GridMapFileMetadata getFileMetadata() const override;
+
+			std::optional<Position> cellWorldPosition(int x, int y) const override;
+
 			std::array<float, 4> bounds;
 
 			float xyRes;
 
+			std::string worldSrs, projectionSrs;
+
 			Vector3d projectionOrigin; // The origin in local projection coords
 
 			PJ* reproj;
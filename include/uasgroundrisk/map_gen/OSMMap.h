@@ -4,6 +4,9 @@
 #include <uasgroundrisk/map_gen/GeospatialGridMap.h>
 #include "uasgroundrisk/map_gen/osm/OSMOverpassQueryBuilder.h"
 #include "uasgroundrisk/map_gen/osm/OSMOverpassQuery.h"
+#include "uasgroundrisk/map_gen/osm/OSMDataSource.h"
+#include "uasgroundrisk/map_gen/osm/OSMFileQuery.h"
+#include "uasgroundrisk/map_gen/osm/OSMSession.h"
 #include "uasgroundrisk/map_gen/osm/handlers/DefaultNodeLocationsForWaysHandler.h"
 #include "uasgroundrisk/map_gen/osm/OSMTag.h"
 
@@ -21,6 +24,37 @@ namespace ugr
                              const std::vector<osm::OSMTag>& tags,
                              float defaultValue = 0);
 
+			/**
+			 * Set whether OSM layers added after this are stored as tiles, which only use memory
+			 * where features exist. This suits large maps with sparse features.
+			 * @param tiled whether to store OSM layers as tiles
+			 */
+			void setTiledStorage(const bool tiled)
+			{
+				tiledStorage = tiled;
+			}
+
+			bool isTiledStorage() const
+			{
+				return tiledStorage;
+			}
+
+			/**
+			 * Set where OSM data is read from when the map is evaluated. Defaults to querying Overpass.
+			 * A local file lets large areas be built offline, it must cover the map bounds.
+			 * @param source the OSM data source
+			 */
+			void setDataSource(const osm::OSMDataSource& source)
+			{
+				dataSource = source;
+				isEvaluated = false;
+			}
+
+			const osm::OSMDataSource& getDataSource() const
+			{
+				return dataSource;
+			}
+
 			template <typename... THandlers>
 			void eval(THandlers&&...handlers)
 			{
@@ -33,21 +67,46 @@ namespace ugr
 					return;
 				}
 
-                osm::OSMOverpassQueryBuilder builder(Coordinates(bounds[1], bounds[0]),
-                                                     Coordinates(bounds[3], bounds[2]));
+                std::vector<osm::OSMTag> tags;
                 for (const auto& tagLayerPair : tagLayerMap)
                 {
-                    builder.withNodeTag(tagLayerPair.first).withWayTag(tagLayerPair.first).withRelationTag(
-                        tagLayerPair.first);
+                    tags.push_back(tagLayerPair.first);
                 }
-
-                osm::OSMOverpassQuery query = builder.build();
-                query.makeQuery(handlers...);
+                osm::queryOSMData(dataSource, Coordinates(bounds[1], bounds[0]), Coordinates(bounds[3], bounds[2]),
+                                  tags, handlers...);
             }
 
 		protected:
+			friend class osm::OSMSession;
+
 			std::map<osm::OSMTag, std::string> tagLayerMap;
 			bool isEvaluated = false;
+			bool tiledStorage = false;
+			osm::OSMDataSource dataSource = osm::OSMDataSource::overpass();
+
+			/**
+			 * Add a layer for OSM features, using the storage selected with setTiledStorage
+			 */
+			void addFeatureLayer(const std::string& layerName, float fillValue);
+
+			/**
+			 * Prepare the map to receive OSM data read by a shared osm::OSMSession.
+			 * @return the handler writing OSM features to this map, or null if the map does not take
+			 * OSM data from a session, in which case it is evaluated on its own with eval()
+			 */
+			virtual std::unique_ptr<osm::OSMEntityHandler> makeSessionHandler()
+			{
+				return nullptr;
+			}
+
+			/**
+			 * Finish evaluating the map once a shared osm::OSMSession has passed all OSM data to the
+			 * handler from makeSessionHandler
+			 */
+			virtual void finishSessionEval()
+			{
+				isEvaluated = true;
+			}
 		};
 	}
 }
@@ -38,6 +38,16 @@ namespace ugr
 		protected:
 			std::map<GEOSGeometry*, GridMapDataType> popDensityGeomMap;
 			std::map<osm::OSMTag, GridMapDataType> densityTagMap;
+
+			/**
+			 * Combine all layers into the dense "Population Density" layer by taking the
+			 * max density of each cell
+			 */
+			void combineDensityLayers();
+
+			std::unique_ptr<osm::OSMEntityHandler> makeSessionHandler() override;
+
+			void finishSessionEval() override;
 		};
 	} // namespace mapping
 } // namespace ugr
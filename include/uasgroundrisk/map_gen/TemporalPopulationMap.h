@@ -1,6 +1,7 @@
 #ifndef UGR_TEMPORALPOPULATIONMAP_H
 #define UGR_TEMPORALPOPULATIONMAP_H
 #include "uasgroundrisk/map_gen/PopulationMap.h"
+#include "uasgroundrisk/gridmap/GeometryArena.h"
 
 namespace ugr
 {
@@ -18,6 +19,11 @@ namespace ugr
             //                  const std::vector<osm::OSMTag>& tags,
             //                  float defaultValue) override = delete;
 
+            /**
+             * Set the hour of day of the population. Geometries are only rasterised on the first
+             * evaluation, so evaluating at another hour only recombines the densities of each NHAPS group
+             * @param hourOfDay the hour of day from 0 to 23
+             */
             void setHourOfDay(const short hourOfDay);
 
             std::vector<double> calculateAreas(const std::vector<GEOSGeometry*>& geoms) const;
@@ -31,6 +37,14 @@ namespace ugr
 
             void eval() override;
 
+            /**
+             * Evaluate the population density at several hours of the day. The geometries are only
+             * rasterised once, and the "Population Density" layer stays at the set hour of day
+             * @param hours the hours of day from 0 to 23
+             * @return the population density at each hour, in the order of the hours
+             */
+            std::vector<Matrix> evalHours(const std::vector<short>& hours);
+
         protected:
             short hourOfDay;
             int totalPopulation;
@@ -42,6 +56,64 @@ namespace ugr
             std::map<GEOSGeometry*, GridMapDataType> activeGeomDensityMap;
             std::map<osm::OSMTag, std::vector<GEOSGeometry*>> tagGeomMap;
             std::map<osm::OSMTag, double> tagAreas;
+            // An index of boundedGeometries, which are the keys of activeGeomDensityMap
+            GEOSSTRtree* censusTree = nullptr;
+            // The density of each NHAPS group if the entire population were in it, the max of the layers
+            // of its tags, followed by the max of any layers not in a group. Empty until rasterised
+            std::vector<Matrix> groupDensities;
+
+            /**
+             * Set the geometry and tag densities to those of the entire population being in each NHAPS
+             * group, which the proportions of each hour scale
+             */
+            void setUnitDensities();
+
+            /**
+             * Rasterise the geometries of every tag into its layer and combine the layers of each NHAPS group
+             */
+            void rasterise();
+
+            /**
+             * Combine the group densities scaled by the proportions at an hour of day
+             */
+            Matrix combineGroupDensities(short hour) const;
+
+            /**
+             * Build an STR tree of geometries, whose items are the geometries themselves
+             */
+            GEOSSTRtree* makeTree(const std::vector<GEOSGeometry*>& geoms) const;
+
+            /**
+             * @return the geometries in a tree with envelopes intersecting the envelope of a geometry
+             */
+            std::vector<GEOSGeometry*> queryTree(GEOSSTRtree* tree, const GEOSGeometry* geom) const;
+
+            // The layer and density a polygon is rasterised with in eval
+            struct PolygonDensity
+            {
+                LayerHandle layer;
+                GridMapDataType density;
+            };
+
+            /**
+             * Collect the exterior ring of a polygon to be rasterised with the others in eval
+             */
+            void addGridMapPoly(GeometryArena<PolygonDensity>& polygons, LayerHandle layer,
+                                const GEOSGeometry* geom, GridMapDataType geomDensity) const;
+
+            /**
+             * Write a density to a cell covered by a polygon, weighted by the fraction covered on its boundary
+             */
+            void writeCoverage(LayerHandle layer, const Index& gridMapPoint, GridMapDataType geomDensity,
+                               float coverage);
+
+            /**
+             * OSM data is read once on construction, so evaluation does not take part in shared sessions
+             */
+            std::unique_ptr<osm::OSMEntityHandler> makeSessionHandler() override
+            {
+                return nullptr;
+            }
         };
     }
 }
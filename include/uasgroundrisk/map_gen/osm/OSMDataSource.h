@@ -0,0 +1,64 @@
+/*
+ * OSMDataSource.h
+ */
+
+#ifndef UASGROUNDRISK_SRC_MAP_GEN_OSMDATASOURCE_H_
+#define UASGROUNDRISK_SRC_MAP_GEN_OSMDATASOURCE_H_
+
+#include <string>
+#include <utility>
+
+namespace ugr
+{
+    namespace mapping
+    {
+        namespace osm
+        {
+            /**
+             * Where an OSMMap gets its OSM data from when evaluated.
+             *
+             * Data is either queried from Overpass, or read from a local .osm.pbf or .osm extract
+             * which must cover the bounds of the map.
+             */
+            class OSMDataSource
+            {
+            public:
+                enum class Type
+                {
+                    OVERPASS,
+                    LOCAL_FILE
+                };
+
+                /**
+                 * @return a data source querying the public Overpass instances
+                 */
+                static OSMDataSource overpass()
+                {
+                    return {Type::OVERPASS, ""};
+                }
+
+                /**
+                 * @param path the path of a local OSM file. The format is detected from the file suffix,
+                 * such as .osm.pbf, .osm or .osm.bz2
+                 * @return a data source reading the local file
+                 */
+                static OSMDataSource file(std::string path)
+                {
+                    return {Type::LOCAL_FILE, std::move(path)};
+                }
+
+                Type getType() const { return type; }
+                const std::string& getPath() const { return path; }
+
+            private:
+                Type type;
+                std::string path;
+
+                OSMDataSource(const Type type, std::string path) : type(type), path(std::move(path))
+                {
+                }
+            };
+        }
+    }
+}
+#endif // UASGROUNDRISK_SRC_MAP_GEN_OSMDATASOURCE_H_
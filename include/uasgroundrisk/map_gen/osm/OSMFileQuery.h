@@ -0,0 +1,196 @@
+/*
+ * OSMFileQuery.h
+ */
+
+#ifndef UASGROUNDRISK_SRC_MAP_GEN_OSMFILEQUERY_H_
+#define UASGROUNDRISK_SRC_MAP_GEN_OSMFILEQUERY_H_
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include <osmium/geom/coordinates.hpp>
+#include <osmium/handler.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/osm/box.hpp>
+#include <osmium/tags/tags_filter.hpp>
+#include <osmium/visitor.hpp>
+
+#include <osmium/area/assembler.hpp>
+#include <osmium/area/multipolygon_manager.hpp>
+#include <osmium/relations/manager_util.hpp>
+
+#include "uasgroundrisk/map_gen/osm/OSMTag.h"
+#include "handlers/DefaultNodeLocationsForWaysHandler.h"
+
+namespace ugr
+{
+    namespace mapping
+    {
+        namespace osm
+        {
+            /**
+             * Create a filter matching any of the tags
+             * @param tags the tags to match. A tag without a value matches any value
+             */
+            osmium::TagsFilter makeTagsFilter(const std::vector<OSMTag>& tags);
+
+            /**
+             * @return whether any of the tags match the filter
+             */
+            inline bool matchesTagsFilter(const osmium::TagList& tags, const osmium::TagsFilter& tagsFilter)
+            {
+                return std::any_of(tags.begin(), tags.end(), std::cref(tagsFilter));
+            }
+
+            /**
+             * @return whether a valid envelope overlaps the bounds
+             */
+            inline bool envelopeIntersects(const osmium::Box& envelope, const osmium::Box& bounds)
+            {
+                return envelope.valid()
+                    && envelope.bottom_left().x() <= bounds.top_right().x()
+                    && envelope.top_right().x() >= bounds.bottom_left().x()
+                    && envelope.bottom_left().y() <= bounds.top_right().y()
+                    && envelope.top_right().y() >= bounds.bottom_left().y();
+            }
+
+            /**
+             * Forwards OSM objects to other handlers only if they match the tags filter and lie at least
+             * partly within the bounds.
+             *
+             * Ways must have their node locations set before reaching this handler.
+             */
+            template <typename... THandlers>
+            class BoundedTagsFilterHandler : public osmium::handler::Handler
+            {
+            public:
+                BoundedTagsFilterHandler(const osmium::TagsFilter& tagsFilter, const osmium::Box& bounds,
+                                         THandlers&... handlers)
+                    : tagsFilter(tagsFilter), bounds(bounds), handlers(handlers...)
+                {
+                }
+
+                void node(const osmium::Node& node)
+                {
+                    if (bounds.contains(node.location()) && matches(node.tags()))
+                    {
+                        std::apply([&node](auto&... handler) { (handler.node(node), ...); }, handlers);
+                    }
+                }
+
+                void way(const osmium::Way& way)
+                {
+                    if (matches(way.tags()) && intersects(way.envelope()))
+                    {
+                        std::apply([&way](auto&... handler) { (handler.way(way), ...); }, handlers);
+                    }
+                }
+
+                void area(const osmium::Area& area)
+                {
+                    // Areas are only assembled from relations already filtered by the multipolygon manager
+                    if (intersects(area.envelope()))
+                    {
+                        std::apply([&area](auto&... handler) { (handler.area(area), ...); }, handlers);
+                    }
+                }
+
+                void flush()
+                {
+                    std::apply([](auto&... handler) { (handler.flush(), ...); }, handlers);
+                }
+
+            private:
+                const osmium::TagsFilter& tagsFilter;
+                const osmium::Box bounds;
+                std::tuple<THandlers&...> handlers;
+
+                bool matches(const osmium::TagList& tags) const
+                {
+                    return matchesTagsFilter(tags, tagsFilter);
+                }
+
+                bool intersects(const osmium::Box& envelope) const
+                {
+                    return envelopeIntersects(envelope, bounds);
+                }
+            };
+
+            /**
+             * A query for OSM features from a local OSM file, such as a regional .osm.pbf extract.
+             *
+             * This is a drop in alternative to OSMOverpassQuery for building maps offline. The file is
+             * streamed rather than loaded, with PBF blocks decoded in parallel by the libosmium thread
+             * pool, so large extracts can be read at disk speed. Only features with one of the query
+             * tags within the query bounds are passed to the handlers.
+             */
+            class OSMFileQuery
+            {
+            public:
+                /**
+                 * @param path the path of the OSM file. The format is detected from the file suffix
+                 * @param southWestCoord south west most coordinate of the bounding box
+                 * @param northEastCoord north east most coordinate of the bounding box
+                 * @param tags the tags of features to pass to handlers. A tag without a value matches any value
+                 * @throws std::ios_base::failure if the file does not exist
+                 */
+                OSMFileQuery(std::string path, const osmium::geom::Coordinates& southWestCoord,
+                             const osmium::geom::Coordinates& northEastCoord,
+                             const std::vector<OSMTag>& tags);
+
+                /**
+                 * Read the file, applying handlers to matching features.
+                 * @param ...handlers zero or more osmium::handler::Handler instances to be
+                 * applied to matching features
+                 */
+                template <typename... THandlers>
+                void makeQuery(THandlers&&...handlers) const
+                {
+                    osmium::area::AssemblerConfig assemblerConfig;
+                    assemblerConfig.ignore_invalid_locations = true;
+                    assemblerConfig.create_way_polygons = false; // These are handled as normal ways in the handler
+                    assemblerConfig.create_empty_areas = true;
+                    // Only multipolygon relations with a query tag have their members kept in memory
+                    osmium::area::MultipolygonManager<osmium::area::Assembler> multipolygonManager{
+                        assemblerConfig, tagsFilter
+                    };
+
+                    osm::DefaultNodeLocationsForWaysHandler n2wHandler;
+                    n2wHandler.ignore_errors();
+
+                    BoundedTagsFilterHandler<std::remove_reference_t<THandlers>...> filterHandler{
+                        tagsFilter, bounds, handlers...
+                    };
+
+                    const osmium::io::File f = openFile();
+
+                    osmium::relations::read_relations(f, multipolygonManager);
+
+                    // Object metadata is not needed, skipping it speeds up decoding
+                    osmium::io::Reader reader{f, osmium::osm_entity_bits::all, osmium::io::read_meta::no};
+                    osmium::apply(reader, n2wHandler, multipolygonManager.handler(), filterHandler);
+                    reader.close();
+                    osmium::apply(multipolygonManager.buffer(), filterHandler);
+                }
+
+                const std::string& getPath() const { return path; }
+
+            private:
+                std::string path;
+                osmium::Box bounds;
+                osmium::TagsFilter tagsFilter;
+
+                /**
+                 * Open the file, registering the input formats
+                 */
+                osmium::io::File openFile() const;
+            };
+        }
+    }
+}
+#endif // UASGROUNDRISK_SRC_MAP_GEN_OSMFILEQUERY_H_
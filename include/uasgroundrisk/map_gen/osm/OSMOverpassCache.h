@@ -0,0 +1,127 @@
+/*
+ * OSMOverpassCache.h
+ */
+
+#ifndef UASGROUNDRISK_SRC_MAP_GEN_OSMOVERPASSCACHE_H_
+#define UASGROUNDRISK_SRC_MAP_GEN_OSMOVERPASSCACHE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace ugr
+{
+    namespace mapping
+    {
+        namespace osm
+        {
+            /**
+             * A persistent on-disk cache of Overpass responses, keyed by a hash of the query string.
+             *
+             * Each entry is a response file named by the query hash, alongside a metadata file holding
+             * the full query to guard against hash collisions. The metadata file is written once when
+             * the response is stored, so its modification time gives the age of the entry for expiry.
+             * The response file modification time is updated on every hit, so it gives the last use of
+             * the entry for least recently used eviction when the cache grows past its maximum size.
+             *
+             * Responses are stored in the XML format Overpass returns, or in PBF once they have been
+             * converted, which osmium decodes much faster than XML. An entry only has one of these.
+             *
+             * Entries are written to a temporary file and renamed into place, so several processes can
+             * share a cache directory. Storing entries never evicts others, so responses stay in place while
+             * they are read, and evict is called once they have been.
+             */
+            class OSMOverpassCache
+            {
+            public:
+                /**
+                 * @param directory the cache directory, which is created if needed. An empty directory disables the cache
+                 * @param ttl the maximum age of entries. Zero disables expiry
+                 * @param maxBytes the maximum total size of responses in the cache. Zero disables eviction
+                 * @param offline whether to only serve responses from the cache, without querying Overpass
+                 */
+                OSMOverpassCache(std::string directory, std::chrono::seconds ttl, uint64_t maxBytes, bool offline);
+
+                /**
+                 * Create a cache configured by the environment variables:
+                 *  - UGR_OVERPASS_CACHE_DIR the cache directory. Caching is disabled if this is unset or empty
+                 *  - UGR_OVERPASS_CACHE_TTL the maximum age of entries in seconds. Defaults to one week
+                 *  - UGR_OVERPASS_CACHE_MAX_MB the maximum size of the cache in MiB. Defaults to 1024
+                 *  - UGR_OVERPASS_OFFLINE set to 1 to only serve responses from the cache
+                 * @return the cache
+                 */
+                static OSMOverpassCache fromEnvironment();
+
+                /**
+                 * Hash a query string with 64 bit FNV-1a
+                 * @param query the query string
+                 * @return the hash as a 16 character hex string
+                 */
+                static std::string hashKey(const std::string& query);
+
+                /**
+                 * Get the osmium format of a cached response file from its extension
+                 * @param path the path of the response file
+                 * @return "pbf" or "xml"
+                 */
+                static std::string responseFormat(const std::string& path);
+
+                /**
+                 * Find the cached response for a query, marking it as recently used
+                 * @param query the query string
+                 * @return the path of the response file, or an empty string if there is no valid entry
+                 */
+                std::string lookup(const std::string& query) const;
+
+                /**
+                 * Store the response for a query
+                 * @param query the query string
+                 * @param response the response text
+                 * @return the path of the stored response file
+                 */
+                std::string store(const std::string& query, const std::string& response) const;
+
+                /**
+                 * Store the response for a query from a file written to a path from newTempPath, which is
+                 * moved into the cache. This replaces a response stored in the other format
+                 * @param query the query string
+                 * @param responseFile the path of the response file
+                 * @param format the format of the response file, "xml" or "pbf"
+                 * @return the path of the stored response file
+                 */
+                std::string storeFile(const std::string& query, const std::string& responseFile,
+                                      const std::string& format = "xml") const;
+
+                /**
+                 * Create a unique path in the cache directory to write a response to before storing it with
+                 * storeFile. Keeping the file in the cache directory lets it be moved into place atomically
+                 * @param query the query string
+                 * @return the temporary path
+                 */
+                std::string newTempPath(const std::string& query) const;
+
+                /**
+                 * Remove expired entries, then the least recently used entries until the cache fits in its
+                 * maximum size. Temporary files left by processes stopped while writing are also removed
+                 * once unmodified for an hour, or the TTL if longer.
+                 * Call this once stored responses have been read, as they may be removed
+                 */
+                void evict() const;
+
+                bool isEnabled() const { return !directory.empty(); }
+                bool isOffline() const { return offline; }
+                const std::string& getDirectory() const { return directory; }
+
+            private:
+                std::string directory;
+                std::chrono::seconds ttl;
+                uint64_t maxBytes;
+                bool offline;
+
+                std::string responsePath(const std::string& key, const std::string& format = "xml") const;
+                std::string metadataPath(const std::string& key) const;
+            };
+        }
+    }
+}
+#endif // UASGROUNDRISK_SRC_MAP_GEN_OSMOVERPASSCACHE_H_
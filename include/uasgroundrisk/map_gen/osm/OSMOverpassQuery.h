@@ -7,13 +7,24 @@
 #ifndef UASGROUNDRISK_SRC_MAP_GEN_OSMOVERPASSQUERY_H_
 #define UASGROUNDRISK_SRC_MAP_GEN_OSMOVERPASSQUERY_H_
 
+#include <exception>
+#include <functional>
+#include <memory>
 #include <ostream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+#include <utility>
 #include <cpr/cpr.h>
 #include <osmium/geom/coordinates.hpp>
 #include <osmium/handler.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/io/reader.hpp>
 #include <osmium/memory/buffer.hpp>
 #include <osmium/visitor.hpp>
 #include "uasgroundrisk/map_gen/osm/OSMTag.h"
+#include "uasgroundrisk/map_gen/osm/OSMOverpassCache.h"
+#include "uasgroundrisk/map_gen/osm/OverpassEndpointPool.h"
 
 #include <osmium/area/assembler.hpp>
 #include <osmium/area/multipolygon_manager.hpp>
@@ -31,6 +42,148 @@ namespace ugr
         {
             class OSMOverpassQueryBuilder;
 
+            /**
+             * Runs both multipolygon manager passes over a single stream of OSM data, which must have
+             * all relations before any nodes or ways, as in Overpass responses.
+             *
+             * Relations are collected by the manager first, then the remaining objects are passed to
+             * its second pass. Assembled areas are passed straight to the callback given to the
+             * manager handler, so no part of the stream needs to be read twice.
+             */
+            template <typename TManager>
+            class RelationsFirstHandler : public osmium::handler::Handler
+            {
+            public:
+                RelationsFirstHandler(TManager& manager,
+                                      const std::function<void(osmium::memory::Buffer&&)>& areaCallback)
+                    : manager(manager), secondPass(manager.handler(areaCallback))
+                {
+                }
+
+                void relation(const osmium::Relation& relation)
+                {
+                    if (prepared)
+                    {
+                        throw std::runtime_error("Streamed OSM data has relations after nodes or ways");
+                    }
+                    manager.relation(relation);
+                }
+
+                void node(const osmium::Node& node)
+                {
+                    prepare();
+                    secondPass.node(node);
+                }
+
+                void way(osmium::Way& way)
+                {
+                    prepare();
+                    secondPass.way(way);
+                }
+
+                void flush()
+                {
+                    secondPass.flush();
+                }
+
+            private:
+                TManager& manager;
+                decltype(std::declval<TManager&>().handler()) secondPass;
+                bool prepared = false;
+
+                void prepare()
+                {
+                    if (!prepared)
+                    {
+                        manager.prepare_for_lookup();
+                        prepared = true;
+                    }
+                }
+            };
+
+            /**
+             * Forwards each OSM object to other handlers only the first time its ID is seen, so data from
+             * overlapping responses can be merged
+             */
+            template <typename... THandlers>
+            class UniqueObjectsHandler : public osmium::handler::Handler
+            {
+            public:
+                explicit UniqueObjectsHandler(THandlers&... handlers) : handlers(handlers...)
+                {
+                }
+
+                void node(const osmium::Node& node)
+                {
+                    if (nodeIds.insert(node.id()).second)
+                    {
+                        std::apply([&node](auto&... handler) { (handler.node(node), ...); }, handlers);
+                    }
+                }
+
+                void way(osmium::Way& way)
+                {
+                    if (wayIds.insert(way.id()).second)
+                    {
+                        std::apply([&way](auto&... handler) { (handler.way(way), ...); }, handlers);
+                    }
+                }
+
+                void relation(const osmium::Relation& relation)
+                {
+                    if (relationIds.insert(relation.id()).second)
+                    {
+                        std::apply([&relation](auto&... handler) { (handler.relation(relation), ...); }, handlers);
+                    }
+                }
+
+                void flush()
+                {
+                    std::apply([](auto&... handler) { (handler.flush(), ...); }, handlers);
+                }
+
+            private:
+                std::tuple<THandlers&...> handlers;
+                std::unordered_set<osmium::object_id_type> nodeIds;
+                std::unordered_set<osmium::object_id_type> wayIds;
+                std::unordered_set<osmium::object_id_type> relationIds;
+            };
+
+            /**
+             * An Overpass response for osmium to read. This is either a cached response file, or a
+             * response streamed through a pipe while it is downloaded by a background thread, so
+             * the response is parsed as it arrives without being held in memory or written to disk
+             * first.
+             */
+            class OverpassResponseStream
+            {
+            public:
+                ~OverpassResponseStream();
+
+                OverpassResponseStream(const OverpassResponseStream& other) = delete;
+                OverpassResponseStream& operator=(const OverpassResponseStream& other) = delete;
+
+                const osmium::io::File& getFile() const { return file; }
+
+                /**
+                 * Wait for the download to finish, abandoning any of the response that has not been read
+                 * @throws overpass_network_exception if the download failed
+                 */
+                void finish();
+
+            private:
+                friend class OSMOverpassQuery;
+
+                OverpassResponseStream() = default;
+
+                osmium::io::File file;
+                std::thread downloader;
+                int readFd = -1;
+                std::exception_ptr error;
+
+                void closeRead();
+            };
+
             class OSMOverpassQuery
             {
                 Coordinates southWestCoord;
@@ -45,6 +198,26 @@ namespace ugr
                 short int timeout =
                     90; // set a timeout in seconds for the query to return a response
 
+                OSMOverpassCache cache = OSMOverpassCache::fromEnvironment();
+
+                // Bounds larger than this in either direction are split into quad tiles, in degrees
+                double maxTileSize = 0.25;
+                // The maximum number of tiles fetched at once
+                int maxConcurrentRequests = 4;
+
+            public:
+                inline static const std::vector<std::string> OVERPASS_ENDPOINTS{
+                        "https://overpass.kumi.systems/api/interpreter",
+                        "https://overpass.openstreetmap.ru/api/interpreter",
+                        "https://maps.mail.ru/osm/tools/overpass/api/interpreter",
+                        "https://overpass-api.de/api/interpreter"
+                };
+
+            private:
+                // Shared between copies of the query, so tiles fetched concurrently share endpoint health
+                std::shared_ptr<OverpassEndpointPool> endpoints = std::make_shared<OverpassEndpointPool>(
+                    OVERPASS_ENDPOINTS);
+
                 OSMOverpassQuery(const Coordinates& southWestCoord,
                                  const Coordinates& northEastCoord)
                     : southWestCoord(southWestCoord), northEastCoord(northEastCoord)
@@ -67,11 +240,19 @@ namespace ugr
                                                       const Coordinates& northEastCoord);
 
                 /**
- * Execute a GET request to an Overpass instance
- * @return XML response text
+ * Execute a GET request to an Overpass instance, or read the response from the cache
+ * @return XML response text, converted back from PBF if the cached response has been converted
  */
                 std::string rawResponse(short int maxRetries = 4) const;
 
+                /**
+ * Set the cache used for responses, replacing the one configured by the environment. Responses are
+ * not cached unless UGR_OVERPASS_CACHE_DIR is set or a cache is set here
+ * @param overpassCache the cache
+ */
+                void setCache(const OSMOverpassCache& overpassCache) { cache = overpassCache; }
+                const OSMOverpassCache& getCache() const { return cache; }
+
                 /**
  * Build an Overpass bbox query string from the current object state
  * @return overpass query string
@@ -85,14 +266,33 @@ namespace ugr
  */
                 osmium::memory::Buffer rawBuffer() const;
 
+                /**
+ * Split the query bounds into a grid of quad tiles no larger than the maximum tile size
+ * @return a query for each tile
+ */
+                std::vector<OSMOverpassQuery> splitTiles() const;
+
                 /*
  * Perform Overpass query, applying handlers.
+ *
+ * Queries with bounds larger than the maximum tile size are split into tiles, which are fetched
+ * concurrently then merged, with each OSM object passed to the handlers once.
  * @param ...handlers zero or more osmium::handler::Handler instances to be
  * applied to result
  */
                 template <typename... THandlers>
                 void makeQuery(THandlers&&...handlers)
                 {
+                    auto tiles = splitTiles();
+                    if (tiles.size() > 1)
+                    {
+                        fetchTiles(tiles);
+                        applyTiles(tiles, handlers...);
+                        // Evict once all the tiles have been read, so no tile is removed before it is used
+                        cache.evict();
+                        return;
+                    }
+
                     osmium::area::AssemblerConfig assemblerConfig;
                     assemblerConfig.ignore_invalid_locations = true;
                     assemblerConfig.create_way_polygons = false; // These are handled as normal ways in the handler
@@ -104,34 +304,126 @@ namespace ugr
                     osm::DefaultNodeLocationsForWaysHandler n2wHandler;
                     n2wHandler.ignore_errors();
 
-                    rawResponse();
-                    const osmium::io::File f{responseFilepath};
-
-                    read_relations(f, multipolygonManager);
+                    const auto applyAreas = [&handlers...](osmium::memory::Buffer&& buffer)
+                    {
+                        osmium::apply(buffer, handlers...);
+                    };
+                    RelationsFirstHandler<decltype(multipolygonManager)> relationsHandler{
+                        multipolygonManager, applyAreas
+                    };
 
-                    osmium::io::Reader reader{f, osmium::osm_entity_bits::all};
-                    osmium::apply(reader, n2wHandler, multipolygonManager.handler(),
-                                  std::forward<THandlers>(handlers)...);
-                    osmium::apply(multipolygonManager.buffer(), std::forward<THandlers>(handlers)...);
+                    const auto response = openResponseStream();
+                    try
+                    {
+                        osmium::io::Reader reader{response->getFile(), osmium::osm_entity_bits::all};
+                        osmium::apply(reader, n2wHandler, relationsHandler, handlers...);
+                        reader.close();
+                    }
+                    catch (...)
+                    {
+                        // A failed download usually shows up as a parse error, so report that first
+                        response->finish();
+                        throw;
+                    }
+                    response->finish();
+                    cache.evict();
                 }
 
-                ~OSMOverpassQuery() { std::remove(responseFilepath); }
+                ~OSMOverpassQuery()
+                {
+                    if (ownsResponseFile) std::remove(responseFilepath.c_str());
+                }
 
             private:
-                const char *responseFilepath = strcat(std::tmpnam(nullptr), ".xml");
+                // The response is either an entry in the cache, or a temporary file owned by this query
+                mutable std::string responseFilepath;
+                // The osmium format of the response file, cached responses are converted to PBF
+                mutable std::string responseFormat = "xml";
+                mutable bool ownsResponseFile = false;
 
-                const std::vector<std::string> OVERPASS_ENDPOINTS{
-                        "https://overpass.kumi.systems/api/interpreter",
-                        "https://overpass.openstreetmap.ru/api/interpreter",
-                        "https://maps.mail.ru/osm/tools/overpass/api/interpreter",
-                        "https://overpass-api.de/api/interpreter"
-                };
+                osmium::io::File getResponseFile() const { return osmium::io::File{responseFilepath, responseFormat}; }
+
+                /**
+ * Use the cached response to the query if there is one, converting it to PBF if it is still XML
+ * @param queryString the query
+ * @return whether the response was cached
+ */
+                bool lookupCache(const std::string& queryString) const;
+
+                /**
+ * Convert an OSM file to another format
+ */
+                static void convertResponse(const osmium::io::File& input, const osmium::io::File& output);
+
+                /**
+ * POST the query to the healthiest Overpass endpoint, retrying on other endpoints with backoff.
+ * @param queryString the query
+ * @param maxRetries the number of times to retry failed requests
+ * @param onData called with each chunk of the body of a successful response, returning false to abort
+ * @throws overpass_network_exception if no successful response was received
+ */
+                void postQuery(const std::string& queryString, short int maxRetries,
+                               const std::function<bool(const std::string_view&)>& onData) const;
+
+                /**
+ * Fetch the responses of tile queries concurrently, bounded by the maximum concurrent requests
+ * @throws the first error from fetching any tile
+ */
+                void fetchTiles(std::vector<OSMOverpassQuery>& tiles) const;
+
+                /**
+ * Apply handlers to the merged responses of tiles that have been fetched. All relations are read
+ * first for the multipolygon manager, then nodes and ways are read tile by tile, skipping
+ * objects already seen in an earlier tile.
+ */
+                template <typename... THandlers>
+                static void applyTiles(const std::vector<OSMOverpassQuery>& tiles, THandlers&...handlers)
+                {
+                    osmium::area::AssemblerConfig assemblerConfig;
+                    assemblerConfig.ignore_invalid_locations = true;
+                    assemblerConfig.create_way_polygons = false; // These are handled as normal ways in the handler
+                    assemblerConfig.create_empty_areas = true;
+                    using ManagerType = osmium::area::MultipolygonManager<osmium::area::Assembler>;
+                    ManagerType multipolygonManager{assemblerConfig};
+
+                    UniqueObjectsHandler<ManagerType> uniqueRelations{multipolygonManager};
+                    for (const auto& tile : tiles)
+                    {
+                        osmium::io::Reader reader{tile.getResponseFile(), osmium::osm_entity_bits::relation};
+                        osmium::apply(reader, uniqueRelations);
+                        reader.close();
+                    }
+                    multipolygonManager.prepare_for_lookup();
+
+                    osm::DefaultNodeLocationsForWaysHandler n2wHandler;
+                    n2wHandler.ignore_errors();
+                    auto& secondPass = multipolygonManager.handler([&handlers...](osmium::memory::Buffer&& buffer)
+                    {
+                        osmium::apply(buffer, handlers...);
+                    });
+                    UniqueObjectsHandler<osm::DefaultNodeLocationsForWaysHandler,
+                                         std::remove_reference_t<decltype(secondPass)>, THandlers...>
+                        uniqueObjects{n2wHandler, secondPass, handlers...};
+                    for (const auto& tile : tiles)
+                    {
+                        osmium::io::Reader reader{tile.getResponseFile(),
+                                                  osmium::osm_entity_bits::node | osmium::osm_entity_bits::way};
+                        osmium::apply(reader, uniqueObjects);
+                        reader.close();
+                    }
+                }
+
+                /**
+ * Make sure the response is available on disk, querying Overpass if it is not cached
+ * @return the path of the response file
+ */
+                const std::string& fetchResponseFile(short int maxRetries = 4) const;
 
                 /**
- * Return a cpr::Url containing a valid Overpass instance.
- * @return Overpass instance cpr::Url
+ * Open the response for osmium to read, from the cache or streamed from Overpass
+ * @return the response stream
  */
-                cpr::Url getOverpassEndpoint() const;
+                std::unique_ptr<OverpassResponseStream> openResponseStream(short int maxRetries = 4) const;
 
                 std::string buildQueryStringQL() const;
                 std::string buildQueryStringXML() const;
@@ -7,6 +7,10 @@
 #ifndef UASGROUNDRISK_SRC_MAP_GEN_OSMOVERPASSQUERYBUILDER_H_
 #define UASGROUNDRISK_SRC_MAP_GEN_OSMOVERPASSQUERYBUILDER_H_
 
+#include <chrono>
+#include <string>
+#include <vector>
+
 #include "OSMOverpassQuery.h"
 #include "OSMTag.h"
 
@@ -45,6 +49,22 @@ namespace ugr
 				                                         const std::string& value);
 
 				OSMOverpassQueryBuilder& withTimeout(short int timeout);
+
+				/**
+				 * Set the Overpass endpoints to query, replacing the public instances
+				 * @param endpoints the Overpass interpreter URLs
+				 * @param baseBackoff the time to avoid an endpoint after its first failure
+				 */
+				OSMOverpassQueryBuilder& withEndpoints(const std::vector<std::string>& endpoints,
+				                                       std::chrono::milliseconds baseBackoff = std::chrono::seconds(1));
+
+				/**
+				 * Set the largest tile the query bounds are split into, tiles are fetched concurrently
+				 * @param maxTileSize the maximum width and height of a tile in degrees
+				 */
+				OSMOverpassQueryBuilder& withMaxTileSize(double maxTileSize);
+
+				OSMOverpassQueryBuilder& withMaxConcurrentRequests(int maxConcurrentRequests);
 			};
 		}
 	}
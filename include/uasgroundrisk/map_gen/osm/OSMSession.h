@@ -0,0 +1,162 @@
+/*
+ * OSMSession.h
+ */
+
+#ifndef UASGROUNDRISK_SRC_MAP_GEN_OSMSESSION_H_
+#define UASGROUNDRISK_SRC_MAP_GEN_OSMSESSION_H_
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <osmium/handler.hpp>
+#include <osmium/osm/area.hpp>
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/tags/tags_filter.hpp>
+
+#include "uasgroundrisk/map_gen/osm/OSMDataSource.h"
+#include "uasgroundrisk/map_gen/osm/OSMFileQuery.h"
+#include "uasgroundrisk/map_gen/osm/OSMOverpassQuery.h"
+#include "uasgroundrisk/map_gen/osm/OSMOverpassQueryBuilder.h"
+#include "uasgroundrisk/map_gen/osm/OSMTag.h"
+
+namespace ugr
+{
+    namespace mapping
+    {
+        class OSMMap;
+
+        namespace osm
+        {
+            /**
+             * Read the OSM features with any of the tags within the bounds from a data source, applying
+             * handlers to them.
+             * @param source the data source to read from
+             * @param southWestCoord south west most coordinate of the bounding box
+             * @param northEastCoord north east most coordinate of the bounding box
+             * @param tags the tags of features to read
+             * @param ...handlers zero or more osmium::handler::Handler instances to be applied to the features
+             */
+            template <typename... THandlers>
+            void queryOSMData(const OSMDataSource& source, const osmium::geom::Coordinates& southWestCoord,
+                              const osmium::geom::Coordinates& northEastCoord, const std::vector<OSMTag>& tags,
+                              THandlers&&...handlers)
+            {
+                if (source.getType() == OSMDataSource::Type::LOCAL_FILE)
+                {
+                    const OSMFileQuery query(source.getPath(), southWestCoord, northEastCoord, tags);
+                    query.makeQuery(std::forward<THandlers>(handlers)...);
+                    return;
+                }
+
+                OSMOverpassQueryBuilder builder(southWestCoord, northEastCoord);
+                for (const auto& tag : tags)
+                {
+                    builder.withNodeTag(tag).withWayTag(tag).withRelationTag(tag);
+                }
+                OSMOverpassQuery query = builder.build();
+                query.makeQuery(std::forward<THandlers>(handlers)...);
+            }
+
+            /**
+             * A type erased osmium handler, so handlers of different maps can be held together
+             */
+            class OSMEntityHandler
+            {
+            public:
+                virtual ~OSMEntityHandler() = default;
+                virtual void node(const osmium::Node& node) = 0;
+                virtual void way(const osmium::Way& way) = 0;
+                virtual void area(const osmium::Area& area) = 0;
+                virtual void flush() = 0;
+            };
+
+            /**
+             * Owns an osmium handler and exposes it as an OSMEntityHandler
+             */
+            template <typename THandler>
+            class OSMHandlerAdapter : public OSMEntityHandler
+            {
+            public:
+                template <typename... TArgs>
+                explicit OSMHandlerAdapter(TArgs&&... args) : handler(std::forward<TArgs>(args)...)
+                {
+                }
+
+                void node(const osmium::Node& node) override { handler.node(node); }
+                void way(const osmium::Way& way) override { handler.way(way); }
+                void area(const osmium::Area& area) override { handler.area(area); }
+                void flush() override { handler.flush(); }
+
+            private:
+                THandler handler;
+            };
+
+            /**
+             * Construct an osmium handler wrapped as an OSMEntityHandler
+             */
+            template <typename THandler, typename... TArgs>
+            std::unique_ptr<OSMEntityHandler> makeEntityHandler(TArgs&&... args)
+            {
+                return std::make_unique<OSMHandlerAdapter<THandler>>(std::forward<TArgs>(args)...);
+            }
+
+            /**
+             * Reads the OSM data for several maps at once.
+             *
+             * A single query is made for the union of the tags and bounds of all maps, so the data is
+             * only downloaded and parsed once. Every feature is then dispatched to the handler of each
+             * map with one of its tags within its bounds, in a single pass over the data.
+             *
+             * Maps must share the same data source.
+             */
+            class OSMSession
+            {
+            public:
+                /**
+                 * Add a map to be evaluated by this session. Maps that are already evaluated are skipped.
+                 * @param map the map, which must outlive the session
+                 */
+                void addMap(OSMMap& map);
+
+                /**
+                 * Read the OSM data and evaluate all maps
+                 * @throws std::logic_error if the maps have different data sources
+                 */
+                void eval();
+
+            private:
+                std::vector<OSMMap*> maps;
+            };
+
+            /**
+             * Dispatches features to the handlers of each map in a session, filtered by the tags and
+             * bounds of that map
+             */
+            class OSMSessionHandler : public osmium::handler::Handler
+            {
+            public:
+                void addHandler(const std::vector<OSMTag>& tags, const osmium::Box& bounds,
+                                OSMEntityHandler* handler);
+
+                void node(const osmium::Node& node);
+                void way(const osmium::Way& way);
+                void area(const osmium::Area& area);
+                void flush();
+
+            private:
+                struct Target
+                {
+                    osmium::TagsFilter tagsFilter;
+                    osmium::Box bounds;
+                    OSMEntityHandler* handler;
+                };
+
+                std::vector<Target> targets;
+            };
+        }
+    }
+}
+#endif // UASGROUNDRISK_SRC_MAP_GEN_OSMSESSION_H_
@@ -0,0 +1,76 @@
+/*
+ * OverpassEndpointPool.h
+ */
+
+#ifndef UASGROUNDRISK_SRC_MAP_GEN_OVERPASSENDPOINTPOOL_H_
+#define UASGROUNDRISK_SRC_MAP_GEN_OVERPASSENDPOINTPOOL_H_
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ugr
+{
+    namespace mapping
+    {
+        namespace osm
+        {
+            /**
+             * A set of Overpass endpoints shared by concurrent requests, which tracks the health of each.
+             *
+             * Requests go to the available endpoint with the fewest recent failures and requests in
+             * flight. An endpoint that fails, such as with a timeout or a 429 rate limit, is avoided
+             * for a backoff time that doubles with every consecutive failure, and is reset by a success.
+             * When all endpoints are backing off, requests wait for the first to become available.
+             *
+             * This is thread safe.
+             */
+            class OverpassEndpointPool
+            {
+            public:
+                /**
+                 * @param endpoints the Overpass interpreter URLs
+                 * @param baseBackoff the time to avoid an endpoint after its first failure
+                 * @param maxBackoff the maximum time to avoid an endpoint
+                 * @throws std::invalid_argument if there are no endpoints
+                 */
+                explicit OverpassEndpointPool(std::vector<std::string> endpoints,
+                                              std::chrono::milliseconds baseBackoff = std::chrono::seconds(1),
+                                              std::chrono::milliseconds maxBackoff = std::chrono::seconds(60));
+
+                /**
+                 * Wait for an endpoint to be available and take it for a request. Every acquire must be
+                 * followed by reportSuccess or reportFailure for the returned endpoint
+                 * @return the URL of the endpoint
+                 */
+                std::string acquire();
+
+                void reportSuccess(const std::string& endpoint);
+
+                void reportFailure(const std::string& endpoint);
+
+                std::vector<std::string> getEndpoints() const;
+
+            private:
+                using Clock = std::chrono::steady_clock;
+
+                struct EndpointState
+                {
+                    std::string url;
+                    int consecutiveFailures = 0;
+                    int inFlight = 0;
+                    Clock::time_point availableAt;
+                };
+
+                mutable std::mutex mutex;
+                std::vector<EndpointState> states;
+                std::chrono::milliseconds baseBackoff;
+                std::chrono::milliseconds maxBackoff;
+
+                EndpointState& find(const std::string& endpoint);
+            };
+        }
+    }
+}
+#endif // UASGROUNDRISK_SRC_MAP_GEN_OVERPASSENDPOINTPOOL_H_
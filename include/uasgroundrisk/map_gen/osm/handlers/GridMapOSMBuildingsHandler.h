@@ -2,6 +2,8 @@
 #define GRIDMAPOSMBUILDINGSHANDLER_H
 #include <string>
 #include <osmium/handler.hpp>
+#include "uasgroundrisk/gridmap/GridMap.h"
+#include "uasgroundrisk/gridmap/GeometryArena.h"
 
 namespace ugr
 {
@@ -10,16 +12,30 @@ namespace ugr
 		class GeospatialGridMap;
 
 
+		/**
+		 * Writes the heights of OSM buildings to a gridmap layer.
+		 *
+		 * Buildings are collected while osmium reads them and rasterised in parallel when the handler
+		 * is flushed. Where buildings overlap, a cell takes the greatest height.
+		 */
 		class GridMapOSMBuildingsHandler : public osmium::handler::Handler
 		{
 		public:
 			GridMapOSMBuildingsHandler(ugr::mapping::GeospatialGridMap* gridMap, float levelHeight = 3.048f,
 			                           std::string gridCRS = "EPSG:3395");
 			~GridMapOSMBuildingsHandler() = default;
-			void way(const osmium::Way& way) const noexcept;
+			void way(const osmium::Way& way) noexcept;
+
+			/**
+			 * Rasterise the buildings collected so far
+			 */
+			void flush();
 		protected:
 			ugr::mapping::GeospatialGridMap* gridMap;
 			float buildingLevelHeight;
+			gridmap::LayerHandle buildingHeightLayer;
+			// The buildings read since the last flush, with their heights
+			gridmap::GeometryArena<float> buildings;
 
 			std::string gridCRS;
 		};
@@ -9,9 +9,9 @@
 
 #include <geos_c.h>
 #include "uasgroundrisk/gridmap/GridMap.h"
+#include "uasgroundrisk/gridmap/GeometryArena.h"
 #include <map>
 #include <osmium/handler.hpp>
-#include <proj.h>
 
 #include "uasgroundrisk/map_gen/GeospatialGridMap.h"
 
@@ -36,37 +36,62 @@ namespace ugr
                  * 					  Tags can only map to a single layer name,
                  * but multiple tags can map to a single layer name.
                  * \param densityGeometryMap a map of GEOS polygons to population values.
-                 * Geometries must be in EPSG:4326 projection. This class assumes
-                 * responsibility for freeing the GEOS objects here.
+                 * Geometries must be in EPSG:4326 projection. They are burnt into a raster
+                 * of the gridmap on construction, so are not kept or freed by this class.
+                 * Cells are weighted by the fraction each geometry covers, and where geometries
+                 * overlap, the first in the map takes precedence.
                  * \param densityTagMap a map of OSM tags to uniform densities in
                  * correspondingly tagged areas. densityGeometryMap takes precedence over this
                  * in setting the grid map value.
                  * \param gridCRS the grid coordinate reference system with units in metres
+                 *
+                 * Ways and areas are collected while osmium reads them and rasterised in parallel
+                 * when the handler is flushed, writing them in the order they were read.
                  */
                 GridMapOSMHandler(GeospatialGridMap* gridMap,
                                   std::map<OSMTag, std::string> tagLayerMap,
                                   const std::map<GEOSGeometry*, GridMapDataType>& densityGeometryMap,
                                   std::map<OSMTag, GridMapDataType> densityTagMap,
                                   std::string gridCRS = "EPSG:3395");
-                ~GridMapOSMHandler();
 
-                void way(const osmium::Way& way) const noexcept;
+                void way(const osmium::Way& way) noexcept;
 
-                void area(const osmium::Area& area) const noexcept;
+                void area(const osmium::Area& area) noexcept;
 
-            protected:
-                PJ_CONTEXT* projCtx;
-                PJ* reproj;
+                /**
+                 * Rasterise the ways and areas collected so far
+                 */
+                void flush();
 
+            protected:
                 GeospatialGridMap* gridMap;
                 std::map<OSMTag, std::string> tagLayerMap;
                 std::map<OSMTag, GridMapDataType> densityTagMap;
-                std::map<GEOSGeometry*, GridMapDataType> densityGeometryMap;
+                // The density of the geometry covering each gridmap cell, NaN where there is none.
+                // Empty if there are no density geometries
+                Matrix densityRaster;
+
+                // The layer and density a collected geometry is written with
+                struct DensityRecord
+                {
+                    LayerHandle layer;
+                    GridMapDataType density;
+                    // Whether the density of the density geometries takes precedence
+                    bool useDensityRaster;
+                };
+
+                // The ways and areas read since the last flush
+                GeometryArena<DensityRecord> geometries;
+                std::vector<LayerHandle> writtenLayers;
 
                 std::string gridCRS;
 
-                void setFallbackValue(const std::string& layerName, const Index& gridMapPoint,
-                                      const Matrix::Scalar& fallbackDensity) const;
+                /**
+                 * @param coverage the fraction of the cell covered by the geometry. Partially covered
+                 * cells add the coverage weighted density to the existing value
+                 */
+                void setFallbackValue(LayerHandle layer, const Index& gridMapPoint,
+                                      const Matrix::Scalar& fallbackDensity, float coverage = 1) const;
             };
         }
     }
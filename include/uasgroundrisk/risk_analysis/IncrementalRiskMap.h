@@ -57,6 +57,9 @@ namespace ugr
 
 			double getPositionPointFatalityProbability(const Position3& position, int heading);
 
+			using RiskMap::GetKernelTruncation;
+			using RiskMap::SetKernelTruncation;
+
 		};
 	} // namespace risk
 } // namespace ugr
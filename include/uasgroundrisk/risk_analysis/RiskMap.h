@@ -6,11 +6,12 @@
 
 #ifndef UASGROUNDRISK_SRC_RISK_ANALYSIS_RISKMAP_H_
 #define UASGROUNDRISK_SRC_RISK_ANALYSIS_RISKMAP_H_
-#include <random>
+#include <cstdint>
 
 #include "aircraft/AircraftModel.h"
 #include "obstacles/ObstacleMap.h"
 #include "uasgroundrisk/map_gen/PopulationMap.h"
+#include "uasgroundrisk/map_gen/TemporalPopulationMap.h"
 #include "uasgroundrisk/map_gen/GeospatialGridMap.h"
 #include "uasgroundrisk/risk_analysis/RiskEnums.h"
 #include "uasgroundrisk/risk_analysis/weather/WeatherMap.h"
@@ -54,6 +55,23 @@ namespace ugr
 			 */
 			GridMap& generateMap(const std::vector<RiskType>& risksToGenerate);
 
+			/**
+			 * Generate the population density, strike risk and fatality risk at several hours of the
+			 * day in one pass. The descent samples and impact kernels of each cell do not depend on
+			 * the population, so are only computed once and applied to the population of every hour.
+			 *
+			 * The maps of each hour are added as the layers "Population Density <hour>",
+			 * "Strike Risk <hour>" and "Fatality Risk <hour>", with population densities in people/m^2
+			 * as in the "Population Density" layer.
+			 * @param populationMap the population map, usually the one this risk map was constructed with
+			 * @param hours the distinct hours of day from 0 to 23
+			 * @return a GridMap with the layers of each hour
+			 * @throws std::invalid_argument if the population map is not the size of this map, or if
+			 * any hour is repeated
+			 */
+			GridMap& generateHourlyMaps(mapping::TemporalPopulationMap& populationMap,
+				const std::vector<short>& hours);
+
 			void eval() override;
 
 			bool IsAnyHeading() const
@@ -66,20 +84,148 @@ namespace ugr
 				this->anyHeading = anyHeading;
 			}
 
+			double GetKernelTruncation() const
+			{
+				return kernelSigma;
+			}
+
+			/**
+			 * Set the extent of the impact PDF kernels in standard deviations of the fitted
+			 * impact distribution. Impact PDFs are only evaluated within this window around
+			 * the mean impact position and cells outside of it are taken to have zero impact
+			 * probability. A value <= 0 evaluates the impact PDFs over the whole map.
+			 * @param nSigma the number of standard deviations to evaluate kernels over
+			 */
+			void SetKernelTruncation(const double nSigma)
+			{
+				this->kernelSigma = nSigma;
+			}
+
+			uint64_t GetSeed() const
+			{
+				return seed;
+			}
+
+			/**
+			 * Set the seed of the random streams used for Monte Carlo sampling. Each cell is
+			 * sampled from its own stream derived from this seed, so maps generated with the
+			 * same seed are identical regardless of the number of threads used.
+			 * Defaults to a time based seed.
+			 * @param seed the seed
+			 */
+			void SetSeed(const uint64_t seed)
+			{
+				this->seed = seed;
+			}
+
+			bool IsConvolutionEnabled() const
+			{
+				return convolution;
+			}
+
+			/**
+			 * Set whether strike maps may be generated by convolution when the conditions are
+			 * uniform across the map. In this case the impact PDF is the same relative to every
+			 * cell, so is fitted once per descent and correlated with the population density,
+			 * instead of being sampled and fitted for every cell.
+			 * This is disabled by default, as the fitted PDF is not sampled per cell so the results
+			 * differ slightly from Monte Carlo sampling every cell.
+			 * @param enabled whether to use convolution where possible
+			 */
+			void SetConvolutionEnabled(const bool enabled)
+			{
+				this->convolution = enabled;
+			}
+
 		 protected:
+			/**
+			 * A 2D gaussian fitted to the impact positions of a descent, in grid cell coordinates
+			 */
+			struct ImpactDistribution
+			{
+				Eigen::Matrix<GridMapDataType, 2, 1> means;
+				Eigen::Matrix<GridMapDataType, 2, 2> cov;
+			};
+
+			/**
+			 * The output layers of a descent, resolved once so cells can be written to in parallel
+			 */
+			struct DescentLayers
+			{
+				/// The strike risk from each population density
+				std::vector<Matrix*> strikeRisks;
+				Matrix* impactAngle;
+				Matrix* impactVelocity;
+			};
+
+			/**
+			 * An impact PDF evaluated over a window of the map. Cells outside of the window
+			 * have zero probability.
+			 */
+			struct ImpactKernel
+			{
+				/// The index of the first cell of the window in the map
+				Index origin;
+				/// The normalised PDF over the window
+				Matrix pdf;
+			};
+
 			const AircraftModel aircraftModel;
 //			const WeatherMap& weather;
 			static constexpr int nSamples = 50; //CLT says 30-50 samples is good enough
-			std::default_random_engine generator;
-			Eigen::Matrix<int, 2, Dynamic> evalMat;
-			Eigen::Vector<GridMapDataType, Dynamic> evalXs, evalYs;
+			// Seed of the per cell random streams used to sample the LoC states
+			uint64_t seed;
 			bool anyHeading = false;
+			// The mass of a 2D gaussian outside of 5 sigma is ~4e-6, well below the sampling noise
+			double kernelSigma = 5;
+			bool convolution = false;
+			LayerHandle windVelXLayer, windVelYLayer;
 
 			void generateStrikeMap();
 
+			/**
+			 * Generate the strike risk of each descent from several population densities, sampling
+			 * descents and fitting impact kernels once for all of them
+			 * @param populationDensityMaps the population densities in people/m^2
+			 * @param descentLayers the output layers of each descent, with a strike risk per population density
+			 */
+			void generateStrikeMaps(const std::vector<const Matrix*>& populationDensityMaps,
+				const std::vector<DescentLayers>& descentLayers);
+
+			/**
+			 * @return the impact angle and velocity layers of each descent, without any strike risk layers
+			 */
+			std::vector<DescentLayers> getDescentLayers();
+
+			/**
+			 * @return the probability of a fatality given a strike for each cell of a descent
+			 */
+			Matrix descentFatalityProbability(const std::string& descentName) const;
+
 			void generateFatalityMap();
 
-			void addPointStrikeMap(const Index& index);
+			bool hasUniformConditions() const;
+
+			void generateStrikeMapConvolution(const std::vector<const Matrix*>& populationDensityMaps,
+				const std::vector<DescentLayers>& descentLayers);
+
+			void addPointStrikeMap(const Index& index, const std::vector<const Matrix*>& populationDensityMaps,
+				const std::vector<DescentLayers>& descentLayers) const;
+
+			void fitPointImpactDistributions(
+				const Index& index,
+				double altitude,
+				int heading,
+				std::vector<ImpactDistribution, aligned_allocator<ImpactDistribution>>& impactDistributions,
+				std::vector<GridMapDataType>& impactAngles,
+				std::vector<GridMapDataType>& impactVelocities) const;
+
+			/**
+			 * Evaluate an impact distribution over a window of cells, following the x axis convention
+			 * of the impact PDFs
+			 */
+			static Matrix evalImpactDistribution(const ImpactDistribution& distParams,
+				int xMin, int yMin, int windowX, int windowY);
 
 			void makePointImpactMap(
 				const Index& index,
@@ -87,7 +233,16 @@ namespace ugr
 				int heading,
 				std::vector<Matrix, aligned_allocator<Matrix>>& impactPDFs,
 				std::vector<GridMapDataType>& impactAngles,
-				std::vector<GridMapDataType>& impactVelocities);
+				std::vector<GridMapDataType>& impactVelocities) const;
+
+			void makePointImpactKernels(
+				const Index& index,
+				double altitude,
+				int heading,
+				double nSigma,
+				std::vector<ImpactKernel, aligned_allocator<ImpactKernel>>& impactKernels,
+				std::vector<GridMapDataType>& impactAngles,
+				std::vector<GridMapDataType>& impactVelocities) const;
 
 			void initRiskMapLayers();
 
@@ -22,7 +22,7 @@ namespace ugr
             void eval() override;
 
         protected:
-            // std::vector<std::unique_ptr<osmium::handler::Handler>> handlers;
+            std::unique_ptr<mapping::osm::OSMEntityHandler> makeSessionHandler() override;
         };
     }
 }
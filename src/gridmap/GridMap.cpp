@@ -1,8 +1,173 @@
 #include "uasgroundrisk/gridmap/GridMap.h"
+#include "../utils/MappedFile.h"
 #include "spdlog/spdlog.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 
 using namespace ugr::gridmap;
 
+namespace
+{
+    // Binary gridmap files are a header followed by the row-major data of each layer.
+    // All values are stored in native byte order, which is checked with a byte order mark.
+    constexpr char binaryMagic[8] = {'U', 'G', 'R', 'G', 'M', 'A', 'P', '\0'};
+    constexpr uint32_t binaryVersion = 1;
+    constexpr uint32_t binaryByteOrderMark = 0x01020304;
+    // Layer blocks are aligned to pages so each can be mapped directly
+    constexpr uint64_t binaryAlignment = 4096;
+
+    enum class BinaryDataType : uint32_t
+    {
+        Float32 = 1
+    };
+
+    struct BinaryLayerEntry
+    {
+        std::string name;
+        uint64_t offset;
+        uint64_t bytes;
+    };
+
+    struct BinaryHeader
+    {
+        int32_t sizeX, sizeY;
+        GridMapFileMetadata metadata;
+        std::vector<BinaryLayerEntry> layers;
+    };
+
+    template <typename T>
+    void writeValue(std::string& buffer, const T& value)
+    {
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void writeString(std::string& buffer, const std::string& value)
+    {
+        writeValue(buffer, static_cast<uint32_t>(value.size()));
+        buffer.append(value);
+    }
+
+    std::string serialiseHeader(const BinaryHeader& header)
+    {
+        std::string buffer(binaryMagic, sizeof(binaryMagic));
+        writeValue(buffer, binaryVersion);
+        writeValue(buffer, binaryByteOrderMark);
+        writeValue(buffer, header.sizeX);
+        writeValue(buffer, header.sizeY);
+        for (const float bound : header.metadata.bounds)
+        {
+            writeValue(buffer, bound);
+        }
+        writeValue(buffer, header.metadata.resolution);
+        writeString(buffer, header.metadata.worldSrs);
+        writeString(buffer, header.metadata.projectionSrs);
+        writeValue(buffer, static_cast<uint32_t>(header.layers.size()));
+        for (const auto& layer : header.layers)
+        {
+            writeString(buffer, layer.name);
+            writeValue(buffer, BinaryDataType::Float32);
+            writeValue(buffer, layer.offset);
+            writeValue(buffer, layer.bytes);
+        }
+        return buffer;
+    }
+
+    /**
+     * Bounds checked reading of a binary gridmap header from memory
+     */
+    class HeaderReader
+    {
+    public:
+        HeaderReader(const char* data, const size_t size, const std::string& path)
+            : data(data), size(size), path(path)
+        {
+        }
+
+        template <typename T>
+        T read()
+        {
+            T value;
+            std::memcpy(&value, take(sizeof(T)), sizeof(T));
+            return value;
+        }
+
+        std::string readString()
+        {
+            const auto length = read<uint32_t>();
+            return {take(length), length};
+        }
+
+        const char* take(const size_t bytes)
+        {
+            if (bytes > size - pos)
+            {
+                throw std::ios_base::failure("Truncated gridmap file header at: " + path);
+            }
+            const char* out = data + pos;
+            pos += bytes;
+            return out;
+        }
+
+    private:
+        const char* data;
+        size_t size;
+        size_t pos = 0;
+        const std::string& path;
+    };
+
+    BinaryHeader parseHeader(const ugr::util::MappedFile& file, const std::string& path)
+    {
+        HeaderReader reader(file.data(), file.size(), path);
+        if (std::memcmp(reader.take(sizeof(binaryMagic)), binaryMagic, sizeof(binaryMagic)) != 0)
+        {
+            throw std::ios_base::failure("Not a gridmap file at: " + path);
+        }
+        if (reader.read<uint32_t>() != binaryVersion)
+        {
+            throw std::ios_base::failure("Unsupported gridmap file version at: " + path);
+        }
+        if (reader.read<uint32_t>() != binaryByteOrderMark)
+        {
+            throw std::ios_base::failure("Gridmap file at " + path + " was written with a different byte order");
+        }
+
+        BinaryHeader header;
+        header.sizeX = reader.read<int32_t>();
+        header.sizeY = reader.read<int32_t>();
+        for (float& bound : header.metadata.bounds)
+        {
+            bound = reader.read<float>();
+        }
+        header.metadata.resolution = reader.read<float>();
+        header.metadata.worldSrs = reader.readString();
+        header.metadata.projectionSrs = reader.readString();
+        if (header.sizeX < 0 || header.sizeY < 0)
+        {
+            throw std::ios_base::failure("Invalid gridmap file geometry at: " + path);
+        }
+
+        const auto layerCount = reader.read<uint32_t>();
+        const uint64_t layerBytes = static_cast<uint64_t>(header.sizeX) * header.sizeY * sizeof(GridMapDataType);
+        for (uint32_t i = 0; i < layerCount; ++i)
+        {
+            BinaryLayerEntry layer;
+            layer.name = reader.readString();
+            const auto dataType = reader.read<BinaryDataType>();
+            layer.offset = reader.read<uint64_t>();
+            layer.bytes = reader.read<uint64_t>();
+            if (dataType != BinaryDataType::Float32 || layer.bytes != layerBytes
+                || layer.offset % alignof(GridMapDataType) != 0
+                || layer.offset > file.size() || layer.bytes > file.size() - layer.offset)
+            {
+                throw std::ios_base::failure("Invalid gridmap file layer " + layer.name + " at: " + path);
+            }
+            header.layers.emplace_back(std::move(layer));
+        }
+        return header;
+    }
+}
+
 
 Size GridMap::getSize() const
 {
@@ -17,22 +182,60 @@ void GridMap::setGeometry(const int sizeX, const int sizeY)
     geometrySet = true;
 }
 
-std::vector<std::string> GridMap::getLayers() const
+GridMap::GridMap(const GridMap& other)
+    : geometrySet(other.geometrySet), sizeX(other.sizeX), sizeY(other.sizeY), layers(other.layers),
+      tiledLayers(other.tiledLayers), mappedLayers(other.mappedLayers), layerIds(other.layerIds),
+      layerNames(other.layerNames), referencedLayers(other.referencedLayers.size(), 0)
 {
-    std::vector<std::string> keys;
-    keys.reserve(layers.size());
-    for (const auto& pair : layers)
+    // Mutable references to the other map's layers must not write to this copy, so layers that
+    // references have been taken to are copied rather than shared
+    for (size_t id = 0; id < layerNames.size(); ++id)
     {
-        keys.emplace_back(pair.first);
+        if (!other.referencedLayers[id])
+        {
+            continue;
+        }
+        if (tiledLayers[id])
+        {
+            tiledLayers[id] = std::make_shared<TiledLayer>(*tiledLayers[id]);
+            tiledLayers[id]->copyTiles();
+        }
+        else if (layers[id])
+        {
+            layers[id] = std::make_shared<Matrix>(*layers[id]);
+        }
     }
-    return keys;
 }
 
-void GridMap::add(const std::string& layerName, const Matrix& layerData)
+GridMap& GridMap::operator=(const GridMap& other)
+{
+    if (this != &other)
+    {
+        *this = GridMap(other);
+    }
+    return *this;
+}
+
+std::vector<std::string> GridMap::getLayers() const
+{
+    return layerNames;
+}
+
+void GridMap::insert(const std::string& layerName, std::shared_ptr<Matrix> layerData,
+                     std::shared_ptr<TiledLayer> tiledLayerData,
+                     std::shared_ptr<const GridMapDataType> mappedLayerData)
 {
     if (geometrySet)
     {
-        layers.insert({layerName, layerData});
+        if (layerIds.count(layerName) == 0)
+        {
+            layerIds.emplace(layerName, static_cast<int>(layers.size()));
+            layerNames.emplace_back(layerName);
+            layers.emplace_back(std::move(layerData));
+            tiledLayers.emplace_back(std::move(tiledLayerData));
+            mappedLayers.emplace_back(std::move(mappedLayerData));
+            referencedLayers.emplace_back(0);
+        }
     }
     else
     {
@@ -40,58 +243,131 @@ void GridMap::add(const std::string& layerName, const Matrix& layerData)
     }
 }
 
+void GridMap::add(const std::string& layerName, const Matrix& layerData)
+{
+    // Layers only exist once the geometry is set, so insert will throw if it is not
+    if (layerIds.count(layerName) == 0)
+    {
+        insert(layerName, std::make_shared<Matrix>(layerData));
+    }
+}
+
+void GridMap::add(const std::string& layerName, Matrix&& layerData)
+{
+    if (layerIds.count(layerName) == 0)
+    {
+        insert(layerName, std::make_shared<Matrix>(std::move(layerData)));
+    }
+}
+
 void GridMap::add(const std::string& layerName, const double constValue)
 {
-    if (geometrySet)
+    if (layerIds.count(layerName) == 0)
     {
-        Matrix layerData(sizeX, sizeY);
-        layerData.setConstant(constValue);
-        layers.emplace(layerName, layerData);
+        insert(layerName, std::make_shared<Matrix>(Matrix::Constant(sizeX, sizeY, static_cast<GridMapDataType>(constValue))));
     }
-    else
+}
+
+void GridMap::addShared(const std::string& layerName, const GridMap& source, const std::string& sourceLayerName)
+{
+    const int sourceId = source.layerIds.at(sourceLayerName);
+    insert(layerName, source.layers[sourceId], source.tiledLayers[sourceId], source.mappedLayers[sourceId]);
+}
+
+void GridMap::addTiled(const std::string& layerName, const double fillValue)
+{
+    if (layerIds.count(layerName) == 0)
     {
-        throw std::out_of_range("GridMap Geometry not set");
+        insert(layerName, nullptr,
+               std::make_shared<TiledLayer>(sizeX, sizeY, static_cast<GridMapDataType>(fillValue)));
     }
 }
 
-Matrix GridMap::get(const std::string& layerName) const
+bool GridMap::isTiled(const std::string& layerName) const
+{
+    return isTiled(getHandle(layerName));
+}
+
+bool GridMap::isMapped(const std::string& layerName) const
 {
-    return layers.at(layerName);
+    return isMapped(getHandle(layerName));
+}
+
+const TiledLayer& GridMap::getTiled(const std::string& layerName) const
+{
+    const int id = layerIds.at(layerName);
+    if (!tiledLayers[id])
+    {
+        throw std::logic_error("GridMap layer " + layerName + " is not tiled");
+    }
+    return *tiledLayers[id];
+}
+
+TiledLayer& GridMap::getTiled(const std::string& layerName)
+{
+    // Check the layer exists and is tiled before taking it for writing
+    static_cast<const GridMap&>(*this).getTiled(layerName);
+    return mutableTiledLayer(layerIds.at(layerName));
+}
+
+LayerHandle GridMap::getHandle(const std::string& layerName) const
+{
+    return LayerHandle(layerIds.at(layerName));
+}
+
+const Matrix& GridMap::layer(const std::string& layerName) const
+{
+    return denseLayer(layerIds.at(layerName));
+}
+
+Matrix& GridMap::layer(const std::string& layerName)
+{
+    return mutableLayer(layerIds.at(layerName));
+}
+
+const Matrix& GridMap::get(const std::string& layerName) const
+{
+    return layer(layerName);
 }
 
 Matrix& GridMap::get(const std::string& layerName)
 {
-    return layers.at(layerName);
+    return layer(layerName);
 }
 
 const Matrix& GridMap::operator[](const std::string& layerName) const
 {
-    return layers.at(layerName);
+    return layer(layerName);
 }
 
 Matrix& GridMap::operator[](const std::string& layerName)
 {
-    return layers.at(layerName);
+    return layer(layerName);
+}
+
+ConstMatrixMap GridMap::view(const std::string& layerName) const
+{
+    return view(getHandle(layerName));
 }
 
 GridMapDataType GridMap::at(const std::string& layerName, const int i, const int j) const
 {
-    return layers.at(layerName)(i, j);
+    return at(getHandle(layerName), i, j);
 }
 
 GridMapDataType& GridMap::at(const std::string& layerName, const int i, const int j)
 {
-    return layers.at(layerName)(i, j);
+    return at(getHandle(layerName), i, j);
 }
 
 GridMapDataType GridMap::at(const std::string& layerName, const Index& idx) const
 {
-    return layers.at(layerName)(idx(0), idx(1));
+    return at(getHandle(layerName), idx(0), idx(1));
 }
 
 GridMapDataType& GridMap::at(const std::string& layerName, const Index& idx)
 {
-    return layers.at(layerName)(idx(0), idx(1));
+    return at(getHandle(layerName), idx(0), idx(1));
 }
 
 bool GridMap::isInBounds(const Index& localCoord) const
@@ -103,6 +379,92 @@ bool GridMap::isInBounds(const Index& localCoord) const
     throw std::out_of_range("GridMap Geometry not set");
 }
 
-void GridMap::writeToNetCDF(const std::string& path) const
+void GridMap::writeBinary(const std::string& path) const
 {
+    BinaryHeader header;
+    header.sizeX = sizeX;
+    header.sizeY = sizeY;
+    header.metadata = getFileMetadata();
+    const uint64_t layerBytes = static_cast<uint64_t>(sizeX) * sizeY * sizeof(GridMapDataType);
+    for (const auto& layerName : layerNames)
+    {
+        header.layers.push_back({layerName, 0, layerBytes});
+    }
+
+    // The header size does not depend on the offsets, so lay out the layers after a first pass
+    const auto align = [](const uint64_t offset)
+    {
+        return (offset + binaryAlignment - 1) / binaryAlignment * binaryAlignment;
+    };
+    uint64_t offset = align(serialiseHeader(header).size());
+    for (auto& layer : header.layers)
+    {
+        layer.offset = offset;
+        offset = align(offset + layer.bytes);
+    }
+    const std::string headerBuffer = serialiseHeader(header);
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        throw std::ios_base::failure("Cannot open gridmap file for writing at: " + path);
+    }
+    out.write(headerBuffer.data(), static_cast<std::streamsize>(headerBuffer.size()));
+    uint64_t written = headerBuffer.size();
+    const std::string padding(binaryAlignment, '\0');
+    for (size_t id = 0; id < layerNames.size(); ++id)
+    {
+        out.write(padding.data(), static_cast<std::streamsize>(header.layers[id].offset - written));
+        // Tiled layers have no contiguous data, so are written densely
+        Matrix tiledData;
+        const GridMapDataType* data;
+        if (tiledLayers[id])
+        {
+            tiledData = tiledLayers[id]->toDense();
+            data = tiledData.data();
+        }
+        else
+        {
+            data = view(LayerHandle(static_cast<int>(id))).data();
+        }
+        out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(layerBytes));
+        written = header.layers[id].offset + layerBytes;
+    }
+    if (!out.flush())
+    {
+        throw std::ios_base::failure("Cannot write gridmap file at: " + path);
+    }
+}
+
+GridMap GridMap::openBinary(const std::string& path)
+{
+    GridMap gridMap;
+    gridMap.mapBinaryLayers(path);
+    return gridMap;
+}
+
+GridMapFileMetadata GridMap::readBinaryMetadata(const std::string& path)
+{
+    const util::MappedFile file(path);
+    return parseHeader(file, path).metadata;
+}
+
+void GridMap::mapBinaryLayers(const std::string& path)
+{
+    const auto file = std::make_shared<const util::MappedFile>(path);
+    const BinaryHeader header = parseHeader(*file, path);
+    if (!geometrySet)
+    {
+        setGeometry(header.sizeX, header.sizeY);
+    }
+    else if (header.sizeX != sizeX || header.sizeY != sizeY)
+    {
+        throw std::ios_base::failure("Gridmap file at " + path + " does not match the gridmap geometry");
+    }
+    for (const auto& layer : header.layers)
+    {
+        // Each layer shares ownership of the mapping, which stays open while any layer uses it
+        const auto* data = reinterpret_cast<const GridMapDataType*>(file->data() + layer.offset);
+        insert(layer.name, nullptr, nullptr, std::shared_ptr<const GridMapDataType>(file, data));
+    }
 }
@@ -0,0 +1,241 @@
+#include "uasgroundrisk/gridmap/GridMap.h"
+#include <ios>
+#include <stdexcept>
+
+#ifdef UGR_WITH_NETCDF
+#include <netcdf.h>
+#include <algorithm>
+#endif
+
+using namespace ugr::gridmap;
+
+#ifdef UGR_WITH_NETCDF
+namespace
+{
+    // Chunks are square tiles of the layers, which suits the spatial access patterns of GIS tools
+    constexpr size_t netCDFChunkSize = 256;
+    constexpr int netCDFDeflateLevel = 4;
+
+    constexpr auto boundsAttribute = "ugr_bounds";
+    constexpr auto resolutionAttribute = "ugr_resolution";
+    constexpr auto worldSrsAttribute = "ugr_world_srs";
+    constexpr auto projectionSrsAttribute = "ugr_projection_srs";
+
+    void checkNetCDF(const int status, const std::string& path)
+    {
+        if (status != NC_NOERR)
+        {
+            throw std::ios_base::failure("NetCDF error for " + path + ": " + nc_strerror(status));
+        }
+    }
+
+    void putTextAttribute(const int ncid, const int varid, const char* name, const std::string& value,
+                          const std::string& path)
+    {
+        checkNetCDF(nc_put_att_text(ncid, varid, name, value.size(), value.c_str()), path);
+    }
+
+    /**
+     * Closes a NetCDF file when going out of scope, so files are not left open by exceptions
+     */
+    class NetCDFFile
+    {
+    public:
+        explicit NetCDFFile(const int ncid) : ncid(ncid)
+        {
+        }
+
+        ~NetCDFFile()
+        {
+            nc_close(ncid);
+        }
+
+        NetCDFFile(const NetCDFFile& other) = delete;
+        NetCDFFile& operator=(const NetCDFFile& other) = delete;
+
+        const int ncid;
+    };
+
+    std::string getTextAttribute(const int ncid, const char* name)
+    {
+        size_t length;
+        if (nc_inq_attlen(ncid, NC_GLOBAL, name, &length) != NC_NOERR)
+        {
+            return {};
+        }
+        std::string value(length, '\0');
+        if (length > 0 && nc_get_att_text(ncid, NC_GLOBAL, name, &value[0]) != NC_NOERR)
+        {
+            return {};
+        }
+        return value;
+    }
+
+    GridMapFileMetadata readMetadata(const int ncid)
+    {
+        GridMapFileMetadata metadata;
+        nc_get_att_float(ncid, NC_GLOBAL, boundsAttribute, metadata.bounds.data());
+        nc_get_att_float(ncid, NC_GLOBAL, resolutionAttribute, &metadata.resolution);
+        metadata.worldSrs = getTextAttribute(ncid, worldSrsAttribute);
+        metadata.projectionSrs = getTextAttribute(ncid, projectionSrsAttribute);
+        return metadata;
+    }
+}
+#endif
+
+void GridMap::writeToNetCDF(const std::string& path) const
+{
+#ifdef UGR_WITH_NETCDF
+    int ncid;
+    checkNetCDF(nc_create(path.c_str(), NC_CLOBBER | NC_NETCDF4, &ncid), path);
+    const NetCDFFile file(ncid);
+
+    int dims[2];
+    checkNetCDF(nc_def_dim(ncid, "x", sizeX, &dims[0]), path);
+    checkNetCDF(nc_def_dim(ncid, "y", sizeY, &dims[1]), path);
+    const size_t chunks[2] = {
+        std::max<size_t>(1, std::min<size_t>(netCDFChunkSize, sizeX)),
+        std::max<size_t>(1, std::min<size_t>(netCDFChunkSize, sizeY))
+    };
+
+    // Keep enough metadata to reconstruct the gridmap exactly when reading back
+    const auto metadata = getFileMetadata();
+    putTextAttribute(ncid, NC_GLOBAL, "Conventions", "CF-1.8", path);
+    checkNetCDF(nc_put_att_float(ncid, NC_GLOBAL, boundsAttribute, NC_FLOAT, 4, metadata.bounds.data()), path);
+    checkNetCDF(nc_put_att_float(ncid, NC_GLOBAL, resolutionAttribute, NC_FLOAT, 1, &metadata.resolution), path);
+    putTextAttribute(ncid, NC_GLOBAL, worldSrsAttribute, metadata.worldSrs, path);
+    putTextAttribute(ncid, NC_GLOBAL, projectionSrsAttribute, metadata.projectionSrs, path);
+
+    // The grid is regular in the projected CRS, so latitude and longitude are 2D auxiliary coordinates
+    const bool georeferenced = sizeX > 0 && sizeY > 0 && cellWorldPosition(0, 0).has_value();
+    int latVar = -1, lonVar = -1;
+    if (georeferenced)
+    {
+        checkNetCDF(nc_def_var(ncid, "lat", NC_DOUBLE, 2, dims, &latVar), path);
+        checkNetCDF(nc_def_var(ncid, "lon", NC_DOUBLE, 2, dims, &lonVar), path);
+        for (const int var : {latVar, lonVar})
+        {
+            checkNetCDF(nc_def_var_chunking(ncid, var, NC_CHUNKED, chunks), path);
+            checkNetCDF(nc_def_var_deflate(ncid, var, 1, 1, netCDFDeflateLevel), path);
+        }
+        putTextAttribute(ncid, latVar, "standard_name", "latitude", path);
+        putTextAttribute(ncid, latVar, "units", "degrees_north", path);
+        putTextAttribute(ncid, lonVar, "standard_name", "longitude", path);
+        putTextAttribute(ncid, lonVar, "units", "degrees_east", path);
+    }
+
+    std::vector<int> layerVars(layerNames.size());
+    for (size_t id = 0; id < layerNames.size(); ++id)
+    {
+        checkNetCDF(nc_def_var(ncid, layerNames[id].c_str(), NC_FLOAT, 2, dims, &layerVars[id]), path);
+        checkNetCDF(nc_def_var_chunking(ncid, layerVars[id], NC_CHUNKED, chunks), path);
+        checkNetCDF(nc_def_var_deflate(ncid, layerVars[id], 1, 1, netCDFDeflateLevel), path);
+        putTextAttribute(ncid, layerVars[id], "long_name", layerNames[id], path);
+        if (georeferenced)
+        {
+            putTextAttribute(ncid, layerVars[id], "coordinates", "lat lon", path);
+        }
+    }
+    checkNetCDF(nc_enddef(ncid), path);
+
+    if (georeferenced)
+    {
+        // Coordinates are computed and written a row at a time to bound memory use
+        std::vector<double> lats(sizeY), lons(sizeY);
+        for (int x = 0; x < sizeX; ++x)
+        {
+            for (int y = 0; y < sizeY; ++y)
+            {
+                const Position position = *cellWorldPosition(x, y);
+                lons[y] = position[0];
+                lats[y] = position[1];
+            }
+            const size_t start[2] = {static_cast<size_t>(x), 0};
+            const size_t count[2] = {1, static_cast<size_t>(sizeY)};
+            checkNetCDF(nc_put_vara_double(ncid, latVar, start, count, lats.data()), path);
+            checkNetCDF(nc_put_vara_double(ncid, lonVar, start, count, lons.data()), path);
+        }
+    }
+
+    // Layers are written one at a time straight from their storage, so at most one tiled layer
+    // is ever expanded into memory
+    for (size_t id = 0; id < layerNames.size(); ++id)
+    {
+        if (tiledLayers[id])
+        {
+            const Matrix dense = tiledLayers[id]->toDense();
+            checkNetCDF(nc_put_var_float(ncid, layerVars[id], dense.data()), path);
+        }
+        else
+        {
+            checkNetCDF(nc_put_var_float(ncid, layerVars[id], view(LayerHandle(static_cast<int>(id))).data()), path);
+        }
+    }
+#else
+    throw std::runtime_error("uasgroundrisk was built without NetCDF support, enable UGR_WITH_NETCDF");
+#endif
+}
+
+GridMap GridMap::readFromNetCDF(const std::string& path)
+{
+    GridMap gridMap;
+    gridMap.readNetCDFLayers(path);
+    return gridMap;
+}
+
+GridMapFileMetadata GridMap::readNetCDFMetadata(const std::string& path)
+{
+#ifdef UGR_WITH_NETCDF
+    int ncid;
+    checkNetCDF(nc_open(path.c_str(), NC_NOWRITE, &ncid), path);
+    const NetCDFFile file(ncid);
+    return readMetadata(ncid);
+#else
+    throw std::runtime_error("uasgroundrisk was built without NetCDF support, enable UGR_WITH_NETCDF");
+#endif
+}
+
+void GridMap::readNetCDFLayers(const std::string& path)
+{
+#ifdef UGR_WITH_NETCDF
+    int ncid;
+    checkNetCDF(nc_open(path.c_str(), NC_NOWRITE, &ncid), path);
+    const NetCDFFile file(ncid);
+
+    int dims[2];
+    size_t fileSizeX, fileSizeY;
+    checkNetCDF(nc_inq_dimid(ncid, "x", &dims[0]), path);
+    checkNetCDF(nc_inq_dimid(ncid, "y", &dims[1]), path);
+    checkNetCDF(nc_inq_dimlen(ncid, dims[0], &fileSizeX), path);
+    checkNetCDF(nc_inq_dimlen(ncid, dims[1], &fileSizeY), path);
+    if (!geometrySet)
+    {
+        setGeometry(static_cast<int>(fileSizeX), static_cast<int>(fileSizeY));
+    }
+    else if (static_cast<int>(fileSizeX) != sizeX || static_cast<int>(fileSizeY) != sizeY)
+    {
+        throw std::ios_base::failure("NetCDF file at " + path + " does not match the gridmap geometry");
+    }
+
+    int nVars;
+    checkNetCDF(nc_inq_nvars(ncid, &nVars), path);
+    for (int var = 0; var < nVars; ++var)
+    {
+        // Layers are the float variables over the grid, anything else such as coordinates is skipped
+        char name[NC_MAX_NAME + 1];
+        nc_type type;
+        int nDims;
+        int varDims[NC_MAX_VAR_DIMS];
+        checkNetCDF(nc_inq_var(ncid, var, name, &type, &nDims, varDims, nullptr), path);
+        if (type != NC_FLOAT || nDims != 2 || varDims[0] != dims[0] || varDims[1] != dims[1])
+        {
+            continue;
+        }
+        Matrix layerData(sizeX, sizeY);
+        checkNetCDF(nc_get_var_float(ncid, var, layerData.data()), path);
+        add(name, std::move(layerData));
+    }
+#else
+    throw std::runtime_error("uasgroundrisk was built without NetCDF support, enable UGR_WITH_NETCDF");
+#endif
+}
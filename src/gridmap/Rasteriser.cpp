@@ -0,0 +1,268 @@
+#include "uasgroundrisk/gridmap/Rasteriser.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace ugr::gridmap;
+
+namespace
+{
+    /**
+     * Scan the rows of constant x crossed by the edges, calling onRow with the edges that cross any
+     * part of each row
+     * @param rows the number of rows in the gridmap
+     */
+    template <typename TEdge, typename F>
+    void scanRows(std::vector<TEdge> edges, const int rows, F&& onRow)
+    {
+        // The edge table, sorted by where the edges start
+        std::sort(edges.begin(), edges.end(), [](const TEdge& a, const TEdge& b) { return a.x0 < b.x0; });
+        double maxX = edges.front().x1;
+        for (const auto& edge : edges)
+        {
+            maxX = std::max(maxX, edge.x1);
+        }
+        // Only scan the rows the edges cross, clipped to the gridmap
+        const int firstRow = static_cast<int>(std::max(0.0, std::floor(edges.front().x0)));
+        const int lastRow = static_cast<int>(std::min(rows - 1.0, std::ceil(maxX) - 1));
+        std::vector<const TEdge*> active;
+        size_t nextEdge = 0;
+        for (int row = firstRow; row <= lastRow; ++row)
+        {
+            // Add edges starting before the end of this row and drop edges ending before its start
+            while (nextEdge < edges.size() && edges[nextEdge].x0 < row + 1)
+            {
+                active.push_back(&edges[nextEdge++]);
+            }
+            active.erase(std::remove_if(active.begin(), active.end(), [row](const TEdge* edge)
+            {
+                return edge->x1 <= row;
+            }), active.end());
+            if (active.empty())
+            {
+                if (nextEdge == edges.size()) break;
+                continue;
+            }
+            onRow(row, active);
+        }
+    }
+
+    /**
+     * Accumulate the signed area of a segment of an edge within a row. The segment runs from ya to yb
+     * along the row and covers height of the row, signed by the direction of the edge. Each cell gets
+     * the area of the cell beyond the segment less that of the cell before it, so a prefix sum
+     * along the row gives the signed coverage of each cell.
+     * @param accumulation the accumulation buffer of the row. Areas before the start are added to the
+     * first cell and areas past the end are dropped, which leaves the prefix sums of the row unchanged
+     */
+    void accumulateSegment(std::vector<double>& accumulation, const double ya, const double yb, const double height)
+    {
+        const int cells = static_cast<int>(accumulation.size());
+        const auto add = [&accumulation, cells](const int cell, const double area)
+        {
+            if (cell < cells)
+            {
+                accumulation[std::max(0, cell)] += area;
+            }
+        };
+
+        const double y0 = std::min(ya, yb);
+        const double y1 = std::max(ya, yb);
+        const double y0Floor = std::floor(y0);
+        const int y0Cell = static_cast<int>(y0Floor);
+        const int y1Cell = static_cast<int>(std::ceil(y1));
+        if (y1Cell <= y0Cell + 1)
+        {
+            // The segment is within a single cell, which gets the area beyond its midpoint
+            const double mid = 0.5 * (ya + yb) - y0Floor;
+            add(y0Cell, height * (1 - mid));
+            add(y0Cell + 1, height * mid);
+            return;
+        }
+
+        // The segment crosses several cells, its area is a triangle in the first and last cells and
+        // a constant strip in between
+        const double slope = 1 / (y1 - y0);
+        const double y0Fraction = y0 - y0Floor;
+        const double firstArea = 0.5 * slope * (1 - y0Fraction) * (1 - y0Fraction);
+        const double y1Fraction = y1 - y1Cell + 1;
+        const double lastArea = 0.5 * slope * y1Fraction * y1Fraction;
+        add(y0Cell, height * firstArea);
+        if (y1Cell == y0Cell + 2)
+        {
+            add(y0Cell + 1, height * (1 - firstArea - lastArea));
+        }
+        else
+        {
+            const double secondArea = slope * (1.5 - y0Fraction);
+            add(y0Cell + 1, height * (secondArea - firstArea));
+            // Strips below the map all accumulate into its first cell, so are added in one step
+            const int stripsBelow = std::min(y1Cell - 1, 0) - (y0Cell + 2);
+            if (stripsBelow > 0)
+            {
+                add(0, height * slope * stripsBelow);
+            }
+            for (int cell = std::max(y0Cell + 2, 0); cell < std::min(y1Cell - 1, cells); ++cell)
+            {
+                add(cell, height * slope);
+            }
+            const double penultimateArea = secondArea + (y1Cell - y0Cell - 3) * slope;
+            add(y1Cell - 1, height * (1 - penultimateArea - lastArea));
+        }
+        add(y1Cell, height * lastArea);
+    }
+
+    /**
+     * Convert the signed coverage of a cell to the coverage of the even-odd fill, snapping values
+     * within rounding error of empty or full
+     */
+    float evenOddCoverage(const double signedCoverage)
+    {
+        double coverage = std::fmod(std::abs(signedCoverage), 2.0);
+        if (coverage > 1)
+        {
+            coverage = 2 - coverage;
+        }
+        constexpr double epsilon = 1e-6;
+        if (coverage < epsilon) return 0;
+        if (coverage > 1 - epsilon) return 1;
+        return static_cast<float>(coverage);
+    }
+}
+
+Rasteriser::Rasteriser(const Size& size) : size(size)
+{
+}
+
+void Rasteriser::addRing(const std::vector<Vector>& ring)
+{
+    addRing(ring.data(), ring.size());
+}
+
+void Rasteriser::addRing(const Vector* vertices, const size_t count)
+{
+    for (size_t i = 0, j = count - 1; i < count; j = i++)
+    {
+        addEdge(vertices[j], vertices[i]);
+    }
+}
+
+void Rasteriser::addRing(const Polygon& ring)
+{
+    // Shift the vertices by half a cell, so sampling cell centres samples the cell indices
+    const Vector halfCell(0.5, 0.5);
+    for (size_t i = 0, j = ring.size() - 1; i < ring.size(); j = i++)
+    {
+        addEdge(ring[j].cast<double>().matrix() + halfCell, ring[i].cast<double>().matrix() + halfCell);
+    }
+}
+
+void Rasteriser::clear()
+{
+    edges.clear();
+}
+
+void Rasteriser::addEdge(const Vector& a, const Vector& b)
+{
+    // Edges along x are never crossed by a scanline, and invalid points cannot be rasterised
+    if (a.x() == b.x() || !a.allFinite() || !b.allFinite())
+    {
+        return;
+    }
+    if (a.x() < b.x())
+    {
+        edges.push_back({a.x(), a.y(), b.x(), b.y(), 1});
+    }
+    else
+    {
+        edges.push_back({b.x(), b.y(), a.x(), a.y(), -1});
+    }
+}
+
+std::vector<Rasteriser::Span> Rasteriser::rasterise(const SampleMode mode) const
+{
+    if (edges.empty())
+    {
+        return {};
+    }
+    return mode == SampleMode::COVERAGE ? rasteriseCoverage() : rasteriseCentres();
+}
+
+std::vector<Rasteriser::Span> Rasteriser::rasteriseCentres() const
+{
+    std::vector<Span> spans;
+    std::vector<double> crossings;
+    scanRows(edges, size.x(), [this, &spans, &crossings](const int row, const std::vector<const Edge*>& active)
+    {
+        // Find where the edges cross the centre line of the row
+        const double x = row + 0.5;
+        crossings.clear();
+        for (const auto* edge : active)
+        {
+            if (edge->x0 <= x && x < edge->x1)
+            {
+                crossings.push_back(edge->y0 + (x - edge->x0) / (edge->x1 - edge->x0) * (edge->y1 - edge->y0));
+            }
+        }
+        std::sort(crossings.begin(), crossings.end());
+
+        // Crossings pair up into the intervals inside the polygon
+        for (size_t i = 0; i + 1 < crossings.size(); i += 2)
+        {
+            // The cells with centres in [crossings[i], crossings[i + 1])
+            const int yStart = std::max(0, static_cast<int>(std::ceil(crossings[i] - 0.5)));
+            const int yEnd = std::min(size.y(), static_cast<int>(std::ceil(crossings[i + 1] - 0.5)));
+            if (yStart < yEnd)
+            {
+                spans.push_back({row, yStart, yEnd, 1});
+            }
+        }
+    });
+    return spans;
+}
+
+std::vector<Rasteriser::Span> Rasteriser::rasteriseCoverage() const
+{
+    std::vector<Span> spans;
+    std::vector<double> accumulation(size.y(), 0);
+    scanRows(edges, size.x(), [this, &spans, &accumulation](const int row, const std::vector<const Edge*>& active)
+    {
+        int minCell = size.y();
+        int maxCell = -1;
+        for (const auto* edge : active)
+        {
+            // Clip the edge to the row
+            const double xa = std::max(static_cast<double>(row), edge->x0);
+            const double xb = std::min(row + 1.0, edge->x1);
+            if (xa >= xb) continue;
+            const double slope = (edge->y1 - edge->y0) / (edge->x1 - edge->x0);
+            const double ya = edge->y0 + (xa - edge->x0) * slope;
+            const double yb = edge->y0 + (xb - edge->x0) * slope;
+            accumulateSegment(accumulation, ya, yb, (xb - xa) * edge->direction);
+            minCell = std::min(minCell, std::max(0, static_cast<int>(std::floor(std::min(ya, yb)))));
+            maxCell = std::max(maxCell, std::min(size.y() - 1, static_cast<int>(std::ceil(std::max(ya, yb)))));
+        }
+        if (maxCell < minCell) return;
+
+        // A prefix sum along the row gives the signed coverage of each cell, which is emitted as runs
+        // of cells with the same coverage
+        double signedCoverage = 0;
+        int runStart = minCell;
+        float runCoverage = 0;
+        for (int y = minCell; y <= maxCell; ++y)
+        {
+            signedCoverage += accumulation[y];
+            accumulation[y] = 0;
+            const float coverage = evenOddCoverage(signedCoverage);
+            if (coverage != runCoverage)
+            {
+                if (runCoverage > 0) spans.push_back({row, runStart, y, runCoverage});
+                runStart = y;
+                runCoverage = coverage;
+            }
+        }
+        // Past the last edge the coverage is constant to the end of the row
+        const int runEnd = evenOddCoverage(signedCoverage) > 0 ? size.y() : maxCell + 1;
+        if (runCoverage > 0) spans.push_back({row, runStart, runEnd, runCoverage});
+    });
+    return spans;
+}
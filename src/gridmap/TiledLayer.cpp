@@ -0,0 +1,66 @@
+#include "uasgroundrisk/gridmap/TiledLayer.h"
+#include <algorithm>
+
+using namespace ugr::gridmap;
+
+
+TiledLayer::TiledLayer(const int sizeX, const int sizeY, const GridMapDataType fillValue)
+    : sizeX(sizeX), sizeY(sizeY),
+      tilesX((sizeX + TileSize - 1) / TileSize), tilesY((sizeY + TileSize - 1) / TileSize),
+      fillValue(fillValue), tiles(static_cast<size_t>(tilesX) * tilesY)
+{
+}
+
+void TiledLayer::setConstant(const GridMapDataType value)
+{
+    fillValue = value;
+    std::fill(tiles.begin(), tiles.end(), nullptr);
+}
+
+void TiledLayer::copyTiles()
+{
+    for (auto& tile : tiles)
+    {
+        if (tile)
+        {
+            tile = std::make_shared<Matrix>(*tile);
+        }
+    }
+}
+
+Matrix TiledLayer::toDense() const
+{
+    Matrix dense(sizeX, sizeY);
+    forEachTile(dense, [this](const Matrix* tile, Eigen::Block<Matrix> block)
+    {
+        if (tile)
+        {
+            block = tile->topLeftCorner(block.rows(), block.cols());
+        }
+        else
+        {
+            block.setConstant(fillValue);
+        }
+    });
+    return dense;
+}
+
+void TiledLayer::cwiseMaxInto(Matrix& dense) const
+{
+    forEachTile(dense, [this](const Matrix* tile, Eigen::Block<Matrix> block)
+    {
+        if (tile)
+        {
+            block = block.cwiseMax(tile->topLeftCorner(block.rows(), block.cols()));
+        }
+        else
+        {
+            block = block.cwiseMax(fillValue);
+        }
+    });
+}
+
+size_t TiledLayer::getAllocatedTiles() const
+{
+    return std::count_if(tiles.begin(), tiles.end(), [](const std::shared_ptr<Matrix>& tile) { return tile != nullptr; });
+}
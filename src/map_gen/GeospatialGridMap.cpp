@@ -14,7 +14,7 @@ using namespace ugr::gridmap;
 
 ugr::mapping::GeospatialGridMap::GeospatialGridMap(
 	const std::array<float, 4> bounds, const float resolution, const char* worldSrs,
-	const char* projectionSrs) : bounds(bounds), xyRes(resolution)
+	const char* projectionSrs) : bounds(bounds), xyRes(resolution), worldSrs(worldSrs), projectionSrs(projectionSrs)
 {
 	assert(bounds[0] < bounds[2]); // South < North
 	assert(bounds[1] < bounds[3]); // West < East
@@ -33,14 +33,14 @@ GridMapDataType ugr::mapping::GeospatialGridMap::atPosition(const std::string& l
 	const double lat) const
 {
 	const auto localIdx = world2Local(lon, lat);
-	return layers.at(layerName)(localIdx[0], localIdx[1]);
+	return at(layerName, localIdx[0], localIdx[1]);
 }
 
 GridMapDataType& ugr::mapping::GeospatialGridMap::atPosition(const std::string& layerName, const double lon,
 	const double lat)
 {
 	const auto localIdx = world2Local(lon, lat);
-	return layers.at(layerName)(localIdx[0], localIdx[1]);
+	return at(layerName, localIdx[0], localIdx[1]);
 }
 
 GridMapDataType ugr::mapping::GeospatialGridMap::atPosition(const std::string& layerName, const Position& pos) const
@@ -60,7 +60,13 @@ ugr::gridmap::Index ugr::mapping::GeospatialGridMap::world2Local(const Position&
 
 ugr::gridmap::Index ugr::mapping::GeospatialGridMap::world2Local(const double lon, const double lat) const
 {
-	const auto reprojCoord = proj_trans(reproj, PJ_FWD, { lat, lon });
+	const auto localCoord = world2LocalContinuous({ lon, lat });
+	return { static_cast<int>(localCoord[0]), static_cast<int>(localCoord[1]) };
+}
+
+ugr::gridmap::Vector ugr::mapping::GeospatialGridMap::world2LocalContinuous(const Position& worldCoord) const
+{
+	const auto reprojCoord = proj_trans(reproj, PJ_FWD, { worldCoord[1], worldCoord[0] });
 	return {
 		(reprojCoord.enu.e - projectionOrigin[0]) / xyRes, (reprojCoord.enu.n - projectionOrigin[1]) / xyRes
 	};
@@ -84,6 +90,43 @@ void ugr::mapping::GeospatialGridMap::eval()
 {
 }
 
+ugr::mapping::GeospatialGridMap ugr::mapping::GeospatialGridMap::openBinary(const std::string& path)
+{
+	const auto metadata = readBinaryMetadata(path);
+	if (metadata.worldSrs.empty() || metadata.projectionSrs.empty())
+	{
+		throw std::ios_base::failure("Gridmap file at " + path + " has no geospatial reference");
+	}
+	// The geometry is recomputed from the bounds, which must reproduce the stored layer size
+	GeospatialGridMap gridMap(metadata.bounds, metadata.resolution, metadata.worldSrs.c_str(),
+		metadata.projectionSrs.c_str());
+	gridMap.mapBinaryLayers(path);
+	return gridMap;
+}
+
+ugr::mapping::GeospatialGridMap ugr::mapping::GeospatialGridMap::readFromNetCDF(const std::string& path)
+{
+	const auto metadata = readNetCDFMetadata(path);
+	if (metadata.worldSrs.empty() || metadata.projectionSrs.empty())
+	{
+		throw std::ios_base::failure("NetCDF file at " + path + " has no geospatial reference");
+	}
+	GeospatialGridMap gridMap(metadata.bounds, metadata.resolution, metadata.worldSrs.c_str(),
+		metadata.projectionSrs.c_str());
+	gridMap.readNetCDFLayers(path);
+	return gridMap;
+}
+
+std::optional<Position> ugr::mapping::GeospatialGridMap::cellWorldPosition(const int x, const int y) const
+{
+	return local2World(x, y);
+}
+
+GridMapFileMetadata ugr::mapping::GeospatialGridMap::getFileMetadata() const
+{
+	return { bounds, xyRes, worldSrs, projectionSrs };
+}
+
 void ugr::mapping::GeospatialGridMap::setBounds(
 	const std::array<float, 4> boundsArr, const float resolution)
 {
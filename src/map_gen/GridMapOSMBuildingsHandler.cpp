@@ -1,11 +1,11 @@
 #include "uasgroundrisk/map_gen/osm/handlers/GridMapOSMBuildingsHandler.h"
 
+#include <algorithm>
 #include <iostream>
 
 #include "uasgroundrisk/gridmap/TypeDefs.h"
 #include "uasgroundrisk/map_gen/GeospatialGridMap.h"
 #include "uasgroundrisk/gridmap/GridMap.h"
-#include "uasgroundrisk/gridmap/Iterators.h"
 #include "../utils/GeometryProjectionUtils.h"
 #include <osmium/osm/way.hpp>
 
@@ -19,27 +19,12 @@ GridMapOSMBuildingsHandler::GridMapOSMBuildingsHandler(ugr::mapping::GeospatialG
                                                                               gridCRS(gridCRS)
 {
 	gridMap->add("Building Height", 0);
+	buildingHeightLayer = gridMap->getHandle("Building Height");
 }
 
 
-void GridMapOSMBuildingsHandler::way(const osmium::Way& way) const noexcept
+void GridMapOSMBuildingsHandler::way(const osmium::Way& way) noexcept
 {
-	ugr::gridmap::GeoPolygon poly;
-	// Add to a polygon
-	for (const auto& n : way.nodes())
-	{
-		// Nodes are usually invalid because ways have not had node locations mapped
-		// to them
-		if (!n.location().valid())
-		{
-			// std::cerr << "Invalid location for way node; have you used "
-			// 	"NodeLocationsForWays handler?"
-			// 	<< std::endl;
-			continue;
-		}
-		poly.emplace_back(ugr::gridmap::Position(n.lon(), n.lat()));
-	}
-
 	// Initialise to a single floor, as the building must be at least a single level
 	float buildingHeight = buildingLevelHeight;
 	if (way.tags().has_key("building:height"))
@@ -59,10 +44,31 @@ void GridMapOSMBuildingsHandler::way(const osmium::Way& way) const noexcept
 		buildingHeight = std::stof(way.tags().get_value_by_key("levels")) * buildingLevelHeight;
 	}
 
-	for (PolygonIterator iter(*gridMap, poly); !iter.isPastEnd();
-	     ++iter)
+	// Only collect the outline here, it is rasterised with the other buildings on flush
+	buildings.beginGeometry(buildingHeight);
+	buildings.beginRing();
+	for (const auto& n : way.nodes())
 	{
-		const auto gridMapPoint = (*iter);
-		gridMap->at("Building Height", gridMapPoint) = buildingHeight;
+		// Nodes are usually invalid because ways have not had node locations mapped
+		// to them
+		if (!n.location().valid())
+		{
+			continue;
+		}
+		buildings.addVertex(gridMap->world2LocalContinuous(ugr::gridmap::Position(n.lon(), n.lat())));
 	}
 }
+
+void GridMapOSMBuildingsHandler::flush()
+{
+	if (buildings.empty()) return;
+	const int bandSize = GeometryArena<float>::prepareLayers(*gridMap, {buildingHeightLayer});
+	// Overlapping buildings take the max height, which does not depend on the order they are written
+	buildings.rasterise(gridMap->getSize(), Rasteriser::SampleMode::CENTRE, bandSize,
+	                    [this](const float buildingHeight, const Index& gridMapPoint, float)
+	                    {
+		                    auto& height = gridMap->at(buildingHeightLayer, gridMapPoint);
+		                    height = std::max(height, static_cast<GridMapDataType>(buildingHeight));
+	                    });
+	buildings.clear();
+}
@@ -8,9 +8,11 @@
 #include "uasgroundrisk/map_gen/osm/handlers/GridMapOSMHandler.h"
 #include "uasgroundrisk/map_gen/osm/OSMTag.h"
 #include "uasgroundrisk/gridmap/GridMap.h"
-#include "uasgroundrisk/gridmap/Iterators.h"
-#include "../utils/GeometryProjectionUtils.h"
+#include "../utils/GeometryOperations.h"
 #include <osmium/osm/way.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <utility>
 #include "spdlog/spdlog.h"
 
@@ -31,25 +33,54 @@ GridMapOSMHandler::GridMapOSMHandler(
       densityTagMap(std::move(densityTagMap)), gridCRS(std::move(gridCRS))
 {
     spdlog::info("Constructing gridmap OSM handler");
-    std::tie(reproj, projCtx) = util::makeProjObject();
-
-    std::map<GEOSGeometry*, float> reprojectedPopulationGeomMap;
-    std::transform(densityGeometryMap.cbegin(), densityGeometryMap.cend(),
-                   std::inserter(reprojectedPopulationGeomMap,
-                                 reprojectedPopulationGeomMap.begin()),
-                   [this](std::pair<GEOSGeometry*, float> in)
-               -> std::pair<GEOSGeometry*, float>
-                   {
-                       auto* reprojPoly = ugr::util::reprojectPolygon(
-                           reproj,
-                           in.first);
-                       return {reprojPoly, in.second};
-                   });
+
+    // Burn the density geometries into a raster once, so finding the density of a cell is an array
+    // read instead of a containment test against every geometry. Each cell takes the density of the
+    // geometries covering it weighted by the fraction they cover, so population is conserved in cells
+    // on the boundaries between geometries
+    if (!densityGeometryMap.empty())
+    {
+        GeometryArena<GridMapDataType> densityGeometries;
+        for (const auto& densityGeomPair : densityGeometryMap)
+        {
+            const auto nGeom = GEOSGetNumGeometries(densityGeomPair.first);
+            for (int i = 0; i < nGeom; ++i)
+            {
+                densityGeometries.beginGeometry(densityGeomPair.second);
+                densityGeometries.beginRing();
+                for (const auto& point : util::asGeoPolygon(GEOSGetGeometryN(densityGeomPair.first, i)))
+                {
+                    densityGeometries.addVertex(gridMap->world2LocalContinuous(point));
+                }
+            }
+        }
+
+        const auto size = gridMap->getSize();
+        densityRaster = Matrix::Constant(size.x(), size.y(), std::numeric_limits<GridMapDataType>::quiet_NaN());
+        Matrix coveredRaster = Matrix::Zero(size.x(), size.y());
+        densityGeometries.rasterise(size, Rasteriser::SampleMode::COVERAGE,
+                                    GeometryArena<GridMapDataType>::DefaultBandSize,
+                                    [this, &coveredRaster](const GridMapDataType geomDensity, const Index& index,
+                                                           const float cellCoverage)
+                                    {
+                                        // Earlier geometries take precedence over the part of the cell they cover
+                                        auto& covered = coveredRaster(index.x(), index.y());
+                                        const auto coverage = std::min<GridMapDataType>(cellCoverage, 1 - covered);
+                                        if (coverage <= 0) return;
+                                        auto& density = densityRaster(index.x(), index.y());
+                                        if (std::isnan(density))
+                                        {
+                                            density = 0;
+                                        }
+                                        density += geomDensity * coverage;
+                                        covered += coverage;
+                                    });
+    }
 }
 
-void GridMapOSMHandler::way(const osmium::Way& way) const noexcept
+void GridMapOSMHandler::way(const osmium::Way& way) noexcept
 {
-	GeoPolygon poly;
+	std::vector<Vector> poly;
 	// Add to a polygon
 	for (const auto& n : way.nodes())
 	{
@@ -57,19 +88,11 @@ void GridMapOSMHandler::way(const osmium::Way& way) const noexcept
 		// to them
 		if (!n.location().valid())
 		{
-			// std::cerr << "Invalid location for way node; have you used "
-			// 	"NodeLocationsForWays handler?"
-			// 	<< std::endl;
 			continue;
 		}
-		// PJ_COORD c = proj_trans(reproj, PJ_FWD, proj_coord(n.lat(), n.lon(), 0, 0));
-		poly.emplace_back(Position(n.lon(), n.lat()));
+		poly.emplace_back(gridMap->world2LocalContinuous(Position(n.lon(), n.lat())));
 	}
 
-    // Check if there is any geometry defining density
-    // We do this outside the loop as it does not change within the scope of the loop
-    const bool emptyDensityGeom = densityGeometryMap.empty();
-
     // Iterate through the tags associated with the way.
     // This is usually a single relevant tag that is mapped to a grid map layer,
     // however a single geometry can appear on multiple layer
@@ -89,53 +112,22 @@ void GridMapOSMHandler::way(const osmium::Way& way) const noexcept
                 fallbackDensity = densityIter->second;
             }
 
-            // If we find a relevant tag, we can iterate the geometry using grid map'
-            // polygon iterator
-            std::string layerName = tagLayerIter->second;
-            for (PolygonIterator iter(*gridMap, poly); !iter.isPastEnd();
-                 ++iter)
+            // Collect the geometry to rasterise on flush
+            geometries.beginGeometry({gridMap->getHandle(tagLayerIter->second), fallbackDensity, true});
+            geometries.beginRing();
+            for (const auto& vertex : poly)
             {
-                const auto gridMapPoint = (*iter);
-
-                if (!emptyDensityGeom)
-                {
-                    // Each point must be converted to a GEOS geometry for the geometric
-                    // predicates to work
-                    auto* p = GEOSGeom_createPointFromXY(gridMapPoint.x(),
-                                                         gridMapPoint.y()); // GEOS alloc
-
-                    // Iterate through population geometries to find the which one this
-                    // point is within
-                    for (const auto& populationGeomPair : densityGeometryMap)
-                    {
-                        if (GEOSWithin(p, populationGeomPair.first) == 1)
-                        {
-                            // Set the grid map at this point to the population density
-                            // estimate in this geometry
-                            gridMap->at(layerName, gridMapPoint) = populationGeomPair.second;
-                            break;
-                        }
-                    }
-                    // Free test GEOS point
-                    GEOSGeom_destroy(p); // GEOS free
-                }
-
-                //If we haven't broken out the loop by here then use the fallback density
-                // Set the grid map at this point to the population density estimate
-                // in this geometry
-                setFallbackValue(layerName, gridMapPoint, fallbackDensity);
+                geometries.addVertex(vertex);
             }
         }
     }
 }
 
-void GridMapOSMHandler::area(const osmium::Area& area) const noexcept
+void GridMapOSMHandler::area(const osmium::Area& area) noexcept
 {
-    std::vector<OSMTag> tags;
     for (const auto& tag : area.tags())
     {
         OSMTag fullTag(tag.key(), tag.value());
-        tags.emplace_back(fullTag);
         // Try to find the tag in our map
         auto tagLayerIter = tagLayerMap.find(fullTag);
         if (tagLayerIter != tagLayerMap.end())
@@ -148,84 +140,82 @@ void GridMapOSMHandler::area(const osmium::Area& area) const noexcept
             {
                 fallbackDensity = densityIter->second;
             }
-            
-            for (const auto& outerRing : area.outer_rings())
-            {
-                std::vector<GeoPolygon> inners;
-                for (const auto& innerRing : area.inner_rings(outerRing))
-                {
-                    GeoPolygon poly;
-                    // Add to a polygon
-                    for (const auto& n : innerRing)
-                    {
-                        // Nodes are usually invalid because ways have not had node locations mapped
-                        // to them
-                        if (!n.location().valid())
-                        {
-                            // std::cerr << "Invalid location for way node; have you used "
-                            //     "NodeLocationsForWays handler?"
-                            //     << std::endl;
-                            continue;
-                        }
-                        // PJ_COORD c = proj_trans(reproj, PJ_FWD, proj_coord(n.lat(), n.lon(), 0, 0));
-                        poly.emplace_back(Position(n.lon(), n.lat()));
-                    }
-                    inners.emplace_back(poly);
-                }
 
-                GeoPolygon orPoly;
-                // Add to a polygon
-                for (const auto& n : outerRing)
+            // Collect all outer and inner rings together, so holes are left unfilled
+            geometries.beginGeometry({gridMap->getHandle(tagLayerIter->second), fallbackDensity, false});
+            const auto addRing = [this](const osmium::NodeRefList& ring)
+            {
+                geometries.beginRing();
+                for (const auto& n : ring)
                 {
                     // Nodes are usually invalid because ways have not had node locations mapped
                     // to them
                     if (!n.location().valid())
                     {
-                        // std::cerr << "Invalid location for way node; have you used "
-                        //     "NodeLocationsForWays handler?"
-                        //     << std::endl;
                         continue;
                     }
-                    // PJ_COORD c = proj_trans(reproj, PJ_FWD, proj_coord(n.lat(), n.lon(), 0, 0));
-                    orPoly.emplace_back(Position(n.lon(), n.lat()));
+                    geometries.addVertex(gridMap->world2LocalContinuous(Position(n.lon(), n.lat())));
                 }
-
-                std::string layerName = tagLayerIter->second;
-                for (PolygonIterator iter(*gridMap, orPoly); !iter.isPastEnd();
-                     ++iter)
+            };
+            for (const auto& outerRing : area.outer_rings())
+            {
+                addRing(outerRing);
+                for (const auto& innerRing : area.inner_rings(outerRing))
                 {
-                    const auto gridMapPoint = (*iter);
-                    setFallbackValue(layerName, gridMapPoint, fallbackDensity);
-                }
-                for (const auto irPoly : inners)
-                {
-                    for (PolygonIterator iter(*gridMap, irPoly); !iter.isPastEnd();
-                         ++iter)
-                    {
-                        const auto gridMapPoint = (*iter);
-                        setFallbackValue(layerName, gridMapPoint, 0);
-                    }
+                    addRing(innerRing);
                 }
             }
         }
     }
 }
 
-void GridMapOSMHandler::setFallbackValue(const std::string& layerName, const gridmap::Index& gridMapPoint,
-                                         const gridmap::Matrix::Scalar& fallbackDensity) const
+void GridMapOSMHandler::flush()
 {
-    gridMap->at(layerName, gridMapPoint) = fallbackDensity;
+    if (geometries.empty()) return;
+    if (writtenLayers.empty())
+    {
+        for (const auto& tagLayerPair : tagLayerMap)
+        {
+            writtenLayers.push_back(gridMap->getHandle(tagLayerPair.second));
+        }
+    }
+    const int bandSize = GeometryArena<DensityRecord>::prepareLayers(*gridMap, writtenLayers);
+
+    // Check if there is any geometry defining density
+    const bool emptyDensityGeom = densityRaster.size() == 0;
+    geometries.rasterise(gridMap->getSize(), Rasteriser::SampleMode::COVERAGE, bandSize,
+                         [this, emptyDensityGeom](const DensityRecord& record, const Index& gridMapPoint,
+                                                  const float coverage)
+                         {
+                             // Use the density of the geometry this point is within, if there is one
+                             if (record.useDensityRaster && !emptyDensityGeom)
+                             {
+                                 const auto geomDensity = densityRaster(gridMapPoint.x(), gridMapPoint.y());
+                                 if (!std::isnan(geomDensity))
+                                 {
+                                     setFallbackValue(record.layer, gridMapPoint, geomDensity, coverage);
+                                     return;
+                                 }
+                             }
+
+                             // Otherwise use the fallback density
+                             setFallbackValue(record.layer, gridMapPoint, record.density, coverage);
+                         });
+    geometries.clear();
 }
 
-GridMapOSMHandler::~GridMapOSMHandler()
+void GridMapOSMHandler::setFallbackValue(const LayerHandle layer, const gridmap::Index& gridMapPoint,
+                                         const gridmap::Matrix::Scalar& fallbackDensity,
+                                         const float coverage) const
 {
-    // Free PROJ objects
-    proj_destroy(reproj);
-    proj_context_destroy(projCtx);
-
-    // Free all GEOS geometries
-    for (const auto& pair : densityGeometryMap)
+    // Cells on the boundary of a geometry add its density weighted by the fraction covered, so
+    // geometries sharing a boundary conserve population. Negative densities mark missing values
+    if (coverage < 1 && fallbackDensity >= 0)
+    {
+        gridMap->at(layer, gridMapPoint) += fallbackDensity * coverage;
+    }
+    else
     {
-        GEOSGeom_destroy(pair.first);
+        gridMap->at(layer, gridMapPoint) = fallbackDensity;
     }
 }
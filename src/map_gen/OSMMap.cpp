@@ -10,10 +10,22 @@ ugr::mapping::OSMMap::OSMMap(const std::array<float, 4>& bounds, const float res
 void ugr::mapping::OSMMap::addOSMLayer(const std::string& layerName, const std::vector<osm::OSMTag>& tags,
                                        const float defaultValue)
 {
-	add(layerName, 0);
+	addFeatureLayer(layerName, 0);
 	for (const auto& tag : tags)
 	{
 		tagLayerMap.emplace(tag, layerName);
 	}
 	isEvaluated = false;
 }
+
+void ugr::mapping::OSMMap::addFeatureLayer(const std::string& layerName, const float fillValue)
+{
+	if (tiledStorage)
+	{
+		addTiled(layerName, fillValue);
+	}
+	else
+	{
+		add(layerName, fillValue);
+	}
+}
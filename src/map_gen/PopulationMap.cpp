@@ -9,6 +9,7 @@
 #include "uasgroundrisk/map_gen/osm/handlers/GridMapOSMHandler.h"
 #include "uasgroundrisk/map_gen/osm/OSMOverpassQuery.h"
 #include "uasgroundrisk/map_gen/osm/handlers/GridMapOSMBuildingsHandler.h"
+#include <utility>
 
 using namespace ugr::util;
 
@@ -30,23 +31,45 @@ void ugr::mapping::PopulationMap::addOSMLayer(const std::string& layerName, cons
 
 void ugr::mapping::PopulationMap::eval()
 {
-	if (isEvaluated) return;
-	// Sum all layers together into a single layer using the max value for each
-	// cell
-	constexpr auto densitySumLayerName = "Population Density";
-	add(densitySumLayerName, 0);
-
-	osm::GridMapOSMHandler handler(this, tagLayerMap, popDensityGeomMap,
-	                               densityTagMap);
-	OSMMap::eval(handler);
-
-	for (const auto& layerName : getLayers())
-	{
-		// GridMap coordinate frame convention has the y axis increasing to the
-		// left, which flips everything around the x (vertical) axis. Here we flip
-		// it back.
-		get(densitySumLayerName) =
-			get(densitySumLayerName).cwiseMax(get(layerName));
-	}
-	isEvaluated = true;
+    if (isEvaluated) return;
+    osm::OSMSession session;
+    session.addMap(*this);
+    session.eval();
+}
+
+std::unique_ptr<ugr::mapping::osm::OSMEntityHandler> ugr::mapping::PopulationMap::makeSessionHandler()
+{
+    add("Population Density", 0);
+    return osm::makeEntityHandler<osm::GridMapOSMHandler>(this, tagLayerMap, popDensityGeomMap,
+                                                          densityTagMap);
+}
+
+void ugr::mapping::PopulationMap::finishSessionEval()
+{
+    combineDensityLayers();
+    isEvaluated = true;
+}
+
+void ugr::mapping::PopulationMap::combineDensityLayers()
+{
+    // Sum all layers together into a single layer using the max value for each
+    // cell. The combined layer is always dense, as it is the input to risk maps.
+    constexpr auto densitySumLayerName = "Population Density";
+    add(densitySumLayerName, 0);
+    Matrix& densitySum = get(densitySumLayerName);
+    for (const auto& layerName : getLayers())
+    {
+        if (layerName == densitySumLayerName)
+        {
+            continue;
+        }
+        if (isTiled(layerName))
+        {
+            std::as_const(*this).getTiled(layerName).cwiseMaxInto(densitySum);
+        }
+        else
+        {
+            densitySum = densitySum.cwiseMax(view(layerName));
+        }
+    }
 }
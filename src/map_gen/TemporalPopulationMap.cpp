@@ -3,7 +3,11 @@
 #include "../src/utils/GeometryOperations.h"
 #include "../src/utils/GeometryProjectionUtils.h"
 #include "../src/map_gen/census/Ingest.h"
+#include "../src/map_gen/census/CensusIndex.h"
 #include "uasgroundrisk/gridmap/Iterators.h"
+#include "uasgroundrisk/gridmap/GeometryArena.h"
+#include <set>
+#include <utility>
 
 ugr::mapping::TemporalPopulationMap::TemporalPopulationMap(const std::array<float, 4>& bounds, const int resolution,
 	const short defaultHour) :
@@ -12,11 +16,9 @@ ugr::mapping::TemporalPopulationMap::TemporalPopulationMap(const std::array<floa
 	// We try to precompute/fetch as many of the steps and data dependencies that are invariant for the life of the object.
 	// In practice, this means that as long as the bounds and resolution stay the same, this data will stay the same.
 
-	// Get census data
+	// Get census data, clipping the wards near the bounds found from the census index shared by all maps
 	CensusIngest censusIngest(geosCtx);
-	// TODO: use an STR tree (impl in GEOS) for faster search?
-	auto geomDensityMap = censusIngest.makePopulationDensityMap<GridMapDataType>();
-	auto boundedGeomDensityMap = util::boundGeometriesMap_r(geomDensityMap, bounds, geosCtx);
+	auto boundedGeomDensityMap = CensusIndex::shared()->clipToBounds<GridMapDataType>(bounds, geosCtx);
 	popDensityGeomMap.swap(boundedGeomDensityMap);
 	for (const auto& pair : popDensityGeomMap)
 	{
@@ -58,12 +60,15 @@ ugr::mapping::TemporalPopulationMap::TemporalPopulationMap(const std::array<floa
 			static_cast<decltype(areas)::value_type>(0));
 		tagAreas.emplace(pair.first, areaSum);
 	}
+	setUnitDensities();
 	setHourOfDay(defaultHour);
 }
 
 ugr::mapping::TemporalPopulationMap::~TemporalPopulationMap()
 {
 	spdlog::debug("Destructing Temporal Population gridmap");
+	if (censusTree != nullptr)
+		GEOSSTRtree_destroy_r(geosCtx, censusTree);
 	spdlog::debug("Destroying existing GEOS geometries");
 	util::destroyGEOSGeoms(boundedGeometries);
 	spdlog::debug("Destroying GEOS context");
@@ -78,8 +83,13 @@ void ugr::mapping::TemporalPopulationMap::setHourOfDay(const short hourOfDay)
 		throw std::out_of_range("Hour of Day must be 0<=h<=23");
 	}
 	this->hourOfDay = hourOfDay;
+	// Only the proportions of each NHAPS group change between hours, so the rasterised geometries are
+	// reused and only recombined on the next evaluation
 	isEvaluated = false;
+}
 
+void ugr::mapping::TemporalPopulationMap::setUnitDensities()
+{
 	densityTagMap.clear();
 	activeGeomDensityMap.clear();
 
@@ -87,19 +97,13 @@ void ugr::mapping::TemporalPopulationMap::setHourOfDay(const short hourOfDay)
 	{
 		// Get the OSM tags mapped to this NHAPS category
 		const auto groupOSMTags = CensusNHAPSIngest::NHAPS_OSM_MAPPING[i];
-		// Lookup the proportion of this NHAPS category for this time
-		const auto groupProportion = nhapsProps[hourOfDay][i];
-		// Work out the absolute population we have assigned to this NHAPS category
-		const auto groupPopulation = totalPopulation * groupProportion;
 		// Residential population is special case as we already have densities for the wards
 		// If we did this the same as other categories we would discard this density info and have uniform residential densities
 		if (i == 0)
 		{
 			for (auto* geom : boundedGeometries)
 			{
-				const auto fullPopDensity = popDensityGeomMap.at(geom);
-				const auto scaledPopDensity = groupProportion * fullPopDensity;
-				activeGeomDensityMap.emplace(geom, scaledPopDensity);
+				activeGeomDensityMap.emplace(geom, popDensityGeomMap.at(geom));
 			}
 		}
 		else
@@ -113,7 +117,8 @@ void ugr::mapping::TemporalPopulationMap::setHourOfDay(const short hourOfDay)
 					return acc + tagAreas.at(tag);
 				});
 
-			const auto groupDensity = groupPopulation / groupArea;
+			// The density if the entire population were in this NHAPS category
+			const auto groupDensity = totalPopulation / groupArea;
 			for (const auto& tag : groupOSMTags)
 			{
 				densityTagMap.emplace(tag, groupDensity);
@@ -157,10 +162,12 @@ void ugr::mapping::TemporalPopulationMap::intersectResidentialGeometries()
 	std::vector<GEOSGeometry*> intersectedBoundedGeometries;
 	intersectedBoundedGeometries.reserve(boundedGeometries.size());
 
+	// Index the residential geometries, so each ward is only tested against those near it
+	auto* residentialTree = makeTree(residentialGeoms);
 	for (const auto geom : boundedGeometries)
 	{
 		const auto* prepGeom = GEOSPrepare_r(geosCtx, geom);
-		for (const auto& resGeom : residentialGeoms)
+		for (auto* resGeom : queryTree(residentialTree, geom))
 		{
 			if (GEOSPreparedIntersects_r(geosCtx, prepGeom, resGeom))
 			{
@@ -172,10 +179,41 @@ void ugr::mapping::TemporalPopulationMap::intersectResidentialGeometries()
 				intersectedBoundedGeometries.emplace_back(intersectGeom);
 			}
 		}
+		GEOSPreparedGeom_destroy_r(geosCtx, prepGeom);
 	}
+	GEOSSTRtree_destroy_r(geosCtx, residentialTree);
 	popDensityGeomMap.swap(intersectedPopDensityGeomMap);
 	boundedGeometries.swap(intersectedBoundedGeometries);
 	tagGeomMap[{"landuse", "residential"}] = boundedGeometries;
+
+	// Index the census geometries, to find the one under each OSM geometry without a density in eval
+	if (censusTree != nullptr)
+		GEOSSTRtree_destroy_r(geosCtx, censusTree);
+	censusTree = makeTree(boundedGeometries);
+}
+
+GEOSSTRtree* ugr::mapping::TemporalPopulationMap::makeTree(const std::vector<GEOSGeometry*>& geoms) const
+{
+	auto* tree = GEOSSTRtree_create_r(geosCtx, 10);
+	for (auto* geom : geoms)
+	{
+		GEOSSTRtree_insert_r(geosCtx, tree, geom, geom);
+	}
+	GEOSSTRtree_build_r(geosCtx, tree);
+	return tree;
+}
+
+std::vector<GEOSGeometry*> ugr::mapping::TemporalPopulationMap::queryTree(GEOSSTRtree* tree,
+	const GEOSGeometry* geom) const
+{
+	std::vector<GEOSGeometry*> candidates;
+	GEOSSTRtree_query_r(geosCtx, tree, geom, [](void* item, void* userdata)
+	{
+		static_cast<std::vector<GEOSGeometry*>*>(userdata)->push_back(static_cast<GEOSGeometry*>(item));
+	}, &candidates);
+	// Sort the candidates so they are visited in a deterministic order, matching maps keyed by geometry
+	std::sort(candidates.begin(), candidates.end());
+	return candidates;
 }
 
 void ugr::mapping::TemporalPopulationMap::setOSMGeometries()
@@ -189,7 +227,7 @@ void ugr::mapping::TemporalPopulationMap::setOSMGeometries()
 	for (auto& tag : tags)
 	{
 		tagLayerMap.emplace(tag, tag.to_string());
-		add(tag.to_string(), 0);
+		addFeatureLayer(tag.to_string(), 0);
 	}
 	osm::OSMTagGeometryHandler handler(tags, tagGeomMap, geosCtx);
 
@@ -203,23 +241,81 @@ void ugr::mapping::TemporalPopulationMap::fillGridMapPoly(const std::string& lay
 {
 	const auto poly = util::asGeoPolygon_r(geom, geosCtx);
 	if (poly.size() < 3) return;
-	for (PolygonIterator iter(*this, poly); !iter.isPastEnd();
+	const LayerHandle layer = getHandle(layerName);
+	for (PolygonIterator iter(*this, poly, Rasteriser::SampleMode::COVERAGE); !iter.isPastEnd();
 		++iter)
 	{
-		const auto gridMapPoint = (*iter);
-		at(layerName, gridMapPoint) = geomDensity;
+		writeCoverage(layer, *iter, geomDensity, iter.coverage());
 	}
 }
 
+void ugr::mapping::TemporalPopulationMap::addGridMapPoly(GeometryArena<PolygonDensity>& polygons,
+	const LayerHandle layer, const GEOSGeometry* geom, const GridMapDataType geomDensity) const
+{
+	polygons.beginGeometry({ layer, geomDensity });
+	polygons.beginRing();
+	for (const auto& point : util::asGeoPolygon_r(geom, geosCtx))
+	{
+		polygons.addVertex(world2LocalContinuous(point));
+	}
+}
+
+void ugr::mapping::TemporalPopulationMap::writeCoverage(const LayerHandle layer, const Index& gridMapPoint,
+	const GridMapDataType geomDensity, const float coverage)
+{
+	// Cells inside the polygon take its density, while cells on its boundary add the density weighted
+	// by the fraction covered, so polygons sharing a boundary conserve population at coarse resolutions.
+	// Negative densities mark missing values, so are never weighted
+	if (coverage < 1 && geomDensity >= 0)
+		at(layer, gridMapPoint) += geomDensity * coverage;
+	else
+		at(layer, gridMapPoint) = geomDensity;
+}
+
 void ugr::mapping::TemporalPopulationMap::eval()
 {
 	if (isEvaluated) return;
+	if (groupDensities.empty())
+	{
+		rasterise();
+	}
+	add("Population Density", 0);
+	get("Population Density") = combineGroupDensities(hourOfDay);
+	isEvaluated = true;
+}
+
+std::vector<ugr::gridmap::Matrix> ugr::mapping::TemporalPopulationMap::evalHours(const std::vector<short>& hours)
+{
+	for (const auto hour : hours)
+	{
+		if (hour < 0 || hour > 23)
+		{
+			throw std::out_of_range("Hour of Day must be 0<=h<=23");
+		}
+	}
+	eval();
+	std::vector<Matrix> densities(hours.size());
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < static_cast<int>(hours.size()); ++i)
+	{
+		densities[i] = combineGroupDensities(hours[i]);
+	}
+	return densities;
+}
+
+void ugr::mapping::TemporalPopulationMap::rasterise()
+{
+	// Resolve the density of every geometry first, as the GEOS context cannot be shared between
+	// threads, then rasterise all of them together in parallel
+	GeometryArena<PolygonDensity> polygons;
+	std::vector<LayerHandle> layers;
 	for (auto& pair : tagGeomMap)
 	{
 		GridMapDataType fallbackDensity = -1;
 		if (densityTagMap.count(pair.first) == 1)
 			fallbackDensity = densityTagMap.at(pair.first);
-		std::string layerName = tagLayerMap.at(pair.first);
+		const LayerHandle layer = getHandle(tagLayerMap.at(pair.first));
+		layers.push_back(layer);
 		for (auto& geom : pair.second)
 		{
 			auto geomDensity = fallbackDensity;
@@ -232,49 +328,86 @@ void ugr::mapping::TemporalPopulationMap::eval()
 				else
 				{
 					const auto* prepGeom = GEOSPrepare_r(geosCtx, geom);
-					// Iterate through population geometries to find the which one this
-					// point is within
-					for (const auto& populationGeomPair : activeGeomDensityMap)
+					// Find the population geometry this geometry is within, from those with
+					// envelopes overlapping it
+					const auto candidates = censusTree != nullptr
+						                        ? queryTree(censusTree, geom)
+						                        : std::vector<GEOSGeometry*>();
+					for (auto* populationGeom : candidates)
 					{
-						// const auto gp = util::asGeoPolygon_r(populationGeomPair.first, geosCtx);
-						if (GEOSPreparedIntersects_r(geosCtx, prepGeom, populationGeomPair.first))
+						const auto populationIter = activeGeomDensityMap.find(populationGeom);
+						if (populationIter == activeGeomDensityMap.end()) continue;
+						if (GEOSPreparedIntersects_r(geosCtx, prepGeom, populationGeom))
 						{
-							geom = GEOSIntersection_r(geosCtx, geom, populationGeomPair.first);
-							geomDensity = populationGeomPair.second;
+							GEOSPreparedGeom_destroy_r(geosCtx, prepGeom);
+							prepGeom = nullptr;
+							geom = GEOSIntersection_r(geosCtx, geom, populationGeom);
+							geomDensity = populationIter->second;
 							break;
 						}
 					}
+					if (prepGeom != nullptr)
+						GEOSPreparedGeom_destroy_r(geosCtx, prepGeom);
 					if (geom == nullptr || !GEOSisValid_r(geosCtx, geom)) continue;
 				}
 			}
-			// const auto t = GEOSGeomTypeId_r(geosCtx, geom);
-			// if (t != GEOS_POLYGON)
-			// {
 			const auto nGeom = GEOSGetNumGeometries_r(geosCtx, geom);
 			for (int i = 0; i < nGeom; ++i)
 			{
 				const auto* g = GEOSGetGeometryN_r(geosCtx, geom, i);
 				if (g != nullptr && GEOSisValid_r(geosCtx, g)) {
-					fillGridMapPoly(layerName, g, geomDensity);
+					addGridMapPoly(polygons, layer, g, geomDensity);
 				}
-				// }
-				// else
-				// {
-				//     fillGridMapPoly(layerName, geom, geomDensity);
-				// }
 			}
 		}
+	}
+
+	const int bandSize = GeometryArena<PolygonDensity>::prepareLayers(*this, layers);
+	polygons.rasterise(getSize(), Rasteriser::SampleMode::COVERAGE, bandSize,
+	                   [this](const PolygonDensity& polygon, const Index& gridMapPoint, const float coverage)
+	                   {
+		                   writeCoverage(polygon.layer, gridMapPoint, polygon.density, coverage);
+	                   });
 
-		//Combine layers to pop density;
-		add("Population Density", 0);
-		for (const auto& layerName : getLayers())
+	// Every layer of a group scales with the same proportion, so the max of the group's layers is
+	// taken once here rather than for every hour
+	constexpr auto densitySumLayerName = "Population Density";
+	const auto size = getSize();
+	groupDensities.assign(CensusNHAPSIngest::NHAPS_OSM_MAPPING.size() + 1, Matrix::Zero(size.x(), size.y()));
+	const auto maxInto = [this](const std::string& layerName, Matrix& groupDensity)
+	{
+		if (isTiled(layerName))
+			std::as_const(*this).getTiled(layerName).cwiseMaxInto(groupDensity);
+		else
+			groupDensity = groupDensity.cwiseMax(view(layerName));
+	};
+	std::set<std::string> groupedLayers;
+	for (int i = 0; i < CensusNHAPSIngest::NHAPS_OSM_MAPPING.size(); ++i)
+	{
+		for (const auto& tag : CensusNHAPSIngest::NHAPS_OSM_MAPPING[i])
 		{
-			// GridMap coordinate frame convention has the y axis increasing to the
-			// left, which flips everything around the x (vertical) axis. Here we flip
-			// it back.
-			get("Population Density") =
-				get("Population Density").cwiseMax(get(layerName));
+			const auto& layerName = tagLayerMap.at(tag);
+			if (groupedLayers.insert(layerName).second)
+				maxInto(layerName, groupDensities[i]);
 		}
-		isEvaluated = true;
 	}
+	// Any other layers are combined at every hour without scaling
+	for (const auto& layerName : getLayers())
+	{
+		if (layerName != densitySumLayerName && groupedLayers.count(layerName) == 0)
+			maxInto(layerName, groupDensities.back());
+	}
+}
+
+ugr::gridmap::Matrix ugr::mapping::TemporalPopulationMap::combineGroupDensities(const short hour) const
+{
+	// Combine the group densities scaled by the proportion of the population in each group at this
+	// hour, which is the max of the layers as they would be if rasterised with the scaled densities
+	Matrix densitySum = groupDensities.back();
+	const auto& groupProportions = nhapsProps[hour];
+	for (int i = 0; i + 1 < groupDensities.size(); ++i)
+	{
+		densitySum = densitySum.cwiseMax(groupDensities[i] * groupProportions[i]);
+	}
+	return densitySum;
 }
@@ -0,0 +1,370 @@
+#include "CensusCache.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <limits>
+#include <random>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	// Every field is 8 bytes or a multiple of them until the tile ward lists at the end of the file,
+	// so vertices can be copied straight from the mapped file
+	constexpr char cacheMagic[8] = {'U', 'G', 'R', 'C', 'E', 'N', 'S', '\0'};
+	constexpr uint32_t cacheVersion = 1;
+	constexpr uint32_t cacheByteOrderMark = 0x01020304;
+	constexpr size_t headerBytes = sizeof(cacheMagic) + 2 * sizeof(uint32_t) + 3 * sizeof(double)
+		+ 2 * sizeof(int32_t) + 4 * sizeof(uint64_t);
+
+	template <typename T>
+	void append(std::string& buffer, const T& value)
+	{
+		buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	/**
+	 * Append the coordinates of a ring as a count and interleaved x and y values
+	 */
+	void appendRing(std::string& buffer, const GEOSGeometry* ring, GEOSContextHandle_t geosCtx)
+	{
+		const auto* coordSeq = GEOSGeom_getCoordSeq_r(geosCtx, ring);
+		unsigned nCoords = 0;
+		GEOSCoordSeq_getSize_r(geosCtx, coordSeq, &nCoords);
+		std::vector<double> coords(2 * nCoords);
+		if (nCoords > 0)
+		{
+			GEOSCoordSeq_copyToBuffer_r(geosCtx, coordSeq, coords.data(), 0, 0);
+		}
+		append<uint64_t>(buffer, nCoords);
+		buffer.append(reinterpret_cast<const char*>(coords.data()), coords.size() * sizeof(double));
+	}
+
+	void appendPolygon(std::string& buffer, const GEOSGeometry* polygon, GEOSContextHandle_t geosCtx)
+	{
+		const int nInterior = GEOSGetNumInteriorRings_r(geosCtx, polygon);
+		append<uint64_t>(buffer, 1 + std::max(0, nInterior));
+		appendRing(buffer, GEOSGetExteriorRing_r(geosCtx, polygon), geosCtx);
+		for (int i = 0; i < nInterior; ++i)
+		{
+			appendRing(buffer, GEOSGetInteriorRingN_r(geosCtx, polygon, i), geosCtx);
+		}
+	}
+
+	std::pair<int32_t, int32_t> tileOf(const double x, const double y, const double originX, const double originY)
+	{
+		return {
+			static_cast<int32_t>(std::floor((x - originX) / CensusCache::TILE_SIZE)),
+			static_cast<int32_t>(std::floor((y - originY) / CensusCache::TILE_SIZE))
+		};
+	}
+}
+
+void CensusCache::write(const std::string& path, const std::map<GEOSGeometry*, double>& geomDensityMap,
+                        GEOSContextHandle_t geosCtx)
+{
+	// Encode each ward record after the header, keeping its bounding box for the index
+	std::string records;
+	std::vector<uint64_t> wardOffsets;
+	std::vector<std::array<double, 4>> wardBounds;
+	for (const auto& pair : geomDensityMap)
+	{
+		const auto type = GEOSGeomTypeId_r(geosCtx, pair.first);
+		if (type != GEOS_POLYGON && type != GEOS_MULTIPOLYGON) continue;
+		std::array<double, 4> bounds{};
+		if (GEOSGeom_getExtent_r(geosCtx, pair.first, &bounds[0], &bounds[1], &bounds[2], &bounds[3]) == 0)
+		{
+			continue;
+		}
+
+		wardOffsets.push_back(headerBytes + records.size());
+		wardBounds.push_back(bounds);
+		append(records, pair.second);
+		for (const double bound : bounds)
+		{
+			append(records, bound);
+		}
+		const int nParts = GEOSGetNumGeometries_r(geosCtx, pair.first);
+		append<uint64_t>(records, nParts);
+		for (int i = 0; i < nParts; ++i)
+		{
+			appendPolygon(records, GEOSGetGeometryN_r(geosCtx, pair.first, i), geosCtx);
+		}
+	}
+
+	// The tile grid covers the bounding boxes of all wards
+	double originX = 0, originY = 0;
+	int32_t tilesX = 0, tilesY = 0;
+	if (!wardBounds.empty())
+	{
+		double maxX = std::numeric_limits<double>::lowest(), maxY = std::numeric_limits<double>::lowest();
+		originX = originY = std::numeric_limits<double>::max();
+		for (const auto& bounds : wardBounds)
+		{
+			originX = std::min(originX, bounds[0]);
+			originY = std::min(originY, bounds[1]);
+			maxX = std::max(maxX, bounds[2]);
+			maxY = std::max(maxY, bounds[3]);
+		}
+		originX = std::floor(originX / TILE_SIZE) * TILE_SIZE;
+		originY = std::floor(originY / TILE_SIZE) * TILE_SIZE;
+		const auto maxTile = tileOf(maxX, maxY, originX, originY);
+		tilesX = maxTile.first + 1;
+		tilesY = maxTile.second + 1;
+	}
+
+	// Index the wards overlapping each tile, as compressed rows of ward indices
+	std::vector<std::vector<uint32_t>> tileWards(static_cast<size_t>(tilesX) * tilesY);
+	for (size_t i = 0; i < wardBounds.size(); ++i)
+	{
+		const auto minTile = tileOf(wardBounds[i][0], wardBounds[i][1], originX, originY);
+		const auto maxTile = tileOf(wardBounds[i][2], wardBounds[i][3], originX, originY);
+		for (int32_t tx = std::max(0, minTile.first); tx <= std::min(tilesX - 1, maxTile.first); ++tx)
+		{
+			for (int32_t ty = std::max(0, minTile.second); ty <= std::min(tilesY - 1, maxTile.second); ++ty)
+			{
+				tileWards[static_cast<size_t>(tx) * tilesY + ty].push_back(static_cast<uint32_t>(i));
+			}
+		}
+	}
+
+	const uint64_t wardOffsetsOffset = headerBytes + records.size();
+	const uint64_t tileStartsOffset = wardOffsetsOffset + wardOffsets.size() * sizeof(uint64_t);
+	const uint64_t tileWardsOffset = tileStartsOffset + (tileWards.size() + 1) * sizeof(uint64_t);
+
+	std::string buffer;
+	buffer.append(cacheMagic, sizeof(cacheMagic));
+	append(buffer, cacheVersion);
+	append(buffer, cacheByteOrderMark);
+	append(buffer, TILE_SIZE);
+	append(buffer, originX);
+	append(buffer, originY);
+	append(buffer, tilesX);
+	append(buffer, tilesY);
+	append<uint64_t>(buffer, wardOffsets.size());
+	append(buffer, wardOffsetsOffset);
+	append(buffer, tileStartsOffset);
+	append(buffer, tileWardsOffset);
+	buffer += records;
+	for (const auto offset : wardOffsets)
+	{
+		append(buffer, offset);
+	}
+	uint64_t tileStart = 0;
+	for (const auto& wards : tileWards)
+	{
+		append(buffer, tileStart);
+		tileStart += wards.size();
+	}
+	append(buffer, tileStart);
+	for (const auto& wards : tileWards)
+	{
+		buffer.append(reinterpret_cast<const char*>(wards.data()), wards.size() * sizeof(uint32_t));
+	}
+
+	// Write to a temporary file then rename it, so a partially written cache is never read
+	std::random_device rd;
+	const fs::path tmpPath = path + ".tmp" + std::to_string(rd());
+	{
+		std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+		out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+		if (!out.flush())
+		{
+			std::error_code ec;
+			fs::remove(tmpPath, ec);
+			throw std::ios_base::failure("Cannot write census cache file at: " + tmpPath.string());
+		}
+	}
+	std::error_code ec;
+	fs::rename(tmpPath, path, ec);
+	if (ec)
+	{
+		fs::remove(tmpPath, ec);
+		throw std::ios_base::failure("Cannot write census cache file at: " + path);
+	}
+}
+
+bool CensusCache::isFresh(const std::string& path, const std::vector<std::string>& sources)
+{
+	std::error_code ec;
+	const auto cacheTime = fs::last_write_time(path, ec);
+	if (ec) return false;
+	for (const auto& source : sources)
+	{
+		const auto sourceTime = fs::last_write_time(source, ec);
+		if (ec || sourceTime > cacheTime) return false;
+	}
+	return true;
+}
+
+CensusCache::CensusCache(const std::string& path) : path(path),
+                                                    file(std::make_unique<const ugr::util::MappedFile>(path))
+{
+	if (file->size() < headerBytes || std::memcmp(file->data(), cacheMagic, sizeof(cacheMagic)) != 0)
+	{
+		throw std::ios_base::failure("Not a census cache file at: " + path);
+	}
+	const char* ptr = file->data() + sizeof(cacheMagic);
+	const auto read = [&ptr](auto& value)
+	{
+		std::memcpy(&value, ptr, sizeof(value));
+		ptr += sizeof(value);
+	};
+	uint32_t version, byteOrderMark;
+	double tileSize;
+	read(version);
+	read(byteOrderMark);
+	if (version != cacheVersion || byteOrderMark != cacheByteOrderMark)
+	{
+		throw std::ios_base::failure("Unsupported census cache file version or byte order at: " + path);
+	}
+	read(tileSize);
+	read(originX);
+	read(originY);
+	read(tilesX);
+	read(tilesY);
+	read(wardCount);
+	read(wardOffsetsOffset);
+	read(tileStartsOffset);
+	read(tileWardsOffset);
+
+	const uint64_t nTiles = static_cast<uint64_t>(std::max(0, tilesX)) * std::max(0, tilesY);
+	if (tileSize != TILE_SIZE || tilesX < 0 || tilesY < 0
+		|| wardOffsetsOffset + wardCount * sizeof(uint64_t) != tileStartsOffset
+		|| tileStartsOffset + (nTiles + 1) * sizeof(uint64_t) != tileWardsOffset
+		|| tileWardsOffset > file->size())
+	{
+		throw std::ios_base::failure("Invalid census cache file at: " + path);
+	}
+	uint64_t totalTileWards;
+	std::memcpy(&totalTileWards, file->data() + tileWardsOffset - sizeof(uint64_t), sizeof(uint64_t));
+	if (tileWardsOffset + totalTileWards * sizeof(uint32_t) != file->size())
+	{
+		throw std::ios_base::failure("Truncated census cache file at: " + path);
+	}
+}
+
+std::vector<uint32_t> CensusCache::find(const std::array<double, 4>& bounds) const
+{
+	// Bounds as min x, min y, max x, max y
+	const std::array<double, 4> box{bounds[1], bounds[0], bounds[3], bounds[2]};
+	const auto minTile = tileOf(box[0], box[1], originX, originY);
+	const auto maxTile = tileOf(box[2], box[3], originX, originY);
+
+	// Gather the wards in the tiles overlapping the bounds, which may be in several tiles
+	std::vector<uint32_t> wards;
+	const char* data = file->data();
+	for (int32_t tx = std::max(0, minTile.first); tx <= std::min(tilesX - 1, maxTile.first); ++tx)
+	{
+		for (int32_t ty = std::max(0, minTile.second); ty <= std::min(tilesY - 1, maxTile.second); ++ty)
+		{
+			uint64_t tileStart[2];
+			std::memcpy(tileStart, data + tileStartsOffset + (static_cast<uint64_t>(tx) * tilesY + ty) * sizeof(uint64_t),
+			            sizeof(tileStart));
+			const auto first = wards.size();
+			wards.resize(first + (tileStart[1] - tileStart[0]));
+			std::memcpy(wards.data() + first, data + tileWardsOffset + tileStart[0] * sizeof(uint32_t),
+			            (tileStart[1] - tileStart[0]) * sizeof(uint32_t));
+		}
+	}
+	std::sort(wards.begin(), wards.end());
+	wards.erase(std::unique(wards.begin(), wards.end()), wards.end());
+
+	// Tiles only roughly overlap the bounds, so check the bounding box of each ward
+	wards.erase(std::remove_if(wards.begin(), wards.end(), [this, data, &box](const uint32_t ward)
+	{
+		const auto offset = wardOffset(ward);
+		if (offset + sizeof(double) + 4 * sizeof(double) > wardOffsetsOffset)
+		{
+			throw std::ios_base::failure("Truncated census cache record at: " + path);
+		}
+		double wardBounds[4];
+		std::memcpy(wardBounds, data + offset + sizeof(double), sizeof(wardBounds));
+		return wardBounds[0] > box[2] || wardBounds[2] < box[0] || wardBounds[1] > box[3] || wardBounds[3] < box[1];
+	}), wards.end());
+	return wards;
+}
+
+GEOSGeometry* CensusCache::decode(const uint32_t ward, double& density, GEOSContextHandle_t geosCtx) const
+{
+	return decodeWard(wardOffset(ward), density, geosCtx);
+}
+
+std::vector<std::pair<GEOSGeometry*, double>> CensusCache::loadWards(const std::array<float, 4>& bounds,
+                                                                     GEOSContextHandle_t geosCtx) const
+{
+	std::vector<std::pair<GEOSGeometry*, double>> out;
+	for (const auto ward : find({bounds[0], bounds[1], bounds[2], bounds[3]}))
+	{
+		double density;
+		if (auto* geom = decode(ward, density, geosCtx))
+		{
+			out.emplace_back(geom, density);
+		}
+	}
+	return out;
+}
+
+uint64_t CensusCache::wardOffset(const uint32_t ward) const
+{
+	if (ward >= wardCount)
+	{
+		throw std::ios_base::failure("Invalid census cache file at: " + path);
+	}
+	uint64_t offset;
+	std::memcpy(&offset, file->data() + wardOffsetsOffset + ward * sizeof(uint64_t), sizeof(offset));
+	return offset;
+}
+
+GEOSGeometry* CensusCache::decodeWard(uint64_t offset, double& density, GEOSContextHandle_t geosCtx) const
+{
+	const char* data = file->data();
+	const auto read = [this, data, &offset](const uint64_t bytes)
+	{
+		if (offset + bytes > wardOffsetsOffset)
+		{
+			throw std::ios_base::failure("Truncated census cache record at: " + path);
+		}
+		const char* ptr = data + offset;
+		offset += bytes;
+		return ptr;
+	};
+	const auto readValue = [&read](auto& value)
+	{
+		std::memcpy(&value, read(sizeof(value)), sizeof(value));
+	};
+
+	// The bounding box was checked when the ward was found
+	readValue(density);
+	read(4 * sizeof(double));
+
+	uint64_t nParts;
+	readValue(nParts);
+	std::vector<GEOSGeometry*> polygons;
+	for (uint64_t part = 0; part < nParts; ++part)
+	{
+		uint64_t nRings;
+		readValue(nRings);
+		std::vector<GEOSGeometry*> rings;
+		for (uint64_t ring = 0; ring < nRings; ++ring)
+		{
+			uint64_t nCoords;
+			readValue(nCoords);
+			// The coordinates are 8 byte aligned in the mapped file, so are copied straight into GEOS
+			const auto* coords = reinterpret_cast<const double*>(read(nCoords * 2 * sizeof(double)));
+			auto* coordSeq = GEOSCoordSeq_copyFromBuffer_r(geosCtx, coords, static_cast<unsigned>(nCoords), 0, 0);
+			rings.push_back(GEOSGeom_createLinearRing_r(geosCtx, coordSeq));
+		}
+		if (rings.empty()) continue;
+		polygons.push_back(GEOSGeom_createPolygon_r(geosCtx, rings[0], rings.data() + 1,
+		                                            static_cast<unsigned>(rings.size() - 1)));
+	}
+
+	if (polygons.empty()) return nullptr;
+	if (polygons.size() == 1) return polygons[0];
+	return GEOSGeom_createCollection_r(geosCtx, GEOS_MULTIPOLYGON, polygons.data(),
+	                                   static_cast<unsigned>(polygons.size()));
+}
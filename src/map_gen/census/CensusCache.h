@@ -0,0 +1,113 @@
+#ifndef UGR_CENSUS_CENSUSCACHE_H
+#define UGR_CENSUS_CENSUSCACHE_H
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <geos_c.h>
+#include "../../utils/MappedFile.h"
+
+/**
+ * A tiled and indexed binary copy of the census ward geometries and their densities.
+ *
+ * Parsing the national ward shapefile and building GEOS polygons for every ward is slow, while a map
+ * only needs the wards within its bounds. The cache stores the polygons of every ward with its density
+ * and bounding box, along with an index of the wards overlapping each tile of a regular lon/lat grid.
+ * Opening a cache maps the file without reading it, and loading only decodes the wards in the tiles
+ * overlapping the bounds.
+ *
+ * Geometries are stored in the CRS of the shapefile, EPSG:4326 with x as longitude, so they need no
+ * reprojection when loaded.
+ */
+class CensusCache
+{
+public:
+	// The size of the tiles of the index in degrees
+	static constexpr double TILE_SIZE = 0.1;
+
+	/**
+	 * Write a cache of geometries and their densities. The file is replaced atomically.
+	 * @param path the path of the cache file
+	 * @param geomDensityMap polygon or multipolygon geometries and their densities
+	 * @param geosCtx the GEOS context of the geometries
+	 * @throws std::ios_base::failure if the file cannot be written
+	 */
+	static void write(const std::string& path, const std::map<GEOSGeometry*, double>& geomDensityMap,
+	                  GEOSContextHandle_t geosCtx);
+
+	/**
+	 * Test if a cache file exists and is newer than all of the files it was made from
+	 * @param path the path of the cache file
+	 * @param sources the paths of the files the cache was made from
+	 */
+	static bool isFresh(const std::string& path, const std::vector<std::string>& sources);
+
+	/**
+	 * @param path the path of the cache file
+	 * @throws std::ios_base::failure if the file cannot be mapped or is not a valid cache
+	 */
+	explicit CensusCache(const std::string& path);
+
+	/**
+	 * @return the number of geometries in the cache
+	 */
+	size_t size() const
+	{
+		return wardCount;
+	}
+
+	/**
+	 * Decode the geometries with bounding boxes intersecting the bounds
+	 * @param bounds the bounds as [S, W, N, E]
+	 * @param geosCtx the GEOS context to create geometries with
+	 * @return the geometries, which are owned by the caller, and their densities
+	 */
+	template <typename Scalar>
+	std::map<GEOSGeometry*, Scalar> load(const std::array<float, 4>& bounds, GEOSContextHandle_t geosCtx) const
+	{
+		std::map<GEOSGeometry*, Scalar> out;
+		for (const auto& ward : loadWards(bounds, geosCtx))
+		{
+			out.emplace(ward.first, static_cast<Scalar>(ward.second));
+		}
+		return out;
+	}
+
+	/**
+	 * Find the geometries with bounding boxes intersecting the bounds, without decoding them
+	 * @param bounds the bounds as [S, W, N, E]
+	 * @return the indices of the geometries, in ascending order
+	 */
+	std::vector<uint32_t> find(const std::array<double, 4>& bounds) const;
+
+	/**
+	 * Decode a geometry
+	 * @param ward the index of the geometry, as returned by find
+	 * @param density set to the density of the geometry
+	 * @param geosCtx the GEOS context to create the geometry with
+	 * @return the geometry, which is owned by the caller, or null if it has no polygons
+	 * @throws std::ios_base::failure if the index or record is invalid
+	 */
+	GEOSGeometry* decode(uint32_t ward, double& density, GEOSContextHandle_t geosCtx) const;
+
+private:
+	std::string path;
+	std::unique_ptr<const ugr::util::MappedFile> file;
+	uint64_t wardCount = 0;
+	double originX = 0, originY = 0;
+	int32_t tilesX = 0, tilesY = 0;
+	// Offsets of the ward offset table, tile start table and tile ward lists in the file
+	uint64_t wardOffsetsOffset = 0, tileStartsOffset = 0, tileWardsOffset = 0;
+
+	std::vector<std::pair<GEOSGeometry*, double>> loadWards(const std::array<float, 4>& bounds,
+	                                                        GEOSContextHandle_t geosCtx) const;
+
+	uint64_t wardOffset(uint32_t ward) const;
+
+	GEOSGeometry* decodeWard(uint64_t offset, double& density, GEOSContextHandle_t geosCtx) const;
+};
+
+#endif // UGR_CENSUS_CENSUSCACHE_H
@@ -0,0 +1,148 @@
+#include "CensusIndex.h"
+#include <algorithm>
+#include <mutex>
+#include "Ingest.h"
+#include "../../utils/DefaultGEOSMessageHandlers.h"
+
+namespace
+{
+	// The number of children of each node of the STR tree
+	constexpr size_t treeNodeCapacity = 10;
+
+	void collectWard(void* item, void* userdata)
+	{
+		static_cast<std::vector<const CensusIndex::Ward*>*>(userdata)->push_back(
+			static_cast<const CensusIndex::Ward*>(item));
+	}
+}
+
+std::shared_ptr<const CensusIndex> CensusIndex::shared()
+{
+	static std::mutex mutex;
+	static std::shared_ptr<const CensusIndex> index;
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!index)
+	{
+		GEOSContextHandle_t geosCtx = initGEOS_r(notice, log_and_exit);
+		try
+		{
+			CensusIngest censusIngest(geosCtx);
+			if (censusIngest.updateCache())
+			{
+				index = std::make_shared<const CensusIndex>(
+					geosCtx, std::make_unique<const CensusCache>(CensusIngest::cachePath()));
+			}
+			else
+			{
+				index = std::make_shared<const CensusIndex>(geosCtx, censusIngest.makePopulationDensityMap<double>());
+			}
+		}
+		catch (...)
+		{
+			finishGEOS_r(geosCtx);
+			throw;
+		}
+	}
+	return index;
+}
+
+CensusIndex::CensusIndex(GEOSContextHandle_t geosCtx, const std::map<GEOSGeometry*, double>& wards)
+	: ownerCtx(geosCtx)
+{
+	this->wards.reserve(wards.size());
+	for (const auto& pair : wards)
+	{
+		this->wards.push_back({pair.first, pair.second});
+	}
+	tree = GEOSSTRtree_create_r(ownerCtx, treeNodeCapacity);
+	for (auto& ward : this->wards)
+	{
+		GEOSSTRtree_insert_r(ownerCtx, tree, ward.geometry, &ward);
+	}
+	// Build the tree now, so queries never modify it
+	GEOSSTRtree_build_r(ownerCtx, tree);
+}
+
+CensusIndex::CensusIndex(GEOSContextHandle_t geosCtx, std::unique_ptr<const CensusCache> cache)
+	: ownerCtx(geosCtx), cache(std::move(cache)), cachedWards(this->cache->size(), Ward{nullptr, 0}),
+	  isDecoded(this->cache->size(), false)
+{
+}
+
+CensusIndex::~CensusIndex()
+{
+	if (tree != nullptr) GEOSSTRtree_destroy_r(ownerCtx, tree);
+	for (const auto* indexedWards : {&wards, &cachedWards})
+	{
+		for (const auto& ward : *indexedWards)
+		{
+			if (ward.geometry != nullptr) GEOSGeom_destroy_r(ownerCtx, const_cast<GEOSGeometry*>(ward.geometry));
+		}
+	}
+	finishGEOS_r(ownerCtx);
+}
+
+std::vector<CensusIndex::Ward> CensusIndex::queryBounds(const std::array<float, 4>& bounds,
+                                                        GEOSContextHandle_t geosCtx) const
+{
+	auto* boundingPoly = GEOSGeom_createRectangle_r(geosCtx, bounds[1], bounds[0], bounds[3], bounds[2]);
+	auto out = queryCandidates(boundingPoly, geosCtx);
+	GEOSGeom_destroy_r(geosCtx, boundingPoly);
+	return out;
+}
+
+std::vector<CensusIndex::Ward> CensusIndex::queryCandidates(const GEOSGeometry* geom,
+                                                            GEOSContextHandle_t geosCtx) const
+{
+	if (cache)
+	{
+		double minX, minY, maxX, maxY;
+		if (GEOSGeom_getExtent_r(geosCtx, geom, &minX, &minY, &maxX, &maxY) == 0)
+		{
+			return {};
+		}
+		// The cache finds wards in ascending order, so they are already deterministic
+		const auto found = cache->find({minY, minX, maxY, maxX});
+		std::vector<Ward> out;
+		out.reserve(found.size());
+		std::lock_guard<std::mutex> lock(decodeMutex);
+		for (const auto ward : found)
+		{
+			if (!isDecoded[ward])
+			{
+				cachedWards[ward].geometry = cache->decode(ward, cachedWards[ward].density, ownerCtx);
+				isDecoded[ward] = true;
+			}
+			if (cachedWards[ward].geometry != nullptr) out.push_back(cachedWards[ward]);
+		}
+		return out;
+	}
+
+	std::vector<const Ward*> found;
+	GEOSSTRtree_query_r(geosCtx, tree, geom, collectWard, &found);
+	// The tree returns wards in no particular order, so sort them to be deterministic
+	std::sort(found.begin(), found.end());
+	std::vector<Ward> out;
+	out.reserve(found.size());
+	for (const auto* ward : found)
+	{
+		out.push_back(*ward);
+	}
+	return out;
+}
+
+CensusIndex::Ward CensusIndex::locate(const double lon, const double lat, GEOSContextHandle_t geosCtx) const
+{
+	auto* point = GEOSGeom_createPointFromXY_r(geosCtx, lon, lat);
+	Ward out{nullptr, 0};
+	for (const auto& ward : queryCandidates(point, geosCtx))
+	{
+		if (GEOSContains_r(geosCtx, ward.geometry, point))
+		{
+			out = ward;
+			break;
+		}
+	}
+	GEOSGeom_destroy_r(geosCtx, point);
+	return out;
+}
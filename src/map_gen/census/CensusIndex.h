@@ -0,0 +1,136 @@
+#ifndef UGR_CENSUS_CENSUSINDEX_H
+#define UGR_CENSUS_CENSUSINDEX_H
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <geos_c.h>
+#include "CensusCache.h"
+
+/**
+ * A spatial index of census ward geometries and their densities.
+ *
+ * The index of all wards is opened once per process by #shared, and shared by every map, so
+ * finding the wards within bounds, at a point or intersecting a geometry only tests the few wards
+ * with overlapping envelopes rather than every ward in the country.
+ *
+ * Normally the index is built on the CensusCache. Queries look up the wards listed in the cache's
+ * tiles of its CensusCache::TILE_SIZE degree lon/lat grid, filter them by the bounding boxes stored
+ * in the cache, and only decode a ward the first time a query finds it, so the wards far from any
+ * map are never decoded.
+ *
+ * If the cache cannot be used, the index is instead built from a set of decoded wards, which it
+ * keeps in an STR tree.
+ *
+ * The index owns its geometries, which are only ever read. Queries are made with the GEOS context
+ * of the caller, as GEOS contexts cannot be used by several threads at once, so an index can be
+ * queried from any thread.
+ */
+class CensusIndex
+{
+public:
+	struct Ward
+	{
+		const GEOSGeometry* geometry;
+		double density;
+	};
+
+	/**
+	 * Return the index of all census wards. This creates or updates the census cache if needed and
+	 * indexes it by its tile grid, decoding wards as they are queried. If the cache cannot be written,
+	 * it falls back to reading every ward from the census data into an STR tree the first time this
+	 * is called
+	 * @throws std::ios_base::failure if the census data cannot be read
+	 */
+	static std::shared_ptr<const CensusIndex> shared();
+
+	/**
+	 * Index a set of wards, taking ownership of their geometries
+	 * @param geosCtx the context the geometries were created with, which the index takes ownership of
+	 * @param wards polygon or multipolygon geometries and their densities
+	 */
+	CensusIndex(GEOSContextHandle_t geosCtx, const std::map<GEOSGeometry*, double>& wards);
+
+	/**
+	 * Index the wards of a census cache, decoding them as they are queried
+	 * @param geosCtx the context to decode the geometries with, which the index takes ownership of
+	 * @param cache the cache of the wards
+	 */
+	CensusIndex(GEOSContextHandle_t geosCtx, std::unique_ptr<const CensusCache> cache);
+
+	~CensusIndex();
+
+	CensusIndex(const CensusIndex& other) = delete;
+	CensusIndex& operator=(const CensusIndex& other) = delete;
+
+	/**
+	 * @return the number of wards in the index, decoded or not
+	 */
+	size_t size() const
+	{
+		return cache ? cache->size() : wards.size();
+	}
+
+	/**
+	 * @param bounds the bounds as [S, W, N, E]
+	 * @return the wards with envelopes intersecting the bounds
+	 */
+	std::vector<Ward> queryBounds(const std::array<float, 4>& bounds, GEOSContextHandle_t geosCtx) const;
+
+	/**
+	 * @param geom the geometry to find candidates for
+	 * @return the wards with envelopes intersecting the envelope of the geometry, in the order they
+	 * were indexed. These are candidates to intersect the geometry
+	 */
+	std::vector<Ward> queryCandidates(const GEOSGeometry* geom, GEOSContextHandle_t geosCtx) const;
+
+	/**
+	 * Find the ward containing a point
+	 * @param lon the longitude of the point
+	 * @param lat the latitude of the point
+	 * @return the first ward containing the point, or a ward with a null geometry if there is none
+	 */
+	Ward locate(double lon, double lat, GEOSContextHandle_t geosCtx) const;
+
+	/**
+	 * Clip the wards to bounds
+	 * @param bounds the bounds as [S, W, N, E]
+	 * @param geosCtx the context to create the clipped geometries with
+	 * @return the non empty intersections of the wards with the bounds, which are owned by the
+	 * caller, and their densities
+	 */
+	template <typename Scalar>
+	std::map<GEOSGeometry*, Scalar> clipToBounds(const std::array<float, 4>& bounds, GEOSContextHandle_t geosCtx) const
+	{
+		std::map<GEOSGeometry*, Scalar> out;
+		auto* boundingPoly = GEOSGeom_createRectangle_r(geosCtx, bounds[1], bounds[0], bounds[3], bounds[2]);
+		for (const auto& ward : queryCandidates(boundingPoly, geosCtx))
+		{
+			auto* intersection = GEOSIntersection_r(geosCtx, boundingPoly, ward.geometry);
+			if (intersection == nullptr) continue;
+			if (GEOSisEmpty_r(geosCtx, intersection))
+			{
+				GEOSGeom_destroy_r(geosCtx, intersection);
+				continue;
+			}
+			out.emplace(intersection, static_cast<Scalar>(ward.density));
+		}
+		GEOSGeom_destroy_r(geosCtx, boundingPoly);
+		return out;
+	}
+
+private:
+	GEOSContextHandle_t ownerCtx;
+	std::vector<Ward> wards;
+	GEOSSTRtree* tree = nullptr;
+
+	std::unique_ptr<const CensusCache> cache;
+	// The wards of the cache by their index in it, which are decoded with the owner context as they are
+	// first queried, so decoding is serialised
+	mutable std::vector<Ward> cachedWards;
+	mutable std::vector<bool> isDecoded;
+	mutable std::mutex decodeMutex;
+};
+
+#endif // UGR_CENSUS_CENSUSINDEX_H
@@ -3,13 +3,13 @@
 #include <rapidjson/document.h>
 #include <rapidjson/filereadstream.h>
 #include <cstdio>
-#include <shapefil.h>
 #include <geos_c.h>
 #include <proj.h>
 #include <iostream>
 #include <csv.h>
 #include <fstream>
 
+#include "ShapefileReader.h"
 #include "../../utils/DefaultGEOSMessageHandlers.h"
 
 
@@ -35,120 +35,36 @@ const std::vector<std::vector<ugr::mapping::osm::OSMTag>> CensusNHAPSIngest::NHA
 
 std::map<std::string, GEOSGeometry*> CensusGeometryIngest::readFile(const std::string& file)
 {
-	std::map<std::string, GEOSGeometry*> outMap;
+	return readFile(file, nullptr);
+}
 
-	// Remove the extension and assume the .shp, .shx and .dbf files all share a common path and name
-	const auto extIdx = file.find_last_of('.');
-	const auto basePath = file.substr(0, extIdx);
+std::map<std::string, GEOSGeometry*> CensusGeometryIngest::readFile(const std::string& file,
+                                                                    const std::array<float, 4>& bounds)
+{
+	return readFile(file, &bounds);
+}
 
+std::map<std::string, GEOSGeometry*> CensusGeometryIngest::readFile(const std::string& file,
+                                                                    const std::array<float, 4>* bounds)
+{
 	const std::ifstream f(file.c_str());
 	if (!f.good())
 	{
 		throw std::ios_base::failure("Cannot locate census geometry .shp file at: " + file);
 	}
 
-	// Open vertex (shp), index (shx) and attribute (dbf) files and keep the handles
-	const auto shpHandle = SHPOpen(basePath.c_str(), "rb");
-	const auto dbfHandle = DBFOpen(basePath.c_str(), "rb");
-
-	// Get the number of shapes we are extracting
-	int nEntities;
-	SHPGetInfo(shpHandle, &nEntities, nullptr, nullptr, nullptr);
+	const ShapefileReader reader(file);
+	const auto geoms = reader.readPolygons(bounds);
 
-	for (int i = 0; i < nEntities; ++i)
+	std::map<std::string, GEOSGeometry*> outMap;
+	for (size_t i = 0; i < geoms.size(); ++i)
 	{
-		auto* obj = SHPReadObject(shpHandle, i); //alloc
-		if (obj == nullptr)
-		{
-			std::cerr << "SHP file header gave wrong number of entities";
-			break;
-		}
-
-		GEOSGeometry* outerRing;
-		std::vector<GEOSGeometry*> innerRings;
-
-		for (int j = 0; j < obj->nParts; ++j)
-		{
-			const unsigned int nVert = obj->nVertices;
-
-			// Allocate a GEOS coord sequence
-			// ugr is only 2D and so is the grid map, so only 2 dimensions used, even if data has more
-			auto* objGeosCoordSeq = GEOSCoordSeq_create_r(geosCtx, nVert, 2);
-
-			const auto startVertIdx = obj->panPartStart[j];
-			const double startX = obj->padfX[startVertIdx], startY = obj->padfY[startVertIdx];
-
-			GEOSCoordSeq_setOrdinate_r(geosCtx, objGeosCoordSeq, 0, 0, startX);
-			GEOSCoordSeq_setOrdinate_r(geosCtx, objGeosCoordSeq, 0, 1, startY);
-
-			for (unsigned k = startVertIdx + 1; k < nVert; ++k)
-			{
-				GEOSCoordSeq_setOrdinate_r(geosCtx, objGeosCoordSeq, k, 0, obj->padfX[k]);
-				GEOSCoordSeq_setOrdinate_r(geosCtx, objGeosCoordSeq, k, 1, obj->padfY[k]);
-			}
-
-			// Ensure a closed ring is formed
-			double endX, endY;
-			GEOSCoordSeq_getOrdinate_r(geosCtx, objGeosCoordSeq, nVert - 1, 0, &endX);
-			GEOSCoordSeq_getOrdinate_r(geosCtx, objGeosCoordSeq, nVert - 1, 1, &endY);
-			if (startX != endX || startY != endY)
-			{
-				GEOSCoordSeq_setOrdinate_r(geosCtx, objGeosCoordSeq, nVert - 1, 0, startX);
-				GEOSCoordSeq_setOrdinate_r(geosCtx, objGeosCoordSeq, nVert - 1, 1, startY);
-			}
-
-
-			switch (obj->panPartType[j])
-			{
-			case SHPP_FIRSTRING:
-			case SHPP_OUTERRING:
-			case SHPP_RING:
-				outerRing = GEOSGeom_createLinearRing_r(geosCtx, objGeosCoordSeq);
-				break;
-			case SHPP_INNERRING:
-				innerRings.emplace_back(GEOSGeom_createLinearRing_r(geosCtx, objGeosCoordSeq));
-				break;
-			default:
-				break;
-			}
-		}
-
-		GEOSGeometry* geom;
-		switch (obj->nSHPType)
+		if (geoms[i] == nullptr) continue;
+		// The ward code is the first attribute
+		if (!outMap.emplace(reader.readString(i, 0), geoms[i]).second)
 		{
-		case SHPT_POINT:
-		case SHPT_POINTZ:
-		case SHPT_POINTM:
-			{
-				auto* coordSeq = GEOSGeom_getCoordSeq_r(geosCtx, outerRing);
-				double x, y;
-				GEOSCoordSeq_getXY_r(geosCtx, coordSeq, 0, &x, &y);
-				geom = GEOSGeom_createPointFromXY_r(geosCtx, x, y);
-			}
-			break;
-		case SHPT_POLYGON:
-		case SHPT_POLYGONZ:
-		case SHPT_POLYGONM:
-			{
-				geom = GEOSGeom_createPolygon_r(geosCtx, outerRing, innerRings.data(), innerRings.size());
-				auto v = GEOSisValid_r(geosCtx, geom);
-				if (v != 1)
-				{
-					auto vr = GEOSisValidReason_r(geosCtx, geom);
-					auto t = GEOSGeomType_r(geosCtx, geom);
-					SHPDestroyObject(obj);
-					continue;
-				}
-			}
-			break;
-		default:
-			break;
+			GEOSGeom_destroy_r(geosCtx, geoms[i]);
 		}
-		auto* code = DBFReadStringAttribute(dbfHandle, i, 0);
-		if (geom != nullptr)
-			outMap.emplace(code, geom);
-
-		SHPDestroyObject(obj); //dealloc
 	}
 	return outMap;
 }
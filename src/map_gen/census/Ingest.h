@@ -1,6 +1,7 @@
 #ifndef UGR_CENSUS_INGEST_H
 #define UGR_CENSUS_INGEST_H
 #include <algorithm>
+#include <array>
 #include <string>
 #include <cstdlib>
 #include <vector>
@@ -11,6 +12,8 @@
 #include "../../utils/GeometryOperations.h"
 
 #include "uasgroundrisk/map_gen/osm/OSMTag.h"
+#include "CensusCache.h"
+#include <spdlog/spdlog.h>
 
 #ifndef UGR_DATA_DIR
 #define UGR_DATA_DIR "../data/"
@@ -38,6 +41,18 @@ public:
 	}
 
 	std::map<std::string, GEOSGeometry*> readFile(const std::string& file) override;
+
+	/**
+	 * Read the wards of a shapefile near bounds. Wards are filtered by the bounding boxes in the
+	 * shapefile record headers, so wards outside the bounds are never decoded.
+	 * @param file the path of the .shp file
+	 * @param bounds the bounds as [S, W, N, E]
+	 * @return the ward geometries with bounding boxes intersecting the bounds, by ward code
+	 */
+	std::map<std::string, GEOSGeometry*> readFile(const std::string& file, const std::array<float, 4>& bounds);
+
+private:
+	std::map<std::string, GEOSGeometry*> readFile(const std::string& file, const std::array<float, 4>* bounds);
 };
 
 class CensusDensityIngest final : public DataIngester<std::string, double>
@@ -70,24 +85,101 @@ public:
 	{
 	}
 
-	template <typename Scalar>
-	std::map<GEOSGeometry*, Scalar> makePopulationDensityMap()
+	/**
+	 * @return the directory of the census data, from the UGR_DATA_DIR environment variable if it is set
+	 */
+	static std::string dataDirectory()
 	{
-		CensusGeometryIngest geomIngest(geosCtx);
-
 		// Check if the env var is set and preferentially use it
 		const auto* envDataDir = std::getenv("UGR_DATA_DIR");
-		std::string dataDir;
 		if (envDataDir == nullptr)
 		{
-			dataDir = UGR_DATA_DIR;
+			return UGR_DATA_DIR;
 		}
-		else
+		return std::string(envDataDir);
+	}
+
+	/**
+	 * @return the path of the CensusCache of the census data
+	 */
+	static std::string cachePath()
+	{
+		return dataDirectory() + "/merged.ugrcensus";
+	}
+
+	/**
+	 * Build the CensusCache from the full census data if it does not exist or the census data has
+	 * changed since it was built
+	 * @return whether the cache is up to date, which it is not if it cannot be written
+	 */
+	bool updateCache()
+	{
+		const auto dataDir = dataDirectory();
+		if (CensusCache::isFresh(cachePath(), {dataDir + "/merged.shp", dataDir + "/density.csv"}))
 		{
-			dataDir = std::string(envDataDir);
+			return true;
 		}
+		spdlog::info("Building census cache at {}", cachePath());
+		auto geomDensityMap = makePopulationDensityMap<double>();
+		bool written = true;
+		try
+		{
+			CensusCache::write(cachePath(), geomDensityMap, geosCtx);
+		}
+		catch (const std::ios_base::failure& e)
+		{
+			spdlog::warn("Cannot build census cache: {}", e.what());
+			written = false;
+		}
+		for (const auto& pair : geomDensityMap)
+		{
+			GEOSGeom_destroy_r(geosCtx, pair.first);
+		}
+		return written;
+	}
 
-		auto geoms = geomIngest.readFile(dataDir + "/merged.shp");
+	/**
+	 * Read the census wards intersecting the bounds with their population densities.
+	 *
+	 * Wards are read from a CensusCache next to the census data, which is built from the full
+	 * census data the first time it is needed or when the census data changes. If the cache
+	 * cannot be written, the wards near the bounds are read from the census data instead.
+	 * @param bounds the bounds as [S, W, N, E]
+	 * @return the ward geometries, which are owned by the caller, and their densities
+	 */
+	template <typename Scalar>
+	std::map<GEOSGeometry*, Scalar> makePopulationDensityMap(const std::array<float, 4>& bounds)
+	{
+		if (updateCache())
+		{
+			return CensusCache(cachePath()).load<Scalar>(bounds, geosCtx);
+		}
+		return readPopulationDensityMap<Scalar>(&bounds);
+	}
+
+	template <typename Scalar>
+	std::map<GEOSGeometry*, Scalar> makePopulationDensityMap()
+	{
+		return readPopulationDensityMap<Scalar>(nullptr);
+	}
+
+	std::vector<std::vector<float>> makeNHAPSProportions();
+protected:
+	GEOSContextHandle_t& geosCtx;
+
+	/**
+	 * Read the census wards and their population densities from the census data
+	 * @param bounds if not null, only wards near these bounds, as [S, W, N, E], are read
+	 */
+	template <typename Scalar>
+	std::map<GEOSGeometry*, Scalar> readPopulationDensityMap(const std::array<float, 4>* bounds)
+	{
+		CensusGeometryIngest geomIngest(geosCtx);
+		const auto dataDir = dataDirectory();
+
+		auto geoms = bounds == nullptr
+			             ? geomIngest.readFile(dataDir + "/merged.shp")
+			             : geomIngest.readFile(dataDir + "/merged.shp", *bounds);
 
 //		const auto projObjs = ugr::util::makeProjObject("EPSG:27700", "EPSG:4326");
 //		PJ* reproj = std::get<0>(projObjs);
@@ -119,10 +211,6 @@ public:
 
 		return mergedMap;
 	}
-
-	std::vector<std::vector<float>> makeNHAPSProportions();
-protected:
-	GEOSContextHandle_t& geosCtx;
 };
 
 #endif // UGR_CENSUS_INGEST_H
@@ -0,0 +1,307 @@
+#include "ShapefileReader.h"
+#include <algorithm>
+#include <cstring>
+#include <ios>
+#include <stdexcept>
+#include "../../utils/DefaultGEOSMessageHandlers.h"
+
+namespace
+{
+	constexpr size_t fileHeaderBytes = 100;
+	constexpr size_t recordHeaderBytes = 8;
+	constexpr int32_t shpFileCode = 9994;
+
+	// Shape types with polygon records, which share the layout of their x and y values
+	constexpr int32_t shapePolygon = 5;
+	constexpr int32_t shapePolygonZ = 15;
+	constexpr int32_t shapePolygonM = 25;
+
+	int32_t readBigEndian32(const char* data)
+	{
+		const auto* bytes = reinterpret_cast<const unsigned char*>(data);
+		return static_cast<int32_t>(static_cast<uint32_t>(bytes[0]) << 24 | static_cast<uint32_t>(bytes[1]) << 16
+			| static_cast<uint32_t>(bytes[2]) << 8 | static_cast<uint32_t>(bytes[3]));
+	}
+
+	template <typename T>
+	T readLittleEndian(const char* data)
+	{
+		// Shapefiles are little endian in their values, as are all supported platforms
+		T value;
+		std::memcpy(&value, data, sizeof(T));
+		return value;
+	}
+
+	/**
+	 * Twice the signed area of a ring of interleaved x and y values, which is negative for clockwise rings
+	 */
+	double signedArea(const double* coords, const size_t nPoints)
+	{
+		double area = 0;
+		for (size_t i = 0, j = nPoints - 1; i < nPoints; j = i++)
+		{
+			area += coords[2 * j] * coords[2 * i + 1] - coords[2 * i] * coords[2 * j + 1];
+		}
+		return area;
+	}
+
+	bool ringContains(const double* coords, const size_t nPoints, const double x, const double y)
+	{
+		bool inside = false;
+		for (size_t i = 0, j = nPoints - 1; i < nPoints; j = i++)
+		{
+			const double xi = coords[2 * i], yi = coords[2 * i + 1];
+			const double xj = coords[2 * j], yj = coords[2 * j + 1];
+			if ((yi > y) != (yj > y) && x < (xj - xi) * (y - yi) / (yj - yi) + xi)
+			{
+				inside = !inside;
+			}
+		}
+		return inside;
+	}
+}
+
+ShapefileReader::ShapefileReader(const std::string& path) : path(path)
+{
+	// Assume the .shp, .shx and .dbf files all share a common path and name
+	const auto basePath = path.substr(0, path.find_last_of('.'));
+	shp = std::make_unique<const ugr::util::MappedFile>(path);
+	shx = std::make_unique<const ugr::util::MappedFile>(basePath + ".shx");
+	dbf = std::make_unique<const ugr::util::MappedFile>(basePath + ".dbf");
+
+	if (shp->size() < fileHeaderBytes || readBigEndian32(shp->data()) != shpFileCode
+		|| shx->size() < fileHeaderBytes || readBigEndian32(shx->data()) != shpFileCode)
+	{
+		throw std::ios_base::failure("Not a shapefile at: " + path);
+	}
+	recordCount = (shx->size() - fileHeaderBytes) / recordHeaderBytes;
+
+	// The dbf header is followed by 32 byte field descriptors, terminated by 0x0D
+	if (dbf->size() < 32)
+	{
+		throw std::ios_base::failure("Invalid shapefile attributes at: " + basePath + ".dbf");
+	}
+	dbfHeaderLength = readLittleEndian<uint16_t>(dbf->data() + 8);
+	dbfRecordLength = readLittleEndian<uint16_t>(dbf->data() + 10);
+	// Each record starts with a deletion flag
+	size_t fieldOffset = 1;
+	for (size_t descriptor = 32; descriptor + 32 <= dbfHeaderLength && dbf->data()[descriptor] != 0x0D;
+	     descriptor += 32)
+	{
+		const auto length = static_cast<unsigned char>(dbf->data()[descriptor + 16]);
+		fields.push_back({fieldOffset, length});
+		fieldOffset += length;
+	}
+	if (readLittleEndian<uint32_t>(dbf->data() + 4) < recordCount
+		|| dbfHeaderLength + recordCount * dbfRecordLength > dbf->size() || fieldOffset > dbfRecordLength)
+	{
+		throw std::ios_base::failure("Invalid shapefile attributes at: " + basePath + ".dbf");
+	}
+}
+
+std::vector<GEOSGeometry*> ShapefileReader::readPolygons(const std::array<float, 4>* bounds) const
+{
+	// Bounds as min x, min y, max x, max y
+	std::array<double, 4> box{};
+	if (bounds != nullptr)
+	{
+		box = {(*bounds)[1], (*bounds)[0], (*bounds)[3], (*bounds)[2]};
+	}
+
+	std::vector<GEOSGeometry*> geoms(recordCount, nullptr);
+	const long nRecords = static_cast<long>(recordCount);
+	bool truncated = false;
+#pragma omp parallel
+	{
+		// GEOS contexts cannot be shared between threads, though the geometries they create can be
+		GEOSContextHandle_t geosCtx = initGEOS_r(notice, log_and_exit);
+		std::vector<double> coords;
+#pragma omp for schedule(dynamic, 64)
+		for (long i = 0; i < nRecords; ++i)
+		{
+			try
+			{
+				geoms[i] = readPolygon(i, bounds != nullptr ? &box : nullptr, coords, geosCtx);
+			}
+			catch (const std::ios_base::failure&)
+			{
+#pragma omp atomic write
+				truncated = true;
+			}
+		}
+		finishGEOS_r(geosCtx);
+	}
+	if (truncated)
+	{
+		GEOSContextHandle_t geosCtx = initGEOS_r(notice, log_and_exit);
+		for (auto* geom : geoms)
+		{
+			if (geom != nullptr) GEOSGeom_destroy_r(geosCtx, geom);
+		}
+		finishGEOS_r(geosCtx);
+		throw std::ios_base::failure("Truncated shapefile record at: " + path);
+	}
+	return geoms;
+}
+
+GEOSGeometry* ShapefileReader::readPolygon(const size_t record, const std::array<double, 4>* box,
+                                           std::vector<double>& coords, GEOSContextHandle_t geosCtx) const
+{
+	// Offsets and lengths in the index are in 16 bit words
+	const char* index = shx->data() + fileHeaderBytes + record * recordHeaderBytes;
+	const size_t offset = static_cast<size_t>(readBigEndian32(index)) * 2 + recordHeaderBytes;
+	const size_t length = static_cast<size_t>(readBigEndian32(index + 4)) * 2;
+	if (offset + length > shp->size() || length < 4)
+	{
+		throw std::ios_base::failure("Truncated shapefile record at: " + path);
+	}
+	const char* content = shp->data() + offset;
+	const auto shapeType = readLittleEndian<int32_t>(content);
+	if (shapeType != shapePolygon && shapeType != shapePolygonZ && shapeType != shapePolygonM)
+	{
+		return nullptr;
+	}
+
+	// Skip records outside the bounds using the bounding box in their header
+	constexpr size_t polygonHeaderBytes = 44;
+	if (length < polygonHeaderBytes)
+	{
+		throw std::ios_base::failure("Truncated shapefile record at: " + path);
+	}
+	if (box != nullptr)
+	{
+		const auto minX = readLittleEndian<double>(content + 4), minY = readLittleEndian<double>(content + 12);
+		const auto maxX = readLittleEndian<double>(content + 20), maxY = readLittleEndian<double>(content + 28);
+		if (minX > (*box)[2] || maxX < (*box)[0] || minY > (*box)[3] || maxY < (*box)[1])
+		{
+			return nullptr;
+		}
+	}
+
+	const auto nParts = readLittleEndian<int32_t>(content + 36);
+	const auto nPoints = readLittleEndian<int32_t>(content + 40);
+	if (nParts <= 0 || nPoints <= 0
+		|| polygonHeaderBytes + 4 * static_cast<size_t>(nParts) + 16 * static_cast<size_t>(nPoints) > length)
+	{
+		return nullptr;
+	}
+	const char* parts = content + polygonHeaderBytes;
+	const char* points = parts + 4 * nParts;
+
+	// Copy the vertices once into an aligned buffer, as records are not 8 byte aligned in the file
+	coords.resize(2 * static_cast<size_t>(nPoints));
+	std::memcpy(coords.data(), points, coords.size() * sizeof(double));
+
+	// Classify each ring by its orientation
+	struct Ring
+	{
+		size_t start;
+		size_t nPoints;
+		std::vector<size_t> holes;
+	};
+	std::vector<Ring> outerRings, holes;
+	for (int32_t part = 0; part < nParts; ++part)
+	{
+		const auto start = readLittleEndian<int32_t>(parts + 4 * part);
+		const auto end = part + 1 < nParts ? readLittleEndian<int32_t>(parts + 4 * (part + 1)) : nPoints;
+		// A valid ring has at least three distinct points and is closed
+		if (start < 0 || end > nPoints || end - start < 4) continue;
+		Ring ring{static_cast<size_t>(start), static_cast<size_t>(end - start), {}};
+		if (signedArea(&coords[2 * ring.start], ring.nPoints) < 0)
+		{
+			outerRings.push_back(ring);
+		}
+		else
+		{
+			holes.push_back(ring);
+		}
+	}
+	// Rings with the wrong orientation are outer rings if there are no others
+	if (outerRings.empty())
+	{
+		outerRings.swap(holes);
+	}
+	for (size_t hole = 0; hole < holes.size(); ++hole)
+	{
+		const double x = coords[2 * holes[hole].start], y = coords[2 * holes[hole].start + 1];
+		auto outer = std::find_if(outerRings.begin(), outerRings.end(), [&coords, x, y](const Ring& ring)
+		{
+			return ringContains(&coords[2 * ring.start], ring.nPoints, x, y);
+		});
+		// A hole outside every outer ring is assumed to belong to the last one
+		if (outer == outerRings.end()) --outer;
+		outer->holes.push_back(hole);
+	}
+
+	const auto makeRing = [&coords, geosCtx](const Ring& ring)
+	{
+		auto* coordSeq = GEOSCoordSeq_copyFromBuffer_r(geosCtx, &coords[2 * ring.start],
+		                                               static_cast<unsigned>(ring.nPoints), 0, 0);
+		// Close rings that are left open
+		const double* first = &coords[2 * ring.start];
+		const double* last = &coords[2 * (ring.start + ring.nPoints - 1)];
+		if (first[0] != last[0] || first[1] != last[1])
+		{
+			GEOSCoordSeq_destroy_r(geosCtx, coordSeq);
+			std::vector<double> closed(first, last + 2);
+			closed.push_back(first[0]);
+			closed.push_back(first[1]);
+			coordSeq = GEOSCoordSeq_copyFromBuffer_r(geosCtx, closed.data(),
+			                                         static_cast<unsigned>(ring.nPoints + 1), 0, 0);
+		}
+		return GEOSGeom_createLinearRing_r(geosCtx, coordSeq);
+	};
+
+	std::vector<GEOSGeometry*> polygons;
+	for (const auto& outer : outerRings)
+	{
+		auto* shell = makeRing(outer);
+		std::vector<GEOSGeometry*> innerRings;
+		for (const auto hole : outer.holes)
+		{
+			if (auto* innerRing = makeRing(holes[hole]))
+			{
+				innerRings.push_back(innerRing);
+			}
+		}
+		if (shell == nullptr)
+		{
+			for (auto* innerRing : innerRings)
+			{
+				GEOSGeom_destroy_r(geosCtx, innerRing);
+			}
+			continue;
+		}
+		if (auto* polygon = GEOSGeom_createPolygon_r(geosCtx, shell, innerRings.data(),
+		                                             static_cast<unsigned>(innerRings.size())))
+		{
+			polygons.push_back(polygon);
+		}
+	}
+	if (polygons.empty()) return nullptr;
+
+	GEOSGeometry* geom = polygons.size() == 1
+		                     ? polygons[0]
+		                     : GEOSGeom_createCollection_r(geosCtx, GEOS_MULTIPOLYGON, polygons.data(),
+		                                                   static_cast<unsigned>(polygons.size()));
+	if (geom != nullptr && GEOSisValid_r(geosCtx, geom) != 1)
+	{
+		GEOSGeom_destroy_r(geosCtx, geom);
+		return nullptr;
+	}
+	return geom;
+}
+
+std::string ShapefileReader::readString(const size_t record, const size_t field) const
+{
+	if (record >= recordCount || field >= fields.size())
+	{
+		throw std::out_of_range("No shapefile attribute " + std::to_string(field) + " of record "
+			+ std::to_string(record) + " at: " + path);
+	}
+	const char* value = dbf->data() + dbfHeaderLength + record * dbfRecordLength + fields[field].offset;
+	size_t start = 0, end = fields[field].length;
+	while (start < end && (value[start] == ' ' || value[start] == '\0')) ++start;
+	while (end > start && (value[end - 1] == ' ' || value[end - 1] == '\0')) --end;
+	return {value + start, end - start};
+}
@@ -0,0 +1,76 @@
+#ifndef UGR_CENSUS_SHAPEFILEREADER_H
+#define UGR_CENSUS_SHAPEFILEREADER_H
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <geos_c.h>
+#include "../../utils/MappedFile.h"
+
+/**
+ * Reads the polygons and attributes of an ESRI shapefile from its memory mapped .shp, .shx and .dbf
+ * files.
+ *
+ * The .shx index gives the offset of every record, so records are decoded in parallel, and records
+ * outside the requested bounds are skipped from their header bounding box without decoding their
+ * vertices. Vertices are passed to GEOS in bulk from contiguous buffers.
+ *
+ * Rings are classified by their orientation as in the shapefile specification, where outer rings are
+ * clockwise and holes anticlockwise. Holes belong to the outer ring containing them, and a record
+ * with several outer rings is a multipolygon.
+ */
+class ShapefileReader
+{
+public:
+	/**
+	 * @param path the path of the .shp file, the .shx and .dbf files must share its path and name
+	 * @throws std::ios_base::failure if any of the files cannot be mapped or are not valid
+	 */
+	explicit ShapefileReader(const std::string& path);
+
+	/**
+	 * @return the number of records
+	 */
+	size_t size() const
+	{
+		return recordCount;
+	}
+
+	/**
+	 * Decode the polygons of every record, in parallel
+	 * @param bounds if not null, only records with bounding boxes intersecting these bounds, as
+	 * [S, W, N, E], are decoded
+	 * @return the geometry of each record, which is null for records outside the bounds, records
+	 * that are not polygons and invalid polygons. Geometries are owned by the caller and can be used
+	 * with any GEOS context
+	 */
+	std::vector<GEOSGeometry*> readPolygons(const std::array<float, 4>* bounds = nullptr) const;
+
+	/**
+	 * Read an attribute of a record as a string, without surrounding spaces
+	 * @param record the index of the record
+	 * @param field the index of the attribute field
+	 * @throws std::out_of_range if the record or field does not exist
+	 */
+	std::string readString(size_t record, size_t field) const;
+
+private:
+	struct Field
+	{
+		size_t offset;
+		size_t length;
+	};
+
+	std::string path;
+	std::unique_ptr<const ugr::util::MappedFile> shp, shx, dbf;
+	size_t recordCount = 0;
+	size_t dbfHeaderLength = 0;
+	size_t dbfRecordLength = 0;
+	std::vector<Field> fields;
+
+	GEOSGeometry* readPolygon(size_t record, const std::array<double, 4>* box, std::vector<double>& coords,
+	                          GEOSContextHandle_t geosCtx) const;
+};
+
+#endif // UGR_CENSUS_SHAPEFILEREADER_H
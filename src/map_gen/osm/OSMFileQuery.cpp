@@ -0,0 +1,54 @@
+/*
+ * OSMFileQuery.cpp
+ */
+
+#include "uasgroundrisk/map_gen/osm/OSMFileQuery.h"
+
+#include <filesystem>
+#include <ios>
+
+// The input formats register themselves with osmium when included, this makes sure they are always linked
+#include <osmium/io/pbf_input.hpp>
+#include <osmium/io/xml_input.hpp>
+
+#ifdef UGR_IO_COMPRESSION_BZ2
+#include <osmium/io/any_compression.hpp>
+#endif
+
+using namespace ugr::mapping::osm;
+
+osmium::TagsFilter ugr::mapping::osm::makeTagsFilter(const std::vector<OSMTag>& tags)
+{
+    osmium::TagsFilter tagsFilter;
+    for (const auto& tag : tags)
+    {
+        if (tag.value.empty())
+        {
+            tagsFilter.add_rule(true, osmium::TagMatcher(tag.key));
+        }
+        else
+        {
+            tagsFilter.add_rule(true, osmium::TagMatcher(tag.key, tag.value));
+        }
+    }
+    return tagsFilter;
+}
+
+OSMFileQuery::OSMFileQuery(std::string path, const osmium::geom::Coordinates& southWestCoord,
+                           const osmium::geom::Coordinates& northEastCoord,
+                           const std::vector<OSMTag>& tags)
+    : path(std::move(path)), tagsFilter(makeTagsFilter(tags))
+{
+    if (!std::filesystem::exists(this->path))
+    {
+        throw std::ios_base::failure("Cannot find OSM file at: " + this->path);
+    }
+
+    bounds.extend(osmium::Location(southWestCoord.x, southWestCoord.y));
+    bounds.extend(osmium::Location(northEastCoord.x, northEastCoord.y));
+}
+
+osmium::io::File OSMFileQuery::openFile() const
+{
+    return osmium::io::File{path};
+}
@@ -0,0 +1,310 @@
+/*
+ * OSMOverpassCache.cpp
+ */
+
+#include "uasgroundrisk/map_gen/osm/OSMOverpassCache.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+using namespace ugr::mapping::osm;
+namespace fs = std::filesystem;
+
+namespace
+{
+    constexpr auto xmlExtension = ".xml";
+    constexpr auto pbfExtension = ".pbf";
+    constexpr auto metadataExtension = ".query";
+    // Half written entries of other processes are left alone for this long before eviction removes them
+    constexpr auto orphanGracePeriod = std::chrono::minutes(1);
+    // Temporary files may still be being downloaded to, so are only removed once unmodified for at least this
+    // long, or the TTL if longer
+    constexpr std::chrono::seconds tempFileGracePeriod = std::chrono::hours(1);
+
+    // Serialises writing and evicting entries between threads, so eviction never sees a half written entry
+    std::mutex cacheMutex;
+
+    std::string readFile(const std::string& path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    }
+
+    constexpr auto tempSuffix = ".tmp";
+
+    fs::path uniqueTempPath(const fs::path& path)
+    {
+        std::random_device rd;
+        return path.string() + tempSuffix + std::to_string(rd());
+    }
+
+    /**
+     * Write a file atomically by writing to a unique temporary file in the same directory then renaming it
+     */
+    void writeFileAtomic(const fs::path& path, const std::string& contents)
+    {
+        const fs::path tmpPath = uniqueTempPath(path);
+        {
+            std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+            out << contents;
+            if (!out.flush())
+            {
+                throw std::ios_base::failure("Cannot write Overpass cache file at: " + tmpPath.string());
+            }
+        }
+        fs::rename(tmpPath, path);
+    }
+}
+
+OSMOverpassCache::OSMOverpassCache(std::string directory, const std::chrono::seconds ttl, const uint64_t maxBytes,
+                                   const bool offline)
+    : directory(std::move(directory)), ttl(ttl), maxBytes(maxBytes), offline(offline)
+{
+}
+
+OSMOverpassCache OSMOverpassCache::fromEnvironment()
+{
+    // Caching is opt in, as responses would otherwise collect in a shared directory without the user knowing
+    std::string directory;
+    if (const char* dirEnv = std::getenv("UGR_OVERPASS_CACHE_DIR"))
+    {
+        directory = dirEnv;
+    }
+
+    std::chrono::seconds ttl = std::chrono::hours(24 * 7);
+    if (const char* ttlEnv = std::getenv("UGR_OVERPASS_CACHE_TTL"))
+    {
+        ttl = std::chrono::seconds(std::strtoll(ttlEnv, nullptr, 10));
+    }
+
+    uint64_t maxBytes = 1024ULL << 20;
+    if (const char* maxEnv = std::getenv("UGR_OVERPASS_CACHE_MAX_MB"))
+    {
+        maxBytes = std::strtoull(maxEnv, nullptr, 10) << 20;
+    }
+
+    bool offline = false;
+    if (const char* offlineEnv = std::getenv("UGR_OVERPASS_OFFLINE"))
+    {
+        const std::string value = offlineEnv;
+        offline = value == "1" || value == "ON" || value == "on" || value == "true";
+    }
+
+    return {directory, ttl, maxBytes, offline};
+}
+
+std::string OSMOverpassCache::hashKey(const std::string& query)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const unsigned char c : query)
+    {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    std::ostringstream hex;
+    hex << std::hex;
+    hex.width(16);
+    hex.fill('0');
+    hex << hash;
+    return hex.str();
+}
+
+std::string OSMOverpassCache::responseFormat(const std::string& path)
+{
+    return fs::path(path).extension() == pbfExtension ? "pbf" : "xml";
+}
+
+std::string OSMOverpassCache::responsePath(const std::string& key, const std::string& format) const
+{
+    return (fs::path(directory) / (key + (format == "pbf" ? pbfExtension : xmlExtension))).string();
+}
+
+std::string OSMOverpassCache::metadataPath(const std::string& key) const
+{
+    return (fs::path(directory) / (key + metadataExtension)).string();
+}
+
+std::string OSMOverpassCache::lookup(const std::string& query) const
+{
+    if (!isEnabled())
+    {
+        return {};
+    }
+    const auto key = hashKey(query);
+    const auto metadata = metadataPath(key);
+
+    std::error_code ec;
+    const auto storedTime = fs::last_write_time(metadata, ec);
+    if (ec)
+    {
+        return {};
+    }
+    auto response = responsePath(key, "pbf");
+    if (!fs::exists(response, ec))
+    {
+        response = responsePath(key, "xml");
+        if (!fs::exists(response, ec))
+        {
+            return {};
+        }
+    }
+    const auto now = fs::file_time_type::clock::now();
+    if (ttl.count() > 0 && now - storedTime > ttl)
+    {
+        spdlog::debug("Overpass cache entry {} has expired", key);
+        return {};
+    }
+    if (readFile(metadata) != query)
+    {
+        spdlog::warn("Overpass cache hash collision for entry {}", key);
+        return {};
+    }
+
+    // Mark the entry as recently used for eviction
+    fs::last_write_time(response, now, ec);
+    spdlog::info("Using cached Overpass response {}", response);
+    return response;
+}
+
+std::string OSMOverpassCache::store(const std::string& query, const std::string& response) const
+{
+    fs::create_directories(directory);
+    const auto key = hashKey(query);
+    const auto path = responsePath(key);
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    // The metadata is written first, so a response is never seen without its metadata and evicted
+    writeFileAtomic(metadataPath(key), query);
+    writeFileAtomic(path, response);
+    std::error_code ec;
+    fs::remove(responsePath(key, "pbf"), ec);
+    return path;
+}
+
+std::string OSMOverpassCache::storeFile(const std::string& query, const std::string& responseFile,
+                                        const std::string& format) const
+{
+    fs::create_directories(directory);
+    const auto key = hashKey(query);
+    const auto path = responsePath(key, format);
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    // The metadata is written first, so a response is never seen without its metadata and evicted
+    writeFileAtomic(metadataPath(key), query);
+    fs::rename(responseFile, path);
+    // Lookups prefer PBF, so a stale entry in the other format must not be left behind
+    std::error_code ec;
+    fs::remove(responsePath(key, format == "pbf" ? "xml" : "pbf"), ec);
+    return path;
+}
+
+std::string OSMOverpassCache::newTempPath(const std::string& query) const
+{
+    fs::create_directories(directory);
+    return uniqueTempPath(responsePath(hashKey(query))).string();
+}
+
+void OSMOverpassCache::evict() const
+{
+    std::error_code ec;
+    if (!isEnabled() || !fs::is_directory(directory, ec))
+    {
+        return;
+    }
+
+    struct Entry
+    {
+        fs::path response;
+        fs::path metadata;
+        fs::file_time_type lastUsed;
+        uint64_t bytes;
+    };
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    std::vector<Entry> entries;
+    uint64_t totalBytes = 0;
+    const auto now = fs::file_time_type::clock::now();
+    const auto tempGracePeriod = std::max(ttl, tempFileGracePeriod);
+    for (const auto& file : fs::directory_iterator(directory, ec))
+    {
+        if (file.path().filename().string().find(tempSuffix) != std::string::npos)
+        {
+            // Temporary files left by a process stopped between writing and renaming them
+            if (now - file.last_write_time(ec) > tempGracePeriod && !ec)
+            {
+                spdlog::debug("Removing orphaned Overpass cache file {}", file.path().string());
+                fs::remove(file.path(), ec);
+            }
+            ec.clear();
+            continue;
+        }
+        const auto extension = file.path().extension();
+        if (extension == metadataExtension)
+        {
+            // Metadata left without a response by a failed write
+            auto response = file.path();
+            if (!fs::exists(response.replace_extension(xmlExtension), ec)
+                && !fs::exists(response.replace_extension(pbfExtension), ec)
+                && now - file.last_write_time(ec) > orphanGracePeriod && !ec)
+            {
+                fs::remove(file.path(), ec);
+            }
+            ec.clear();
+            continue;
+        }
+        if (extension != xmlExtension && extension != pbfExtension)
+        {
+            continue;
+        }
+        Entry entry{file.path(), file.path(), file.last_write_time(ec), file.file_size(ec)};
+        entry.metadata.replace_extension(metadataExtension);
+        if (ec)
+        {
+            // Removed by another process
+            ec.clear();
+            continue;
+        }
+        const auto storedTime = fs::last_write_time(entry.metadata, ec);
+        if (ec && now - entry.lastUsed <= orphanGracePeriod)
+        {
+            // Another process may be writing this entry
+            ec.clear();
+            continue;
+        }
+        if (ec || (ttl.count() > 0 && now - storedTime > ttl))
+        {
+            ec.clear();
+            fs::remove(entry.response, ec);
+            fs::remove(entry.metadata, ec);
+            continue;
+        }
+        totalBytes += entry.bytes;
+        entries.push_back(std::move(entry));
+    }
+
+    if (maxBytes == 0 || totalBytes <= maxBytes)
+    {
+        return;
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b)
+    {
+        return a.lastUsed < b.lastUsed;
+    });
+    for (const auto& entry : entries)
+    {
+        if (totalBytes <= maxBytes)
+        {
+            break;
+        }
+        spdlog::debug("Evicting Overpass cache entry {}", entry.response.string());
+        fs::remove(entry.metadata, ec);
+        fs::remove(entry.response, ec);
+        totalBytes -= entry.bytes;
+    }
+}
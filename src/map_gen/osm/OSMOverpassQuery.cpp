@@ -5,23 +5,124 @@
  */
 
 #include <cpr/cpr.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <ios>
 #include <iostream>
+#include <iterator>
+#include <mutex>
 #include <stack>
+#include <string_view>
+
+#include <spdlog/spdlog.h>
 
 #include <osmium/handler/node_locations_for_ways.hpp>
+#include <osmium/io/pbf_input.hpp>
+#include <osmium/io/pbf_output.hpp>
+#include <osmium/io/writer.hpp>
 #include <osmium/io/xml_input.hpp>
+#include <osmium/io/xml_output.hpp>
 
 #ifdef UGR_IO_COMPRESSION_BZ2
 #include <osmium/io/any_compression.hpp>
 #endif
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#else
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
 #include "OverpassExceptions.h"
 #include "uasgroundrisk/map_gen/osm/OSMOverpassQueryBuilder.h"
 
 using namespace osmium::io;
 using namespace ugr::mapping::osm;
 
+namespace
+{
+    /**
+     * Create an empty file with a unique name in the system temp directory. Unlike std::tmpnam, the
+     * name cannot be taken by another process between choosing it and creating the file
+     * @return the path of the file
+     */
+    std::string makeTempFile()
+    {
+        const auto tmpDir = std::filesystem::temp_directory_path();
+#ifndef _WIN32
+        std::string path = (tmpDir / "ugr_overpass_XXXXXX").string();
+        const int fd = mkstemp(&path[0]);
+        if (fd < 0)
+        {
+            throw std::ios_base::failure("Cannot create temporary file in: " + tmpDir.string());
+        }
+        close(fd);
+        return path;
+#else
+        char path[MAX_PATH];
+        if (GetTempFileNameA(tmpDir.string().c_str(), "ugr", 0, path) == 0)
+        {
+            throw std::ios_base::failure("Cannot create temporary file in: " + tmpDir.string());
+        }
+        return path;
+#endif
+    }
+
+#ifndef _WIN32
+    bool writeAll(const int fd, std::string_view data)
+    {
+        while (!data.empty())
+        {
+            const auto written = write(fd, data.data(), data.size());
+            if (written < 0)
+            {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data.remove_prefix(written);
+        }
+        return true;
+    }
+#endif
+}
+
+OverpassResponseStream::~OverpassResponseStream()
+{
+    // Closing the read end first makes the downloader fail its next write, if the response was not
+    // read to the end
+    closeRead();
+    if (downloader.joinable()) downloader.join();
+}
+
+void OverpassResponseStream::finish()
+{
+    closeRead();
+    if (downloader.joinable()) downloader.join();
+    if (error) std::rethrow_exception(error);
+}
+
+void OverpassResponseStream::closeRead()
+{
+#ifndef _WIN32
+    if (readFd >= 0)
+    {
+        close(readFd);
+        readFd = -1;
+    }
+#endif
+}
+
 OSMOverpassQueryBuilder
 OSMOverpassQuery::create(const Coordinates& southWestCoord,
                          const Coordinates& northEastCoord)
@@ -31,33 +132,348 @@ OSMOverpassQuery::create(const Coordinates& southWestCoord,
 
 std::string OSMOverpassQuery::rawResponse(const short int maxRetries) const
 {
-    cpr::Url url = getOverpassEndpoint();
-    cpr::Body params = cpr::Body{buildQueryString()};
-    cpr::Response response = cpr::Post(url, params, cpr::VerifySsl(false));
+    std::string path = fetchResponseFile(maxRetries);
+    std::string xmlPath;
+    if (responseFormat != "xml")
+    {
+        // Cached responses may have been converted, so convert them back to the XML Overpass returned
+        xmlPath = makeTempFile();
+        convertResponse(File{path, responseFormat}, File{xmlPath, "xml"});
+        path = xmlPath;
+    }
+    std::ifstream in(path, std::ios::binary);
+    std::string response{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    if (!xmlPath.empty()) std::remove(xmlPath.c_str());
+    cache.evict();
+    return response;
+}
+
+bool OSMOverpassQuery::lookupCache(const std::string& queryString) const
+{
+    std::string cachedPath = cache.lookup(queryString);
+    if (cachedPath.empty())
+    {
+        return false;
+    }
 
-    if (response.status_code != 200) {
-        if (maxRetries > 0) {
-            std::cout << "Overpass query failed with status code " << response.status_code << ". Retrying..."
-                      << std::endl;
-            return rawResponse(maxRetries - 1);
-        } else {
-            std::cerr << "Overpass query terminally failed with status code " << std::to_string(response.status_code)
-                      << " for query: " << params.str() << std::endl;
+    std::string format = OSMOverpassCache::responseFormat(cachedPath);
+    if (format == "xml")
+    {
+        // Overpass cannot return PBF, so the cached XML is converted once for later reads to decode
+        // faster. The XML is used if this fails
+        std::string tempPath;
+        try
+        {
+            tempPath = cache.newTempPath(queryString);
+            convertResponse(File{cachedPath, "xml"}, File{tempPath, "pbf"});
+            cachedPath = cache.storeFile(queryString, tempPath, "pbf");
+            format = "pbf";
+        }
+        catch (const std::exception& e)
+        {
+            if (!tempPath.empty()) std::remove(tempPath.c_str());
+            std::cerr << "Could not convert cached Overpass response to PBF: " << e.what() << std::endl;
         }
     }
 
-    std::string response_txt = response.text;
-    std::ofstream out;
-    out.open(responseFilepath);
-    out << response_txt;
+    if (ownsResponseFile) std::remove(responseFilepath.c_str());
+    responseFilepath = cachedPath;
+    responseFormat = format;
+    ownsResponseFile = false;
+    return true;
+}
+
+void OSMOverpassQuery::convertResponse(const File& input, const File& output)
+{
+    Reader reader{input};
+    Writer writer{output, reader.header(), overwrite::allow};
+    while (osmium::memory::Buffer buffer = reader.read())
+    {
+        writer(std::move(buffer));
+    }
+    writer.close();
+    reader.close();
+}
+
+const std::string& OSMOverpassQuery::fetchResponseFile(const short int maxRetries) const
+{
+    const std::string queryString = buildQueryString();
+    if (lookupCache(queryString))
+    {
+        return responseFilepath;
+    }
+    if (cache.isOffline())
+    {
+        throw overpass_cache_miss_exception();
+    }
+
+    // The response is downloaded into the cache directory if possible, so it can be moved into place
+    std::string cacheTempPath;
+    if (cache.isEnabled())
+    {
+        try
+        {
+            cacheTempPath = cache.newTempPath(queryString);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Could not cache Overpass response: " << e.what() << std::endl;
+        }
+    }
+    const std::string downloadPath = cacheTempPath.empty() ? makeTempFile() : cacheTempPath;
+
+    std::ofstream out(downloadPath, std::ios::binary | std::ios::trunc);
+    try
+    {
+        postQuery(queryString, maxRetries, [&out](const std::string_view& data)
+        {
+            out.write(data.data(), data.size());
+            return static_cast<bool>(out);
+        });
+    }
+    catch (...)
+    {
+        out.close();
+        std::remove(downloadPath.c_str());
+        throw;
+    }
     out.close();
-    return std::move(response_txt);
+
+    if (ownsResponseFile) std::remove(responseFilepath.c_str());
+    responseFilepath = downloadPath;
+    responseFormat = "xml";
+    ownsResponseFile = true;
+
+    // Only successful responses are cached, so failures are retried on the next run
+    if (!cacheTempPath.empty())
+    {
+        try
+        {
+            responseFilepath = cache.storeFile(queryString, cacheTempPath);
+            ownsResponseFile = false;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Could not cache Overpass response: " << e.what() << std::endl;
+        }
+    }
+    return responseFilepath;
+}
+
+void OSMOverpassQuery::postQuery(const std::string& queryString, const short int maxRetries,
+                                 const std::function<bool(const std::string_view&)>& onData) const
+{
+    // Once any of the response has been passed on the request cannot be retried
+    bool streamed = false;
+    for (short int attempt = 0;; ++attempt)
+    {
+        const std::string endpoint = endpoints->acquire();
+        long statusCode = 0;
+        const cpr::Response response = cpr::Post(
+            cpr::Url{endpoint}, cpr::Body{queryString}, cpr::VerifySsl(false),
+            cpr::ConnectTimeout{std::chrono::seconds(30)},
+            cpr::HeaderCallback{
+                [&statusCode](const std::string_view& header, intptr_t)
+                {
+                    // The status line is repeated for every redirect, the last one is the response
+                    if (header.rfind("HTTP/", 0) == 0)
+                    {
+                        const auto space = header.find(' ');
+                        if (space != std::string_view::npos)
+                        {
+                            statusCode = std::strtol(std::string(header.substr(space + 1)).c_str(),
+                                                     nullptr, 10);
+                        }
+                    }
+                    return true;
+                }
+            },
+            cpr::WriteCallback{
+                [&](const std::string_view& data, intptr_t)
+                {
+                    // Error pages are discarded, so the request can be retried
+                    if (statusCode != 200) return true;
+                    streamed = true;
+                    return onData(data);
+                }
+            });
+
+        if (response.status_code == 200 && response.error.code == cpr::ErrorCode::OK)
+        {
+            endpoints->reportSuccess(endpoint);
+            return;
+        }
+        endpoints->reportFailure(endpoint);
+        if (streamed || attempt >= maxRetries)
+        {
+            std::cerr << "Overpass query terminally failed with status code " << response.status_code
+                << " for query: " << queryString << std::endl;
+            throw overpass_network_exception();
+        }
+        std::cout << "Overpass query to " << endpoint << " failed with status code " << response.status_code
+            << ". Retrying..." << std::endl;
+    }
+}
+
+std::vector<OSMOverpassQuery> OSMOverpassQuery::splitTiles() const
+{
+    std::vector<OSMOverpassQuery> tiles;
+    std::vector<std::pair<Coordinates, Coordinates>> pending{{southWestCoord, northEastCoord}};
+    while (!pending.empty())
+    {
+        const auto [southWest, northEast] = pending.back();
+        pending.pop_back();
+        const double width = northEast.x - southWest.x;
+        const double height = northEast.y - southWest.y;
+        if (width <= maxTileSize && height <= maxTileSize)
+        {
+            OSMOverpassQuery tile = *this;
+            tile.southWestCoord = southWest;
+            tile.northEastCoord = northEast;
+            tile.responseFilepath.clear();
+            tile.responseFormat = "xml";
+            tile.ownsResponseFile = false;
+            tiles.push_back(std::move(tile));
+            continue;
+        }
+        // Split into quadrants, in the order they are taken from the back of the stack
+        const Coordinates centre{southWest.x + width / 2, southWest.y + height / 2};
+        pending.emplace_back(Coordinates{centre.x, centre.y}, northEast);
+        pending.emplace_back(Coordinates{southWest.x, centre.y}, Coordinates{centre.x, northEast.y});
+        pending.emplace_back(Coordinates{centre.x, southWest.y}, Coordinates{northEast.x, centre.y});
+        pending.emplace_back(southWest, centre);
+    }
+    return tiles;
+}
+
+void OSMOverpassQuery::fetchTiles(std::vector<OSMOverpassQuery>& tiles) const
+{
+    const auto workerCount = static_cast<std::size_t>(std::max(1, maxConcurrentRequests));
+    std::atomic<std::size_t> nextTile{0};
+    std::mutex errorMutex;
+    std::exception_ptr error;
+
+    const auto worker = [&]()
+    {
+        for (auto i = nextTile++; i < tiles.size(); i = nextTile++)
+        {
+            try
+            {
+                tiles[i].fetchResponseFile();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) error = std::current_exception();
+                // Skip the remaining tiles, as the query cannot be completed
+                nextTile = tiles.size();
+            }
+        }
+    };
+
+    spdlog::info("Fetching Overpass query in {} tiles", tiles.size());
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < std::min(workerCount, tiles.size()); ++i)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+    if (error) std::rethrow_exception(error);
 }
 
-cpr::Url OSMOverpassQuery::getOverpassEndpoint() const
+std::unique_ptr<OverpassResponseStream> OSMOverpassQuery::openResponseStream(const short int maxRetries) const
 {
-    // Get a random Overpass endpoint from OVERPASS_ENDPOINTS
-    return OVERPASS_ENDPOINTS[std::rand() % OVERPASS_ENDPOINTS.size()];
+    std::unique_ptr<OverpassResponseStream> stream(new OverpassResponseStream());
+    const std::string queryString = buildQueryString();
+    if (lookupCache(queryString))
+    {
+        stream->file = getResponseFile();
+        return stream;
+    }
+    if (cache.isOffline())
+    {
+        throw overpass_cache_miss_exception();
+    }
+
+#ifdef _WIN32
+    // Anonymous pipes cannot be opened by path on Windows, so the response is downloaded first
+    fetchResponseFile(maxRetries);
+    stream->file = getResponseFile();
+    return stream;
+#else
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        throw std::ios_base::failure("Cannot create pipe for the Overpass response");
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    stream->readFd = fds[0];
+    stream->file = File{"/dev/fd/" + std::to_string(fds[0]), "xml"};
+
+    // The response is also written to the cache as it is streamed
+    std::string cacheTempPath;
+    if (cache.isEnabled())
+    {
+        try
+        {
+            cacheTempPath = cache.newTempPath(queryString);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Could not cache Overpass response: " << e.what() << std::endl;
+        }
+    }
+
+    const int writeFd = fds[1];
+    auto* const streamPtr = stream.get();
+    stream->downloader = std::thread([this, streamPtr, writeFd, queryString, cacheTempPath, maxRetries]()
+    {
+        // Writing to a pipe with no reader raises SIGPIPE, block it so the write fails instead
+        sigset_t sigpipe;
+        sigemptyset(&sigpipe);
+        sigaddset(&sigpipe, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+
+        std::ofstream cacheOut;
+        if (!cacheTempPath.empty()) cacheOut.open(cacheTempPath, std::ios::binary | std::ios::trunc);
+
+        try
+        {
+            postQuery(queryString, maxRetries, [&](const std::string_view& data)
+            {
+                if (cacheOut.is_open()) cacheOut.write(data.data(), data.size());
+                return writeAll(writeFd, data);
+            });
+        }
+        catch (...)
+        {
+            streamPtr->error = std::current_exception();
+        }
+        // Closing the write end lets the reader see the end of the response
+        close(writeFd);
+
+        if (cacheOut.is_open())
+        {
+            cacheOut.close();
+            try
+            {
+                if (!streamPtr->error && cacheOut) cache.storeFile(queryString, cacheTempPath);
+                else std::remove(cacheTempPath.c_str());
+            }
+            catch (const std::exception& e)
+            {
+                std::remove(cacheTempPath.c_str());
+                std::cerr << "Could not cache Overpass response: " << e.what() << std::endl;
+            }
+        }
+    });
+    return stream;
+#endif
 }
 
 std::string OSMOverpassQuery::buildQueryString(const bool xmlQuery) const
@@ -69,11 +485,12 @@ std::string OSMOverpassQuery::buildQueryString(const bool xmlQuery) const
 
 osmium::memory::Buffer OSMOverpassQuery::rawBuffer() const
 {
-    rawResponse();
-    Reader reader{responseFilepath, osmium::osm_entity_bits::all};
+    fetchResponseFile();
+    Reader reader{getResponseFile(), osmium::osm_entity_bits::all};
     osmium::memory::Buffer buffer = reader.read();
     buffer.commit();
     reader.close();
+    cache.evict();
     return buffer;
 }
 
@@ -130,11 +547,15 @@ std::string OSMOverpassQuery::buildQueryStringXML() const
     qss << "<osm-script output=\"xml\">";
     closingTags.emplace("</osm-script>");
 
-    // Print output
-    closingTags.emplace("<print/>");
+    // Print output with relations first, then nodes, then ways. This lets the response be parsed
+    // in a single streaming pass, as multipolygon members and way node locations are known before
+    // they are needed
+    closingTags.emplace("<query type=\"relation\"><item set=\"all\"/></query><print/>"
+                        "<query type=\"node\"><item set=\"all\"/></query><print/>"
+                        "<query type=\"way\"><item set=\"all\"/></query><print/>");
 
     // TODO Allow better designed clauses
-    qss << "<union>";
+    qss << "<union into=\"all\">";
     closingTags.emplace("</union>");
 
     if (!nodeTags.empty())
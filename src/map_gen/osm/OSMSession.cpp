@@ -0,0 +1,156 @@
+/*
+ * OSMSession.cpp
+ */
+
+#include "uasgroundrisk/map_gen/osm/OSMSession.h"
+
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+#include "uasgroundrisk/map_gen/OSMMap.h"
+
+using namespace ugr::mapping::osm;
+
+namespace
+{
+    /**
+     * @param bounds the [South, West, North, East] bounds in EPSG4326 coordinates
+     */
+    osmium::Box toBox(const std::array<float, 4>& bounds)
+    {
+        osmium::Box box;
+        box.extend(osmium::Location(bounds[1], bounds[0]));
+        box.extend(osmium::Location(bounds[3], bounds[2]));
+        return box;
+    }
+
+    bool sameSource(const OSMDataSource& a, const OSMDataSource& b)
+    {
+        return a.getType() == b.getType() && a.getPath() == b.getPath();
+    }
+}
+
+void OSMSession::addMap(OSMMap& map)
+{
+    maps.push_back(&map);
+}
+
+void OSMSession::eval()
+{
+    struct Entry
+    {
+        OSMMap* map;
+        std::unique_ptr<OSMEntityHandler> handler;
+        std::vector<OSMTag> tags;
+    };
+    std::vector<Entry> entries;
+
+    for (auto* map : maps)
+    {
+        if (map->isEvaluated) continue;
+        auto handler = map->makeSessionHandler();
+        if (!handler)
+        {
+            // Go through the base class, as the OSMMap::eval template hides the virtual eval
+            static_cast<GeospatialGridMap*>(map)->eval();
+            continue;
+        }
+        std::vector<OSMTag> tags;
+        for (const auto& tagLayerPair : map->tagLayerMap)
+        {
+            tags.push_back(tagLayerPair.first);
+        }
+        entries.push_back({map, std::move(handler), std::move(tags)});
+    }
+
+    // Build one query over the union of all tags and bounds
+    std::set<OSMTag> unionTags;
+    std::array<float, 4> unionBounds{};
+    const OSMDataSource* source = nullptr;
+    OSMSessionHandler sessionHandler;
+    for (const auto& entry : entries)
+    {
+        if (entry.tags.empty()) continue;
+        const auto bounds = entry.map->getBounds();
+        if (source == nullptr)
+        {
+            source = &entry.map->getDataSource();
+            unionBounds = bounds;
+        }
+        else if (!sameSource(*source, entry.map->getDataSource()))
+        {
+            throw std::logic_error("OSM maps evaluated in the same session must share a data source");
+        }
+        unionBounds[0] = std::min(unionBounds[0], bounds[0]);
+        unionBounds[1] = std::min(unionBounds[1], bounds[1]);
+        unionBounds[2] = std::max(unionBounds[2], bounds[2]);
+        unionBounds[3] = std::max(unionBounds[3], bounds[3]);
+        unionTags.insert(entry.tags.begin(), entry.tags.end());
+        sessionHandler.addHandler(entry.tags, toBox(bounds), entry.handler.get());
+    }
+
+    if (source != nullptr)
+    {
+        spdlog::info("Reading OSM data for {} maps in a single query", entries.size());
+        queryOSMData(*source, osmium::geom::Coordinates(unionBounds[1], unionBounds[0]),
+                     osmium::geom::Coordinates(unionBounds[3], unionBounds[2]),
+                     std::vector<OSMTag>(unionTags.begin(), unionTags.end()), sessionHandler);
+    }
+
+    for (auto& entry : entries)
+    {
+        entry.map->finishSessionEval();
+    }
+}
+
+void OSMSessionHandler::addHandler(const std::vector<OSMTag>& tags, const osmium::Box& bounds,
+                                   OSMEntityHandler* handler)
+{
+    targets.push_back({makeTagsFilter(tags), bounds, handler});
+}
+
+void OSMSessionHandler::node(const osmium::Node& node)
+{
+    for (auto& target : targets)
+    {
+        if (target.bounds.contains(node.location()) && matchesTagsFilter(node.tags(), target.tagsFilter))
+        {
+            target.handler->node(node);
+        }
+    }
+}
+
+void OSMSessionHandler::way(const osmium::Way& way)
+{
+    const auto envelope = way.envelope();
+    for (auto& target : targets)
+    {
+        if (matchesTagsFilter(way.tags(), target.tagsFilter) && envelopeIntersects(envelope, target.bounds))
+        {
+            target.handler->way(way);
+        }
+    }
+}
+
+void OSMSessionHandler::area(const osmium::Area& area)
+{
+    const auto envelope = area.envelope();
+    for (auto& target : targets)
+    {
+        if (matchesTagsFilter(area.tags(), target.tagsFilter) && envelopeIntersects(envelope, target.bounds))
+        {
+            target.handler->area(area);
+        }
+    }
+}
+
+void OSMSessionHandler::flush()
+{
+    for (auto& target : targets)
+    {
+        target.handler->flush();
+    }
+}
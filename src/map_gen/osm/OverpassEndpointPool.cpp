@@ -0,0 +1,109 @@
+/*
+ * OverpassEndpointPool.cpp
+ */
+
+#include "uasgroundrisk/map_gen/osm/OverpassEndpointPool.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+using namespace ugr::mapping::osm;
+
+OverpassEndpointPool::OverpassEndpointPool(std::vector<std::string> endpoints,
+                                           const std::chrono::milliseconds baseBackoff,
+                                           const std::chrono::milliseconds maxBackoff)
+    : baseBackoff(baseBackoff), maxBackoff(maxBackoff)
+{
+    if (endpoints.empty())
+    {
+        throw std::invalid_argument("At least one Overpass endpoint is required");
+    }
+    for (auto& endpoint : endpoints)
+    {
+        EndpointState state;
+        state.url = std::move(endpoint);
+        states.push_back(std::move(state));
+    }
+}
+
+std::string OverpassEndpointPool::acquire()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        const auto now = Clock::now();
+        EndpointState* best = nullptr;
+        auto nextAvailable = Clock::time_point::max();
+        for (auto& state : states)
+        {
+            if (state.availableAt > now)
+            {
+                nextAvailable = std::min(nextAvailable, state.availableAt);
+                continue;
+            }
+            if (best == nullptr || state.consecutiveFailures < best->consecutiveFailures
+                || (state.consecutiveFailures == best->consecutiveFailures && state.inFlight < best->inFlight))
+            {
+                best = &state;
+            }
+        }
+        if (best != nullptr)
+        {
+            ++best->inFlight;
+            return best->url;
+        }
+        // Every endpoint is backing off, wait for the first to recover
+        lock.unlock();
+        std::this_thread::sleep_until(nextAvailable);
+        lock.lock();
+    }
+}
+
+void OverpassEndpointPool::reportSuccess(const std::string& endpoint)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& state = find(endpoint);
+    --state.inFlight;
+    state.consecutiveFailures = 0;
+}
+
+void OverpassEndpointPool::reportFailure(const std::string& endpoint)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& state = find(endpoint);
+    --state.inFlight;
+    ++state.consecutiveFailures;
+    // Double the backoff for every consecutive failure, capping the shift so it cannot overflow
+    const auto doublings = std::min(state.consecutiveFailures - 1, 20);
+    const auto backoff = std::min(maxBackoff, baseBackoff * (std::chrono::milliseconds::rep{1} << doublings));
+    state.availableAt = Clock::now() + backoff;
+    spdlog::warn("Overpass endpoint {} failed {} times in a row, backing off for {} ms", endpoint,
+                 state.consecutiveFailures, backoff.count());
+}
+
+std::vector<std::string> OverpassEndpointPool::getEndpoints() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> endpoints;
+    for (const auto& state : states)
+    {
+        endpoints.push_back(state.url);
+    }
+    return endpoints;
+}
+
+OverpassEndpointPool::EndpointState& OverpassEndpointPool::find(const std::string& endpoint)
+{
+    const auto iter = std::find_if(states.begin(), states.end(), [&endpoint](const EndpointState& state)
+    {
+        return state.url == endpoint;
+    });
+    if (iter == states.end())
+    {
+        throw std::invalid_argument("Unknown Overpass endpoint: " + endpoint);
+    }
+    return *iter;
+}
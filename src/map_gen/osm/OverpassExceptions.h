@@ -21,4 +21,16 @@ public:
 }
 ;
 
+class overpass_cache_miss_exception : public std::exception {
+public:
+#ifdef _MSC_VER
+  const char *what() const override{
+#else
+  const char *what() const _GLIBCXX_TXN_SAFE_DYN _GLIBCXX_NOTHROW override {
+#endif
+      return "The Overpass query is not in the cache and offline mode is enabled";
+}
+}
+;
+
 #endif // UASGROUNDRISK_SRC_MAP_GEN_OSM_OVERPASSEXCEPTIONS_H_
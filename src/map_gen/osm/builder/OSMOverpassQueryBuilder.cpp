@@ -8,6 +8,8 @@
 #include "uasgroundrisk/map_gen/osm/OSMOverpassQueryBuilder.h"
 #include "uasgroundrisk/map_gen/osm/OSMTag.h"
 
+#include <stdexcept>
+
 using namespace ugr::mapping::osm;
 
 OSMOverpassQueryBuilder&
@@ -46,6 +48,33 @@ OSMOverpassQueryBuilder& OSMOverpassQueryBuilder::withTimeout(short timeout)
 	return *this;
 }
 
+OSMOverpassQueryBuilder& OSMOverpassQueryBuilder::withEndpoints(const std::vector<std::string>& endpoints,
+                                                                const std::chrono::milliseconds baseBackoff)
+{
+	query.endpoints = std::make_shared<OverpassEndpointPool>(endpoints, baseBackoff);
+	return *this;
+}
+
+OSMOverpassQueryBuilder& OSMOverpassQueryBuilder::withMaxTileSize(const double maxTileSize)
+{
+	if (maxTileSize <= 0)
+	{
+		throw std::invalid_argument("Overpass query tile size must be positive");
+	}
+	query.maxTileSize = maxTileSize;
+	return *this;
+}
+
+OSMOverpassQueryBuilder& OSMOverpassQueryBuilder::withMaxConcurrentRequests(const int maxConcurrentRequests)
+{
+	if (maxConcurrentRequests < 1)
+	{
+		throw std::invalid_argument("At least one concurrent Overpass request is required");
+	}
+	query.maxConcurrentRequests = maxConcurrentRequests;
+	return *this;
+}
+
 OSMOverpassQueryBuilder&
 OSMOverpassQueryBuilder::withNodeTag(const std::string& key,
                                      const std::string& value)
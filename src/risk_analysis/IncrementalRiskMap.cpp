@@ -44,9 +44,9 @@ double ugr::risk::IncrementalRiskMap::getIndexPointStrikeProbability(const ugr::
 {
 
 	std::vector<GridMapDataType> impactAngles, impactVelocities;
-	std::vector<Matrix, aligned_allocator<Matrix>> impactPDFs;
+	std::vector<ImpactKernel, aligned_allocator<ImpactKernel>> impactKernels;
 
-	makePointImpactMap(index, altitude, heading, impactPDFs, impactAngles, impactVelocities);
+	makePointImpactKernels(index, altitude, heading, kernelSigma, impactKernels, impactAngles, impactVelocities);
 
 	/* We have now evaluated the impact PDF of the aircraft*/
 	/* Now we move onto the strike risk analysis */
@@ -60,9 +60,12 @@ double ugr::risk::IncrementalRiskMap::getIndexPointStrikeProbability(const ugr::
 
 	for (int i = 0; i < aircraftModel.descents.size(); ++i)
 	{
+		const auto& kernel = impactKernels[i];
 		// Work out the lethal area of the aircraft when it crashes
 		const auto letArea = lethalArea(DEG2RAD(impactAngles[i]), uasWidth);
-		const Matrix strikeRisk = (impactPDFs[i].cwiseProduct(populationDensityMap) * letArea) / pixelArea;
+		const auto populationWindow = populationDensityMap.block(kernel.origin.x(), kernel.origin.y(),
+			kernel.pdf.rows(), kernel.pdf.cols());
+		const Matrix strikeRisk = (kernel.pdf.cwiseProduct(populationWindow) * letArea) / pixelArea;
 		const auto strikeRiskSum = static_cast<GridMapDataType>(aircraftModel.failureProb) * strikeRisk.sum();
 		allDescentStrikeRiskSum += strikeRiskSum;
 
@@ -79,8 +82,7 @@ double ugr::risk::IncrementalRiskMap::getIndexPointFatalityProbability(const ugr
 	const int heading)
 {
 	const auto uasMass = aircraftModel.mass;
-	const Matrix shelterFactorMap = get("Shelter Factor");
-	const auto& shelterFactor = shelterFactorMap(index.x(), index.y());
+	const auto shelterFactor = at("Shelter Factor", index);
 
 	// Need to generate the individual descent strike risk maps and impact characteristics
 	getIndexPointStrikeProbability(index, altitude, heading);
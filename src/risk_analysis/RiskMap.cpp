@@ -5,12 +5,15 @@
  */
 
 #include "uasgroundrisk/risk_analysis/RiskMap.h"
+#include "../utils/Convolution.h"
 #include "../utils/DataFitting.h"
+#include "../utils/RandomStreams.h"
 #include "../utils/GeometryOperations.h"
 #include "../utils/VectorOperations.h"
+#include <algorithm>
 #include <chrono>
+#include <stdexcept>
 #include <omp.h>
-#include <random>
 
 #include "uasgroundrisk/risk_analysis/aircraft/AircraftModel.h"
 #include "uasgroundrisk/risk_analysis/obstacles/ObstacleMap.h"
@@ -25,55 +28,31 @@ ugr::risk::RiskMap::RiskMap(mapping::PopulationMap& populationMap,
 	: GeospatialGridMap(populationMap.getBounds(),
 	static_cast<int>(populationMap.getResolution())),
 	  aircraftModel(aircraftModel),
-	  generator(std::default_random_engine(
-		  std::chrono::system_clock::now().time_since_epoch().count()))
+	  seed(std::chrono::system_clock::now().time_since_epoch().count())
 {
 	spdlog::info("Constructing Riskmap");
 
-	// Evaluate population density map
-	populationMap.eval();
 	// Check if building height layer already exists
 	const auto obstacleLayers = obstacleMap.getLayers();
 	if (std::find(obstacleLayers.begin(), obstacleLayers.end(),
 		"Building Height") == obstacleLayers.end())
 		obstacleMap.addBuildingHeights();
-	// Evaluate obstacles
-	obstacleMap.eval();
+	// Evaluate population density and obstacles from a single read of the OSM data
+	mapping::osm::OSMSession osmSession;
+	osmSession.addMap(populationMap);
+	osmSession.addMap(obstacleMap);
+	osmSession.eval();
 	weatherMap.eval();
-	// Copy across only the the population density and building height layer
-	initLayer("Population Density");
-	initLayer("Building Height");
-	initLayer("Wind VelX");
-	initLayer("Wind VelY");
 	// Get population map and convert from people/km^2 to people/m^2
-	get("Population Density") = populationMap.get("Population Density") * 1e-6;
-	get("Building Height") = obstacleMap.get("Building Height");
-	get("Wind VelX") = weatherMap.get("Wind VelX");
-	get("Wind VelY") = weatherMap.get("Wind VelY");
-
-	// Create objects required for sample distribution generation
-	// construct a trivial random generator engine from a time-based seed:
+	add("Population Density", populationMap.view("Population Density") * 1e-6);
+	// The remaining inputs are only read, so share them with the input maps rather than copying
+	addShared("Building Height", obstacleMap, "Building Height");
+	addShared("Wind VelX", weatherMap, "Wind VelX");
+	addShared("Wind VelY", weatherMap, "Wind VelY");
+	windVelXLayer = getHandle("Wind VelX");
+	windVelYLayer = getHandle("Wind VelY");
 
 	initRiskMapLayers();
-
-	// Generate eval grid once instead of on every iteration
-	evalXs.resize(this->sizeX * this->sizeY);
-	evalYs.resize(this->sizeX * this->sizeY);
-	evalMat.resize(2, this->sizeX * this->sizeY);
-	int i = 0;
-	for (int x = 0; x < sizeX; ++x)
-	{
-		for (int y = 0; y < sizeY; ++y)
-		{
-			// Invert x in line with the axes convention chosen here
-			evalXs[i] = static_cast<GridMapDataType>(sizeX - x);
-			evalYs[i] = static_cast<GridMapDataType>(y);
-
-			evalMat(0, i) = sizeX - x;
-			evalMat(1, i) = y;
-			++i;
-		}
-	}
 }
 
 GridMap&
@@ -98,6 +77,67 @@ ugr::risk::RiskMap::generateMap(const std::vector<RiskType>& risksToGenerate)
 	return *this;
 }
 
+ugr::gridmap::GridMap& ugr::risk::RiskMap::generateHourlyMaps(mapping::TemporalPopulationMap& populationMap,
+	const std::vector<short>& hours)
+{
+	if ((populationMap.getSize() != getSize()).any())
+	{
+		throw std::invalid_argument("Population map must be the same size as the risk map");
+	}
+	// Layers are accumulated into, so each hour must only be generated once
+	std::vector<short> sortedHours(hours);
+	std::sort(sortedHours.begin(), sortedHours.end());
+	if (std::adjacent_find(sortedHours.begin(), sortedHours.end()) != sortedHours.end())
+	{
+		throw std::invalid_argument("Hours must not be repeated");
+	}
+	const auto hourlyDensities = populationMap.evalHours(hours);
+
+	// Add the layers of every hour up front, so the strike maps can be generated for all hours at once
+	std::vector<std::string> suffixes;
+	std::vector<const Matrix*> populationDensityMaps;
+	for (int h = 0; h < hours.size(); ++h)
+	{
+		const auto suffix = " " + std::to_string(hours[h]);
+		suffixes.push_back(suffix);
+		initLayer("Population Density" + suffix);
+		initLayer("Strike Risk" + suffix);
+		initLayer("Fatality Risk" + suffix);
+		// Convert from people/km^2 to people/m^2
+		get("Population Density" + suffix) = hourlyDensities[h] * 1e-6;
+	}
+	for (const auto& suffix : suffixes)
+	{
+		populationDensityMaps.push_back(&get("Population Density" + suffix));
+	}
+
+	// The strike risk of each descent at each hour only needs to be kept until it is combined
+	const auto nDescents = aircraftModel.descents.size();
+	std::vector<std::vector<Matrix>> strikeRisks(nDescents,
+		std::vector<Matrix>(hours.size(), Matrix::Zero(sizeX, sizeY)));
+	auto descentLayers = getDescentLayers();
+	for (int i = 0; i < nDescents; ++i)
+	{
+		for (auto& strikeRisk : strikeRisks[i])
+		{
+			descentLayers[i].strikeRisks.push_back(&strikeRisk);
+		}
+	}
+	generateStrikeMaps(populationDensityMaps, descentLayers);
+
+	// The fatality probability only depends on the impact velocities, which are the same at every hour
+	for (int i = 0; i < nDescents; ++i)
+	{
+		const Matrix fatalityProb = descentFatalityProbability(aircraftModel.descents[i]->getName());
+		for (int h = 0; h < hours.size(); ++h)
+		{
+			get("Strike Risk" + suffixes[h]) += strikeRisks[i][h];
+			get("Fatality Risk" + suffixes[h]) += strikeRisks[i][h].cwiseProduct(fatalityProb);
+		}
+	}
+	return *this;
+}
+
 void ugr::risk::RiskMap::eval()
 {
 	spdlog::info("Evaluating Riskmap");
@@ -135,16 +175,13 @@ void ugr::risk::RiskMap::initLayer(const std::string& layerName)
 
 void ugr::risk::RiskMap::generateStrikeMap()
 {
-	// Iterate through all cells in the grid map
-#pragma omp parallel for collapse(2) schedule(dynamic) default(none)
-	for (int x = 0; x < sizeX; ++x)
+	auto descentLayers = getDescentLayers();
+	for (int i = 0; i < aircraftModel.descents.size(); ++i)
 	{
-		for (int y = 0; y < sizeY; ++y)
-		{
-			// TODO: package this as a CUDA function
-			addPointStrikeMap({ x, y });
-		}
+		descentLayers[i].strikeRisks.push_back(&get(aircraftModel.descents[i]->getName() + " Strike Risk"));
 	}
+	generateStrikeMaps({ &get("Population Density") }, descentLayers);
+
 	add("Strike Risk", 0);
 	for (const auto& descent : aircraftModel.descents)
 	{
@@ -153,23 +190,65 @@ void ugr::risk::RiskMap::generateStrikeMap()
 	}
 }
 
-void ugr::risk::RiskMap::generateFatalityMap()
+void ugr::risk::RiskMap::generateStrikeMaps(const std::vector<const Matrix*>& populationDensityMaps,
+	const std::vector<DescentLayers>& descentLayers)
 {
-	const auto uasMass = aircraftModel.mass;
+	if (convolution && hasUniformConditions())
+	{
+		generateStrikeMapConvolution(populationDensityMaps, descentLayers);
+	}
+	else
+	{
+		// Layers are not added or removed while the strike map is generated and each cell only
+		// writes to its own index, so no synchronisation is needed
 
-	const Matrix shelterFactorMap = get("Shelter Factor");
+		// Iterate through all cells in the grid map
+#pragma omp parallel for collapse(2) schedule(dynamic) default(none) shared(populationDensityMaps, descentLayers)
+		for (int x = 0; x < sizeX; ++x)
+		{
+			for (int y = 0; y < sizeY; ++y)
+			{
+				// TODO: package this as a CUDA function
+				addPointStrikeMap({ x, y }, populationDensityMaps, descentLayers);
+			}
+		}
+	}
+}
 
+std::vector<ugr::risk::RiskMap::DescentLayers> ugr::risk::RiskMap::getDescentLayers()
+{
+	// Resolve the layers up front, so cells can write to them in parallel
+	std::vector<DescentLayers> descentLayers;
+	for (const auto& descent : aircraftModel.descents)
+	{
+		const auto descentName = descent->getName();
+		descentLayers.push_back({
+			{},
+			&get(descentName + " Impact Angle"),
+			&get(descentName + " Impact Velocity")
+		});
+	}
+	return descentLayers;
+}
+
+ugr::gridmap::Matrix ugr::risk::RiskMap::descentFatalityProbability(const std::string& descentName) const
+{
+	// Read through views, as layers shared with a map opened from a file are mapped
+	return fatalityProbability(1e6, 100, vel2ke(view(descentName + " Impact Velocity"), aircraftModel.mass),
+		view("Shelter Factor"));
+}
+
+void ugr::risk::RiskMap::generateFatalityMap()
+{
 	for (const auto& descent : aircraftModel.descents)
 	{
 		const auto descentName = descent->getName();
 		const Matrix& strikeRiskMap = get(descentName + " Strike Risk");
-		const Matrix& impactVelocities = get(descentName + " Impact Velocity");
 		// const Matrix& impactAngles = get(descentName + " Impact Angle");
 
 
 		Matrix fatalityRisk(sizeX, sizeY);
-		fatalityRisk = strikeRiskMap.cwiseProduct(fatalityProbability(
-			1e6, 100, vel2ke(impactVelocities, uasMass), shelterFactorMap));
+		fatalityRisk = strikeRiskMap.cwiseProduct(descentFatalityProbability(descentName));
 
 #pragma omp critical
 		get(descentName + " Fatality Risk") = fatalityRisk;
@@ -183,14 +262,101 @@ void ugr::risk::RiskMap::generateFatalityMap()
 	}
 }
 
-void ugr::risk::RiskMap::addPointStrikeMap(const Index& index)
+bool ugr::risk::RiskMap::hasUniformConditions() const
+{
+	// The aircraft state is common to all cells, so only the wind can vary across the map
+	const auto isUniform = [](const ConstMatrixMap& layer)
+	{
+		return layer.size() == 0 || (layer.array() == layer(0, 0)).all();
+	};
+	// The wind layers are shared with the weather map, which may be mapped from a file
+	return isUniform(view("Wind VelX")) && isUniform(view("Wind VelY"));
+}
+
+void ugr::risk::RiskMap::generateStrikeMapConvolution(const std::vector<const Matrix*>& populationDensityMaps,
+	const std::vector<DescentLayers>& descentLayers)
+{
+	spdlog::info("Uniform conditions across map, generating strike map by convolution");
+
+	std::vector<GridMapDataType> impactAngles, impactVelocities;
+	std::vector<ImpactDistribution, aligned_allocator<ImpactDistribution>> impactDistributions;
+	const auto& altitude = aircraftModel.state.getAltitude();
+	const int& heading = anyHeading ? -1 : static_cast<int>(aircraftModel.state.getHeading());
+
+	// With uniform conditions the impact distribution is the same relative to every cell,
+	// so fitting it at the origin gives the distribution of impact offsets directly
+	fitPointImpactDistributions({ 0, 0 }, altitude, heading, impactDistributions, impactAngles, impactVelocities);
+
+	const GridMapDataType pixelArea = getResolution() * getResolution();
+	const auto uasWidth = aircraftModel.width;
+	const Eigen::MatrixXd onMap = Eigen::MatrixXd::Ones(sizeX, sizeY);
+
+	for (int i = 0; i < aircraftModel.descents.size(); ++i)
+	{
+		const auto& distParams = impactDistributions[i];
+		const auto& layers = descentLayers[i];
+		layers.impactAngle->setConstant(impactAngles[i]);
+		layers.impactVelocity->setConstant(impactVelocities[i]);
+
+		// Offsets of impact cells from the LoC cell covered by the kernel. This matches the windows
+		// of makePointImpactKernels, but without clamping to the map as the kernel is shared by all cells
+		int xMin = -(sizeX - 1), yMin = -(sizeY - 1), xMax = sizeX - 1, yMax = sizeY - 1;
+		if (kernelSigma > 0)
+		{
+			const auto support = util::gaussian2DSupport(distParams.means, distParams.cov, kernelSigma);
+			if (std::all_of(support.begin(), support.end(), [](const double b) { return std::isfinite(b); }))
+			{
+				xMin = static_cast<int>(std::max(std::floor(support[0]) - 1, static_cast<double>(xMin)));
+				yMin = static_cast<int>(std::max(std::floor(support[1]), static_cast<double>(yMin)));
+				xMax = static_cast<int>(std::min(std::ceil(support[2]) - 1, static_cast<double>(xMax)));
+				yMax = static_cast<int>(std::min(std::ceil(support[3]), static_cast<double>(yMax)));
+			}
+		}
+		if (xMax < xMin || yMax < yMin)
+		{
+			// No cell can ever impact within the map
+			for (auto* strikeRisk : layers.strikeRisks) strikeRisk->setZero();
+			continue;
+		}
+
+		Eigen::MatrixXd kernel =
+			evalImpactDistribution(distParams, xMin, yMin, xMax - xMin + 1, yMax - yMin + 1).cast<double>();
+		const double kernelSum = kernel.sum();
+		if (!(kernelSum > 0))
+		{
+			for (auto* strikeRisk : layers.strikeRisks) strikeRisk->setZero();
+			continue;
+		}
+		kernel /= kernelSum;
+
+		// Each per cell PDF is renormalised over the part of the kernel that lies on the map,
+		// which is the correlation of the kernel with the map extent itself. The kernel spectrum
+		// is shared by the correlations of every population density
+		const util::FFTCorrelator2D correlator(kernel, xMin, yMin, sizeX, sizeY);
+		const Eigen::MatrixXd kernelMass = correlator.correlate(onMap);
+
+		const double letArea = lethalArea(DEG2RAD(impactAngles[i]), uasWidth);
+		const double strikeScale = aircraftModel.failureProb * letArea / pixelArea;
+		for (int p = 0; p < populationDensityMaps.size(); ++p)
+		{
+			const Eigen::MatrixXd populationStrike = correlator.correlate(*populationDensityMaps[p]);
+			// Cells with (numerically) none of the kernel on the map have no strike risk
+			*layers.strikeRisks[p] = (kernelMass.array() > 1e-9)
+				.select(strikeScale * populationStrike.array() / kernelMass.array(), 0.0)
+				.cast<GridMapDataType>().matrix();
+		}
+	}
+}
+
+void ugr::risk::RiskMap::addPointStrikeMap(const Index& index, const std::vector<const Matrix*>& populationDensityMaps,
+	const std::vector<DescentLayers>& descentLayers) const
 {
 	std::vector<GridMapDataType> impactAngles, impactVelocities;
-	std::vector<Matrix, aligned_allocator<Matrix>> impactPDFs;
+	std::vector<ImpactKernel, aligned_allocator<ImpactKernel>> impactKernels;
 	const auto& altitude = aircraftModel.state.getAltitude();
 	const int& heading = anyHeading ? -1 : static_cast<int>(aircraftModel.state.getHeading());
 
-	makePointImpactMap(index, altitude, heading, impactPDFs, impactAngles, impactVelocities);
+	makePointImpactKernels(index, altitude, heading, kernelSigma, impactKernels, impactAngles, impactVelocities);
 
 	/* We have now evaluated the impact PDF of the aircraft*/
 	/* Now we move onto the strike risk analysis */
@@ -198,28 +364,32 @@ void ugr::risk::RiskMap::addPointStrikeMap(const Index& index)
 	// These are used later
 	const GridMapDataType pixelArea = getResolution() * getResolution();
 	const auto uasWidth = aircraftModel.width;
-	const Matrix& populationDensityMap = get("Population Density");
 
 	for (int i = 0; i < aircraftModel.descents.size(); ++i)
 	{
+		const auto& kernel = impactKernels[i];
 		// Work out the lethal area of the aircraft when it crashes
 		const auto letArea = lethalArea(DEG2RAD(impactAngles[i]), uasWidth);
-		const Matrix strikeRisk =
-			(impactPDFs[i].cwiseProduct(populationDensityMap) * letArea) /
-				pixelArea;
-		const auto strikeRiskSum = static_cast<GridMapDataType>(aircraftModel.failureProb) * strikeRisk.sum();
-		const auto descentName = aircraftModel.descents[i]->getName();
-
-		// Synchronise writing to the common gridmap
-#pragma omp critical
+		const auto& layers = descentLayers[i];
+		// The kernel is applied to every population density
+		for (int p = 0; p < populationDensityMaps.size(); ++p)
 		{
+			// The PDF is zero outside of the kernel window, so only the population under the window contributes
+			const auto populationWindow = populationDensityMaps[p]->block(kernel.origin.x(), kernel.origin.y(),
+				kernel.pdf.rows(), kernel.pdf.cols());
+			const auto strikeRisk =
+				(kernel.pdf.cwiseProduct(populationWindow).sum() * letArea) /
+					pixelArea;
+			const auto strikeRiskSum = static_cast<GridMapDataType>(aircraftModel.failureProb * strikeRisk);
+
 			// As we are only generating the strike risk from a single point,
 			// this is summed across the entire strike risk map for that point
-			// and set as the scalar value for the point it was generated for
-			at(descentName + " Strike Risk", index) = strikeRiskSum;
-			at(descentName + " Impact Angle", index) = impactAngles[i];
-			at(descentName + " Impact Velocity", index) = impactVelocities[i];
+			// and set as the scalar value for the point it was generated for.
+			// Only this cell is written to, so this is safe without synchronisation
+			(*layers.strikeRisks[p])(index.x(), index.y()) = strikeRiskSum;
 		}
+		(*layers.impactAngle)(index.x(), index.y()) = impactAngles[i];
+		(*layers.impactVelocity)(index.x(), index.y()) = impactVelocities[i];
 	}
 }
 
@@ -229,55 +399,150 @@ void ugr::risk::RiskMap::makePointImpactMap(
 	const int heading,
 	std::vector<Matrix, aligned_allocator<Matrix>>& impactPDFs,
 	std::vector<GridMapDataType>& impactAngles,
-	std::vector<GridMapDataType>& impactVelocities)
+	std::vector<GridMapDataType>& impactVelocities) const
 {
-	const auto& windVelX = at("Wind VelX", index);
-	const auto& windVelY = at("Wind VelY", index);
-	auto windXVelDist = std::normal_distribution<double>(windVelX, 0.5);
-	auto windYVelDist = std::normal_distribution<double>(windVelY, 0.5);
-	std::vector<Vector2d, aligned_allocator<Vector2d>> windVect(nSamples);
+	// Without truncation the kernel windows cover the whole map
+	std::vector<ImpactKernel, aligned_allocator<ImpactKernel>> impactKernels;
+	makePointImpactKernels(index, altitude, heading, 0, impactKernels, impactAngles, impactVelocities);
+	for (auto& kernel : impactKernels)
+	{
+		impactPDFs.emplace_back(std::move(kernel.pdf));
+	}
+}
+
+void ugr::risk::RiskMap::makePointImpactKernels(
+	const Index& index,
+	const double altitude,
+	const int heading,
+	const double nSigma,
+	std::vector<ImpactKernel, aligned_allocator<ImpactKernel>>& impactKernels,
+	std::vector<GridMapDataType>& impactAngles,
+	std::vector<GridMapDataType>& impactVelocities) const
+{
+	std::vector<ImpactDistribution, aligned_allocator<ImpactDistribution>> impactDistributions;
+	fitPointImpactDistributions(index, altitude, heading, impactDistributions, impactAngles, impactVelocities);
+
+	for (const auto& distParams : impactDistributions)
+	{
+		// Fit 2D gaussian kernels to the descent model samples instead of
+		// propagating the samples all the way to strike risk. This should account
+		// for a more accurate probabilistic picture of the risk.
+
+		// The PDF at cell (x,y) is the gaussian evaluated at (x+1,y) in line with the
+		// inverted x axes convention of the evaluation grid, so the window is shifted to match
+		int xMin = 0, yMin = 0, xMax = sizeX - 1, yMax = sizeY - 1;
+		if (nSigma > 0)
+		{
+			const auto support = util::gaussian2DSupport(distParams.means, distParams.cov, nSigma);
+			if (std::all_of(support.begin(), support.end(), [](const double b) { return std::isfinite(b); }))
+			{
+				xMin = static_cast<int>(std::max(std::floor(support[0]) - 1, 0.0));
+				yMin = static_cast<int>(std::max(std::floor(support[1]), 0.0));
+				xMax = static_cast<int>(std::min(std::ceil(support[2]) - 1, static_cast<double>(sizeX - 1)));
+				yMax = static_cast<int>(std::min(std::ceil(support[3]), static_cast<double>(sizeY - 1)));
+			}
+		}
+		// The window can be empty if the impact distribution lies entirely outside the map. Empty
+		// windows are anchored at the map origin, so blocks of the map at the window stay valid
+		int windowX = std::max(xMax - xMin + 1, 0);
+		int windowY = std::max(yMax - yMin + 1, 0);
+		if (windowX == 0 || windowY == 0)
+		{
+			xMin = yMin = windowX = windowY = 0;
+		}
+
+		ImpactKernel kernel;
+		kernel.origin = { xMin, yMin };
+		kernel.pdf = evalImpactDistribution(distParams, xMin, yMin, windowX, windowY);
+
+		// Turn fitted impact risk gaussians into PDFs that we can use.
+		// If none of the probability mass lies on the map then there is no impact risk on it either
+		const double pdfSum = kernel.pdf.sum();
+		if (pdfSum > 0)
+		{
+			kernel.pdf /= static_cast<GridMapDataType>(pdfSum);
+		}
+		else
+		{
+			kernel.pdf.setZero();
+		}
+		impactKernels.emplace_back(std::move(kernel));
+	}
+}
+
+ugr::gridmap::Matrix ugr::risk::RiskMap::evalImpactDistribution(const ImpactDistribution& distParams,
+	const int xMin, const int yMin, const int windowX, const int windowY)
+{
+	// Row major so each coordinate is contiguous for the vectorised evaluation
+	Eigen::Matrix<GridMapDataType, 2, Dynamic, RowMajor> windowEvalMat(2, windowX * windowY);
+	for (int x = 0, i = 0; x < windowX; ++x)
+	{
+		for (int y = 0; y < windowY; ++y, ++i)
+		{
+			windowEvalMat(0, i) = static_cast<GridMapDataType>(xMin + x + 1);
+			windowEvalMat(1, i) = static_cast<GridMapDataType>(yMin + y);
+		}
+	}
+	// The evaluation points are in the same order as the row major storage of the PDF,
+	// so the PDF can be written to directly
+	Matrix pdf(windowX, windowY);
+	util::gaussian2DPDF(distParams.means, distParams.cov, windowEvalMat,
+		Eigen::Map<Eigen::Vector<GridMapDataType, Dynamic>>(pdf.data(), pdf.size()));
+	return pdf;
+}
+
+void ugr::risk::RiskMap::fitPointImpactDistributions(
+	const Index& index,
+	const double altitude,
+	const int heading,
+	std::vector<ImpactDistribution, aligned_allocator<ImpactDistribution>>& impactDistributions,
+	std::vector<GridMapDataType>& impactAngles,
+	std::vector<GridMapDataType>& impactVelocities) const
+{
+	const auto windVelX = at(windVelXLayer, index);
+	const auto windVelY = at(windVelYLayer, index);
 
 	// Create samples of state distributions
 	const auto& lateralVel = sqrt(pow(aircraftModel.state.velocity(0), 2) +
 		pow(aircraftModel.state.velocity(1), 2));
 	const auto& verticalVel = aircraftModel.state.velocity(2);
-	auto altDist = std::normal_distribution<double>(altitude, 2);
-	auto lateralVelDist = std::normal_distribution<double>(lateralVel, 0.5);
-	auto verticalVelDist = std::normal_distribution<double>(verticalVel, 0.5);
-
-	// Generate random variable samples for LoC states
-	std::vector<double> altVect(nSamples);
-	std::vector<double> lateralVelVect(nSamples);
-	std::vector<double> verticalVelVect(nSamples);
-	std::vector<Rotation2Dd, aligned_allocator<Rotation2Dd>> headingVect(nSamples);
+
+	// Every cell has its own stream, so the samples only depend on the seed and the cell,
+	// not on which thread evaluates it or in what order
+	const uint64_t streamId = (static_cast<uint64_t>(static_cast<uint32_t>(index.x())) << 32)
+		| static_cast<uint32_t>(index.y());
+	util::RandomStream stream(seed, streamId);
+
+	// Generate random variable samples for LoC states in one batch.
+	// Columns are altitude, lateral velocity, vertical velocity, wind x, wind y and heading
+	Eigen::Array<double, nSamples, 6> stateSamples;
+	stream.normal(stateSamples.leftCols<5>().reshaped());
 	if (heading < 0)
 	{
 		// Use uniformly distributed headings
-		auto headingUniformDist =
-			std::uniform_real_distribution<double>(DEG2RAD(0), DEG2RAD(360));
-		for (size_t i = 0; i < nSamples; ++i)
-		{
-			altVect[i] = std::abs(altDist(generator));
-			lateralVelVect[i] = lateralVelDist(generator);
-			verticalVelVect[i] = verticalVelDist(generator);
-			windVect[i] = { windXVelDist(generator), windYVelDist(generator) };
-			headingVect[i] = Rotation2Dd(util::bearing2Angle(headingUniformDist(generator)));
-
-		}
+		stream.uniform(stateSamples.col(5), DEG2RAD(0), DEG2RAD(360));
 	}
 	else
 	{
 		// Use actual heading with normal distribution
-		auto headingNormalDist = std::normal_distribution<double>(
-			DEG2RAD(heading % 360), DEG2RAD(5));
-		for (size_t i = 0; i < nSamples; ++i)
-		{
-			altVect[i] = std::abs(altDist(generator));
-			lateralVelVect[i] = lateralVelDist(generator);
-			verticalVelVect[i] = verticalVelDist(generator);
-			windVect[i] = { windXVelDist(generator), windYVelDist(generator) };
-			headingVect[i] = Rotation2Dd(util::bearing2Angle(headingNormalDist(generator)));
-		}
+		stream.normal(stateSamples.col(5));
+		stateSamples.col(5) = stateSamples.col(5) * DEG2RAD(5) + DEG2RAD(heading % 360);
+	}
+	stateSamples.col(0) = (stateSamples.col(0) * 2 + altitude).abs();
+	stateSamples.col(1) = stateSamples.col(1) * 0.5 + lateralVel;
+	stateSamples.col(2) = stateSamples.col(2) * 0.5 + verticalVel;
+	stateSamples.col(3) = stateSamples.col(3) * 0.5 + windVelX;
+	stateSamples.col(4) = stateSamples.col(4) * 0.5 + windVelY;
+
+	const std::vector<double> altVect(stateSamples.col(0).begin(), stateSamples.col(0).end());
+	const std::vector<double> lateralVelVect(stateSamples.col(1).begin(), stateSamples.col(1).end());
+	const std::vector<double> verticalVelVect(stateSamples.col(2).begin(), stateSamples.col(2).end());
+	std::vector<Vector2d, aligned_allocator<Vector2d>> windVect(nSamples);
+	std::vector<Rotation2Dd, aligned_allocator<Rotation2Dd>> headingVect(nSamples);
+	for (int i = 0; i < nSamples; ++i)
+	{
+		windVect[i] = { stateSamples(i, 3), stateSamples(i, 4) };
+		headingVect[i] = Rotation2Dd(util::bearing2Angle(stateSamples(i, 5)));
 	}
 
 
@@ -339,25 +604,7 @@ void ugr::risk::RiskMap::makePointImpactMap(
 		const auto distParams =
 			util::fitGaussianParams<float, 2, nSamples>(impactSampleMat);
 
-		// Matrix impactPDFGrid = util::gaussian2D(evalXs, evalYs,
-		// distParams).reshaped<RowMajor>(sizeX, sizeY);
-
-		// Fit 2D gaussian kernels to the descent model samples instead of
-		// propagating the samples all the way to strike risk. This should account
-		// for a more accurate probabilistic picture of the risk.
-
-//		std::cout << "covs " << distParams.cov << "\n";
-		const Matrix impactPDFGrid = util::gaussianND(distParams.means, distParams.cov,
-			evalMat.cast<GridMapDataType>())
-			.reshaped<RowMajor>(sizeX, sizeY);
-		const double pdfSum = impactPDFGrid.sum();
-
-		// Turn fitted impact risk gaussians into PDFs that we can use.
-		// Work these out first to avoid aliasing Eigen expressions
-
-		Matrix normImpactPDFGrid = impactPDFGrid / pdfSum;
-		normImpactPDFGrid.colwise().reverseInPlace();
-		impactPDFs.emplace_back(normImpactPDFGrid);
+		impactDistributions.push_back({ distParams.means, distParams.cov });
 
 		// descentDistrParams.emplace_back(distParams);
 		impactAngles.emplace_back(impactAngle / nSamples);
@@ -11,7 +11,12 @@ void ugr::risk::ObstacleMap::addBuildingHeights()
 void ugr::risk::ObstacleMap::eval()
 {
     if (isEvaluated) return;
-    mapping::GridMapOSMBuildingsHandler handler(this);
-    OSMMap::eval(handler);
-    isEvaluated = true;
+    mapping::osm::OSMSession session;
+    session.addMap(*this);
+    session.eval();
+}
+
+std::unique_ptr<ugr::mapping::osm::OSMEntityHandler> ugr::risk::ObstacleMap::makeSessionHandler()
+{
+    return mapping::osm::makeEntityHandler<mapping::GridMapOSMBuildingsHandler>(this);
 }
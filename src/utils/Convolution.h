@@ -0,0 +1,150 @@
+/*
+ * Convolution.h
+ */
+
+#ifndef UASGROUNDRISK_SRC_UTILS_CONVOLUTION_H_
+#define UASGROUNDRISK_SRC_UTILS_CONVOLUTION_H_
+
+#include <Eigen/Core>
+#include <unsupported/Eigen/FFT>
+#include <algorithm>
+#include <complex>
+
+namespace ugr
+{
+	namespace util
+	{
+		/**
+		 * Find the smallest size >= n that only has prime factors of 2, 3 and 5.
+		 * FFTs of these sizes are considerably faster than those of arbitrary sizes.
+		 * @param n the minimum size
+		 * @return the FFT friendly size
+		 */
+		static int nextFastFFTSize(const int n)
+		{
+			for (int size = std::max(n, 1);; ++size)
+			{
+				int rem = size;
+				for (const int factor : { 2, 3, 5 })
+				{
+					while (rem % factor == 0)
+					{
+						rem /= factor;
+					}
+				}
+				if (rem == 1)
+				{
+					return size;
+				}
+			}
+		}
+
+		/**
+		 * Cross-correlate 2D images of a fixed size with a fixed kernel using FFTs.
+		 *
+		 * The kernel is anchored with an origin offset, such that kernel coefficient (a,b)
+		 * corresponds to the image offset (a + originX, b + originY) from the output cell.
+		 * The output at (i,j) is then
+		 * 	sum_{a,b} kernel(a,b) * image(i + a + originX, j + b + originY)
+		 * with the image taken to be zero outside of its bounds.
+		 *
+		 * The kernel spectrum is computed once on construction, so repeated correlations
+		 * only cost a forward and inverse transform of the image each.
+		 */
+		class FFTCorrelator2D
+		{
+		 public:
+			/**
+			 * @param kernel the correlation kernel
+			 * @param originX the image row offset of the first kernel row. Can be negative
+			 * @param originY the image column offset of the first kernel column. Can be negative
+			 * @param imageRows the number of rows of the images to correlate
+			 * @param imageCols the number of columns of the images to correlate
+			 */
+			FFTCorrelator2D(const Eigen::MatrixXd& kernel, const int originX, const int originY,
+				const int imageRows, const int imageCols)
+				: imageRows(imageRows), imageCols(imageCols),
+				  kernelRows(static_cast<int>(kernel.rows())), kernelCols(static_cast<int>(kernel.cols())),
+				  originX(originX), originY(originY),
+				  // The linear convolution must fit in the padded size to prevent wraparound
+				  padRows(nextFastFFTSize(imageRows + kernelRows - 1)),
+				  padCols(nextFastFFTSize(imageCols + kernelCols - 1))
+			{
+				// Correlation is convolution with the reversed kernel
+				kernelSpectrum.setZero(padRows, padCols);
+				kernelSpectrum.topLeftCorner(kernelRows, kernelCols) =
+					kernel.reverse().cast<std::complex<double>>();
+				fft2D(kernelSpectrum, false);
+			}
+
+			/**
+			 * Cross-correlate an image with the kernel.
+			 * @param image the image of size imageRows x imageCols
+			 * @return the correlation of the same size as the image
+			 */
+			template<typename Derived>
+			Eigen::MatrixXd correlate(const Eigen::MatrixBase<Derived>& image) const
+			{
+				eigen_assert(image.rows() == imageRows && image.cols() == imageCols);
+
+				Eigen::MatrixXcd spectrum;
+				spectrum.setZero(padRows, padCols);
+				spectrum.topLeftCorner(imageRows, imageCols) = image.template cast<double>()
+					.template cast<std::complex<double>>();
+				fft2D(spectrum, false);
+				spectrum.array() *= kernelSpectrum.array();
+				fft2D(spectrum, true);
+
+				// Output cell i sits at i + origin + kernel size - 1 in the full linear convolution.
+				// Anything outside of the full convolution has no overlap with the image at all.
+				Eigen::MatrixXd out;
+				out.setZero(imageRows, imageCols);
+				const int shiftX = originX + kernelRows - 1;
+				const int shiftY = originY + kernelCols - 1;
+				const int fullRows = imageRows + kernelRows - 1;
+				const int fullCols = imageCols + kernelCols - 1;
+				const int iMin = std::max(0, -shiftX);
+				const int iMax = std::min(imageRows, fullRows - shiftX);
+				const int jMin = std::max(0, -shiftY);
+				const int jMax = std::min(imageCols, fullCols - shiftY);
+				if (iMax > iMin && jMax > jMin)
+				{
+					out.block(iMin, jMin, iMax - iMin, jMax - jMin) =
+						spectrum.block(iMin + shiftX, jMin + shiftY, iMax - iMin, jMax - jMin).real();
+				}
+				return out;
+			}
+
+		 private:
+			int imageRows, imageCols;
+			int kernelRows, kernelCols;
+			int originX, originY;
+			int padRows, padCols;
+			Eigen::MatrixXcd kernelSpectrum;
+
+			/**
+			 * In place 2D FFT as 1D FFTs of each column then each row
+			 */
+			static void fft2D(Eigen::MatrixXcd& data, const bool inverse)
+			{
+				// Kiss FFT plans are cached per instance, so keep a local instance for thread safety
+				Eigen::FFT<double> fft;
+				Eigen::VectorXcd in, out;
+				for (Eigen::Index c = 0; c < data.cols(); ++c)
+				{
+					in = data.col(c);
+					inverse ? fft.inv(out, in) : fft.fwd(out, in);
+					data.col(c) = out;
+				}
+				for (Eigen::Index r = 0; r < data.rows(); ++r)
+				{
+					in = data.row(r).transpose();
+					inverse ? fft.inv(out, in) : fft.fwd(out, in);
+					data.row(r) = out.transpose();
+				}
+			}
+		};
+	} // namespace util
+} // namespace ugr
+
+#endif // UASGROUNDRISK_SRC_UTILS_CONVOLUTION_H_
@@ -8,6 +8,7 @@
 #define UASGROUNDRISK_SRC_UTILS_MATHS_DATAFITTING_H_
 
 #include <Eigen/Core>
+#include <Eigen/LU>
 #include <Eigen/QR>
 #include <Eigen/StdVector>
 #include <cmath>
@@ -17,6 +18,8 @@
 #include <vector>
 #include <numeric>
 #include <cfenv>
+#include <array>
+#include <algorithm>
 
 #define SQRT2PI 2.50662827463
 
@@ -42,6 +45,69 @@ namespace ugr
 			}
 		};
 
+		/**
+		 * Evaluate a 2D Gaussian PDF at a set of positions, writing the densities into a caller
+		 * provided buffer. The inverse covariance and normalisation are only computed once and
+		 * positions are evaluated in fixed size blocks with Eigen's vectorised exp, so this does
+		 * not allocate. Row major positions allow contiguous loads of each coordinate.
+		 *
+		 * Densities with an exponent below -102 are flushed to zero, as they cannot be
+		 * represented as a float anyway. Otherwise the relative error is that of the single
+		 * precision exp, around 1e-7 * |exponent|.
+		 * @param means the 2D mean vector
+		 * @param cov the 2x2 covariance matrix
+		 * @param pos 2xN matrix of positions to evaluate, one per column
+		 * @param out vector of size N to write the densities to
+		 */
+		template<typename MeansDerived, typename CovDerived, typename PosDerived, typename OutDerived>
+		static void gaussian2DPDF(
+			const Eigen::MatrixBase<MeansDerived>& means,
+			const Eigen::MatrixBase<CovDerived>& cov,
+			const Eigen::MatrixBase<PosDerived>& pos,
+			const Eigen::MatrixBase<OutDerived>& out)
+		{
+			typedef typename OutDerived::Scalar Type;
+			eigen_assert(pos.rows() == 2 && out.size() == pos.cols());
+			// Eigen parameters are const so the output expression has to be cast back
+			auto& outVec = const_cast<Eigen::MatrixBase<OutDerived>&>(out);
+
+			// Work these out in double precision as near singular covariances are common
+			const Eigen::Matrix2d covD = cov.template cast<double>();
+			const Eigen::Matrix2d covInv = covD.inverse();
+			const Type norm = static_cast<Type>(std::pow(SQRT2PI, -2) * std::pow(std::abs(covD.determinant()), -0.5));
+
+			// Expand -0.5 * d^T covInv d into its quadratic coefficients
+			const Type cxx = static_cast<Type>(-0.5 * covInv(0, 0));
+			const Type cxy = static_cast<Type>(-0.5 * (covInv(0, 1) + covInv(1, 0)));
+			const Type cyy = static_cast<Type>(-0.5 * covInv(1, 1));
+			const Type mx = static_cast<Type>(means(0));
+			const Type my = static_cast<Type>(means(1));
+
+			// Eigen cannot vectorise select(), so the exponents of each block are kept to flush
+			// the tails to zero after the vectorised exp
+			constexpr Eigen::Index blockSize = 256;
+			Eigen::Array<Type, blockSize, 1> exponentBlock;
+			for (Eigen::Index start = 0; start < pos.cols(); start += blockSize)
+			{
+				const Eigen::Index len = std::min(blockSize, pos.cols() - start);
+				auto halfNegQuadform = exponentBlock.head(len);
+				const auto dx = pos.row(0).segment(start, len).transpose().template cast<Type>().array() - mx;
+				const auto dy = pos.row(1).segment(start, len).transpose().template cast<Type>().array() - my;
+				halfNegQuadform = cxx * dx.square() + cxy * dx * dy + cyy * dy.square();
+
+				auto outBlock = outVec.segment(start, len).array();
+				outBlock = norm * halfNegQuadform.exp();
+				for (Eigen::Index i = 0; i < len; ++i)
+				{
+					// exp(-103) is already ~1e-45. Smaller than this cannot be represented as a float
+					if (halfNegQuadform(i) < -102)
+					{
+						outBlock(i) = 0;
+					}
+				}
+			}
+		}
+
 		template<typename MeansDerived, typename CovDerived, typename SamplesDerived>
 		static Eigen::VectorXf gaussianND(
 			const Eigen::MatrixBase<MeansDerived>& means,
@@ -51,15 +117,32 @@ namespace ugr
 			typedef typename SamplesDerived::Scalar Type;
 			const int NDimensions = means.rows();
 
-			//TODO vectorise this, using something like colwise()?
 			Eigen::Vector<Type, Eigen::Dynamic> out;
 			out.resize(pos.cols());
 
+			// Only instantiate the 2D specialisation for inputs that can be 2D, so fixed size inputs of
+			// other dimensions still compile
+			if constexpr (MeansDerived::RowsAtCompileTime == 2)
+			{
+				gaussian2DPDF(means, cov, pos, out);
+				return out;
+			}
+			else if constexpr (MeansDerived::RowsAtCompileTime == Eigen::Dynamic)
+			{
+				if (NDimensions == 2)
+				{
+					gaussian2DPDF(means.template head<2>(), cov.template topLeftCorner<2, 2>(),
+					              pos.template topRows<2>(), out);
+					return out;
+				}
+			}
+
 			const double norm = std::pow(SQRT2PI, -NDimensions) * std::pow(std::abs(cov.determinant()), -0.5);
+			const Eigen::Matrix<typename CovDerived::Scalar, Eigen::Dynamic, Eigen::Dynamic> covInv = cov.inverse();
 
 			for (int i = 0; i < pos.cols(); ++i)
 			{
-				const double quadform = (pos.col(i) - means).transpose() * cov.inverse() * (pos.col(i) - means);
+				const double quadform = (pos.col(i) - means).transpose() * covInv * (pos.col(i) - means);
 				const double halfNegQuadform = -0.5 * quadform;
 				// exp(-103) is already ~1e-45. Smaller than this cannot be represented as a float
 				if (halfNegQuadform < -102)
@@ -71,7 +154,31 @@ namespace ugr
 					out(i) = norm * std::exp(halfNegQuadform);
 				}
 			}
-			return std::move(out);
+			return out;
+		}
+
+		/**
+		 * Return the axis aligned bounding box of the region within nSigma standard deviations
+		 * (Mahalanobis distance) of the mean of a 2D Gaussian. Outside of this box the density is
+		 * at most exp(-nSigma^2 / 2) of the peak density.
+		 * @param means the 2D mean vector
+		 * @param cov the 2x2 covariance matrix
+		 * @param nSigma the number of standard deviations to include
+		 * @return {xMin, yMin, xMax, yMax} bounds of the support
+		 */
+		template<typename MeansDerived, typename CovDerived>
+		static std::array<double, 4> gaussian2DSupport(
+			const Eigen::MatrixBase<MeansDerived>& means,
+			const Eigen::MatrixBase<CovDerived>& cov,
+			const double nSigma)
+		{
+			// The extent of the nSigma ellipse along each axis only depends on the marginal variance
+			const double halfWidthX = nSigma * std::sqrt(std::abs(static_cast<double>(cov(0, 0))));
+			const double halfWidthY = nSigma * std::sqrt(std::abs(static_cast<double>(cov(1, 1))));
+			return {
+				means(0) - halfWidthX, means(1) - halfWidthY,
+				means(0) + halfWidthX, means(1) + halfWidthY
+			};
 		}
 
 		template<typename Type, int Dimensions, int Samples = Eigen::Dynamic>
@@ -0,0 +1,138 @@
+/*
+ * MappedFile.h
+ */
+
+#ifndef UASGROUNDRISK_SRC_UTILS_MAPPEDFILE_H_
+#define UASGROUNDRISK_SRC_UTILS_MAPPEDFILE_H_
+
+#include <cstddef>
+#include <ios>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ugr
+{
+	namespace util
+	{
+		/**
+		 * A whole file mapped read only into memory. Pages are loaded by the OS on first access,
+		 * so opening is near instant regardless of the file size.
+		 */
+		class MappedFile
+		{
+		 public:
+			/**
+			 * @param path the path of the file to map
+			 * @throws std::ios_base::failure if the file cannot be opened or mapped
+			 */
+			explicit MappedFile(const std::string& path)
+			{
+#ifdef _WIN32
+				file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+					FILE_ATTRIBUTE_NORMAL, nullptr);
+				if (file == INVALID_HANDLE_VALUE)
+				{
+					throw std::ios_base::failure("Cannot open file for mapping at: " + path);
+				}
+				LARGE_INTEGER fileSize;
+				if (!GetFileSizeEx(file, &fileSize))
+				{
+					CloseHandle(file);
+					throw std::ios_base::failure("Cannot read size of file at: " + path);
+				}
+				length = static_cast<size_t>(fileSize.QuadPart);
+				if (length > 0)
+				{
+					mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+					if (mapping != nullptr)
+					{
+						ptr = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+					}
+					if (ptr == nullptr)
+					{
+						if (mapping != nullptr) CloseHandle(mapping);
+						CloseHandle(file);
+						throw std::ios_base::failure("Cannot map file at: " + path);
+					}
+				}
+#else
+				const int fd = open(path.c_str(), O_RDONLY);
+				if (fd < 0)
+				{
+					throw std::ios_base::failure("Cannot open file for mapping at: " + path);
+				}
+				struct stat fileStat{};
+				if (fstat(fd, &fileStat) != 0)
+				{
+					close(fd);
+					throw std::ios_base::failure("Cannot read size of file at: " + path);
+				}
+				length = static_cast<size_t>(fileStat.st_size);
+				if (length > 0)
+				{
+					void* addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+					if (addr == MAP_FAILED)
+					{
+						close(fd);
+						throw std::ios_base::failure("Cannot map file at: " + path);
+					}
+					ptr = static_cast<const char*>(addr);
+				}
+				// The mapping stays valid after the descriptor is closed
+				close(fd);
+#endif
+			}
+
+			~MappedFile()
+			{
+#ifdef _WIN32
+				if (ptr != nullptr) UnmapViewOfFile(ptr);
+				if (mapping != nullptr) CloseHandle(mapping);
+				CloseHandle(file);
+#else
+				if (ptr != nullptr) munmap(const_cast<char*>(ptr), length);
+#endif
+			}
+
+			MappedFile(const MappedFile& other) = delete;
+			MappedFile& operator=(const MappedFile& other) = delete;
+
+			/**
+			 * @return the start of the file contents, or null for an empty file
+			 */
+			const char* data() const
+			{
+				return ptr;
+			}
+
+			/**
+			 * @return the size of the file in bytes
+			 */
+			size_t size() const
+			{
+				return length;
+			}
+
+		 private:
+			const char* ptr = nullptr;
+			size_t length = 0;
+#ifdef _WIN32
+			HANDLE file = INVALID_HANDLE_VALUE;
+			HANDLE mapping = nullptr;
+#endif
+		};
+	} // namespace util
+} // namespace ugr
+
+#endif // UASGROUNDRISK_SRC_UTILS_MAPPEDFILE_H_
@@ -0,0 +1,157 @@
+/*
+ * RandomStreams.h
+ */
+
+#ifndef UASGROUNDRISK_SRC_UTILS_RANDOMSTREAMS_H_
+#define UASGROUNDRISK_SRC_UTILS_RANDOMSTREAMS_H_
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+namespace ugr
+{
+	namespace util
+	{
+		/**
+		 * The Philox4x32-10 counter based random number generator of Salmon et al.,
+		 * "Parallel Random Numbers: As Easy as 1, 2, 3" (SC11).
+		 *
+		 * Each (counter, key) pair maps to four independent 32 bit random numbers, so any
+		 * number of streams can be created without shared state by giving each a different key
+		 * or counter range.
+		 */
+		class Philox4x32
+		{
+		 public:
+			typedef std::array<uint32_t, 4> Counter;
+			typedef std::array<uint32_t, 2> Key;
+
+			/**
+			 * Generate the random block for a counter and key
+			 * @param counter the 128 bit counter
+			 * @param key the 64 bit key
+			 * @return four 32 bit random numbers
+			 */
+			static Counter block(Counter counter, Key key)
+			{
+				for (int round = 0; round < 10; ++round)
+				{
+					if (round > 0)
+					{
+						key[0] += 0x9E3779B9;
+						key[1] += 0xBB67AE85;
+					}
+					const uint64_t product0 = static_cast<uint64_t>(0xD2511F53) * counter[0];
+					const uint64_t product1 = static_cast<uint64_t>(0xCD9E8D57) * counter[2];
+					counter = {
+						static_cast<uint32_t>(product1 >> 32) ^ counter[1] ^ key[0],
+						static_cast<uint32_t>(product1),
+						static_cast<uint32_t>(product0 >> 32) ^ counter[3] ^ key[1],
+						static_cast<uint32_t>(product0)
+					};
+				}
+				return counter;
+			}
+		};
+
+		/**
+		 * An independent, reproducible stream of random numbers identified by a seed and a
+		 * stream ID. Streams with the same seed and ID always produce the same sequence, no
+		 * matter which thread they are used from or what other streams have been used.
+		 */
+		class RandomStream
+		{
+		 public:
+			/**
+			 * @param seed the user seed, used as the Philox key
+			 * @param streamId the stream ID, used as the upper half of the Philox counter
+			 */
+			RandomStream(const uint64_t seed, const uint64_t streamId)
+				: key{ static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32) },
+				  counter{ 0, 0, static_cast<uint32_t>(streamId), static_cast<uint32_t>(streamId >> 32) }
+			{
+			}
+
+			/**
+			 * @return the next 32 bit random number in the stream
+			 */
+			uint32_t nextUInt()
+			{
+				if (bufferPos == 4)
+				{
+					buffer = Philox4x32::block(counter, key);
+					bufferPos = 0;
+					// The lower 64 bits of the counter index blocks within the stream
+					if (++counter[0] == 0)
+					{
+						++counter[1];
+					}
+				}
+				return buffer[bufferPos++];
+			}
+
+			/**
+			 * @return a uniformly distributed number in the open interval (0,1)
+			 */
+			double uniform()
+			{
+				return (static_cast<double>(nextUInt()) + 0.5) * (1.0 / 4294967296.0);
+			}
+
+			/**
+			 * Fill an array with uniformly distributed numbers in the open interval (lower, upper)
+			 */
+			template<typename Derived>
+			void uniform(const Eigen::DenseBase<Derived>& out, const double lower = 0, const double upper = 1)
+			{
+				auto& outArr = const_cast<Eigen::DenseBase<Derived>&>(out);
+				for (Eigen::Index i = 0; i < outArr.size(); ++i)
+				{
+					outArr(i) = static_cast<typename Derived::Scalar>(lower + (upper - lower) * uniform());
+				}
+			}
+
+			/**
+			 * Fill an array with standard normally distributed numbers. These are generated in
+			 * blocks with the Box-Muller transform, so the transcendental functions are vectorised.
+			 */
+			template<typename Derived>
+			void normal(const Eigen::DenseBase<Derived>& out)
+			{
+				auto& outArr = const_cast<Eigen::DenseBase<Derived>&>(out);
+				constexpr Eigen::Index blockPairs = 64;
+				Eigen::Array<double, blockPairs, 1> radii, angles;
+				for (Eigen::Index start = 0; start < outArr.size(); start += 2 * blockPairs)
+				{
+					const Eigen::Index len = std::min(2 * blockPairs, outArr.size() - start);
+					const Eigen::Index pairs = (len + 1) / 2;
+					for (Eigen::Index i = 0; i < pairs; ++i)
+					{
+						radii(i) = uniform();
+						angles(i) = uniform();
+					}
+					radii.head(pairs) = (-2 * radii.head(pairs).log()).sqrt();
+					angles.head(pairs) *= 2 * 3.14159265358979323846;
+
+					// Each pair gives two independent normals, the second of which is dropped for an odd tail
+					const Eigen::Index sinLen = len - pairs;
+					outArr.segment(start, pairs) = (radii.head(pairs) * angles.head(pairs).cos())
+						.template cast<typename Derived::Scalar>();
+					outArr.segment(start + pairs, sinLen) = (radii.head(sinLen) * angles.head(sinLen).sin())
+						.template cast<typename Derived::Scalar>();
+				}
+			}
+
+		 private:
+			Philox4x32::Key key;
+			Philox4x32::Counter counter;
+			Philox4x32::Counter buffer{};
+			int bufferPos = 4;
+		};
+	} // namespace util
+} // namespace ugr
+
+#endif // UASGROUNDRISK_SRC_UTILS_RANDOMSTREAMS_H_
@@ -150,6 +150,119 @@ TEST(DataFittingTests, Gaussian2DFitTest)
 //    ASSERT_NEAR(res(2), 1.59154e-1, 1e-6);
 //}
 
+TEST(DataFittingTests, Gaussian2DSupportTest)
+{
+    Vector2f means(50, 50);
+    Matrix2f cov;
+    cov << 25, 5,
+        5, 16;
+
+    const auto support = ugr::util::gaussian2DSupport(means, cov, 5);
+    ASSERT_NEAR(support[0], 25, 1e-4);
+    ASSERT_NEAR(support[1], 30, 1e-4);
+    ASSERT_NEAR(support[2], 75, 1e-4);
+    ASSERT_NEAR(support[3], 70, 1e-4);
+
+    constexpr int size = 100;
+    Eigen::Matrix<float, 2, Eigen::Dynamic> pos(2, size * size);
+    for (int x = 0, i = 0; x < size; ++x)
+    {
+        for (int y = 0; y < size; ++y, ++i)
+        {
+            pos(0, i) = static_cast<float>(x);
+            pos(1, i) = static_cast<float>(y);
+        }
+    }
+    const MatrixXf pdf = ugr::util::gaussianND(means, cov, pos).reshaped<RowMajor>(size, size);
+
+    // Almost all of the probability mass must lie within the support window
+    const float windowSum = pdf.block(25, 30, 51, 41).sum();
+    ASSERT_NEAR(windowSum / pdf.sum(), 1, 1e-4);
+}
+
+TEST(DataFittingTests, Gaussian2DPDFTest)
+{
+    Vector2f means(10, -5);
+    Matrix2f cov;
+    cov << 9, -4,
+        -4, 6;
+
+    std::default_random_engine generator(42);
+    auto posDist = std::uniform_real_distribution<float>(-30, 30);
+
+    constexpr int N = 10000;
+    Eigen::Matrix<float, 2, Eigen::Dynamic, RowMajor> pos(2, N);
+    for (int i = 0; i < N; ++i)
+    {
+        pos(0, i) = posDist(generator);
+        pos(1, i) = posDist(generator);
+    }
+
+    // Write into a view of a larger buffer to make sure arbitrary expressions are handled
+    VectorXf buffer = VectorXf::Constant(N + 2, -1);
+    ugr::util::gaussian2DPDF(means, cov, pos, buffer.segment(1, N));
+    ASSERT_EQ(buffer(0), -1);
+    ASSERT_EQ(buffer(N + 1), -1);
+
+    // Compare against a scalar evaluation in double precision
+    const Matrix2d covInv = cov.cast<double>().inverse();
+    const double norm = 1 / (2 * M_PI * std::sqrt(cov.cast<double>().determinant()));
+    for (int i = 0; i < N; ++i)
+    {
+        const Vector2d d = pos.col(i).cast<double>() - means.cast<double>();
+        const double halfNegQuadform = -0.5 * d.transpose() * covInv * d;
+        const double expected = halfNegQuadform < -102 ? 0 : norm * std::exp(halfNegQuadform);
+        // Single precision evaluation of the exponent limits the relative accuracy for the far tails
+        ASSERT_NEAR(buffer(i + 1), expected, 1e-4 * expected + 1e-30) << "at position " << pos.col(i).transpose();
+    }
+
+    // The generic version must agree with the 2D specialisation
+    const VectorXf generic = ugr::util::gaussianND(means, cov, pos);
+    ASSERT_TRUE(generic.isApprox(buffer.segment(1, N)));
+}
+
+TEST(DataFittingTests, GaussianNDPDFTest)
+{
+    // Fixed size inputs of other dimensions than 2 are evaluated by the generic version
+    Vector3f means(1, -2, 0.5);
+    Matrix3f cov;
+    cov << 4, 1, 0,
+        1, 3, -0.5,
+        0, -0.5, 2;
+
+    std::default_random_engine generator(42);
+    auto posDist = std::uniform_real_distribution<float>(-5, 5);
+
+    constexpr int N = 100;
+    Eigen::Matrix<float, 3, Eigen::Dynamic> pos(3, N);
+    for (int i = 0; i < N; ++i)
+    {
+        for (int d = 0; d < 3; ++d)
+        {
+            pos(d, i) = posDist(generator);
+        }
+    }
+
+    const VectorXf pdf = ugr::util::gaussianND(means, cov, pos);
+    ASSERT_EQ(pdf.size(), N);
+    const Matrix3d covInv = cov.cast<double>().inverse();
+    const double norm = std::pow(2 * M_PI, -1.5) / std::sqrt(cov.cast<double>().determinant());
+    for (int i = 0; i < N; ++i)
+    {
+        const Vector3d d = pos.col(i).cast<double>() - means.cast<double>();
+        const double expected = norm * std::exp(-0.5 * d.transpose() * covInv * d);
+        ASSERT_NEAR(pdf(i), expected, 1e-4 * expected + 1e-30) << "at position " << pos.col(i).transpose();
+    }
+
+    // Dynamic size 2D inputs still use the 2D specialisation
+    const VectorXf means2 = means.head<2>();
+    const MatrixXf cov2 = cov.topLeftCorner<2, 2>();
+    const MatrixXf pos2 = pos.topRows<2>();
+    VectorXf specialised(N);
+    ugr::util::gaussian2DPDF(means2.head<2>(), cov2.topLeftCorner<2, 2>(), pos2, specialised);
+    ASSERT_TRUE(ugr::util::gaussianND(means2, cov2, pos2).isApprox(specialised));
+}
+
 TEST(DataFittingTests, LinAlgFitTest)
 {
     std::default_random_engine generator;
@@ -2,9 +2,125 @@
 #include <gtest/gtest.h>
 #include <proj.h>
 #include "../src/map_gen/census/Ingest.h"
+#include "../src/map_gen/census/CensusCache.h"
+#include "../src/map_gen/census/CensusIndex.h"
 #include "../src/utils/GeometryProjectionUtils.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <vector>
 
+namespace
+{
+    using Ring = std::vector<std::array<double, 2>>;
+
+    void writeBigEndian32(std::ofstream& out, const int32_t value)
+    {
+        const char bytes[4] = {
+            static_cast<char>(value >> 24), static_cast<char>(value >> 16), static_cast<char>(value >> 8),
+            static_cast<char>(value)
+        };
+        out.write(bytes, 4);
+    }
+
+    template <typename T>
+    void writeLittleEndian(std::ofstream& out, const T value)
+    {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void writeFileHeader(std::ofstream& out, const int32_t lengthBytes)
+    {
+        writeBigEndian32(out, 9994);
+        for (int i = 0; i < 5; ++i) writeBigEndian32(out, 0);
+        writeBigEndian32(out, lengthBytes / 2);
+        writeLittleEndian<int32_t>(out, 1000);
+        writeLittleEndian<int32_t>(out, 5);
+        for (int i = 0; i < 8; ++i) writeLittleEndian<double>(out, 0);
+    }
+
+    /**
+     * Write a polygon shapefile with a single 8 character attribute field
+     */
+    void writeShapefile(const std::string& basePath, const std::vector<std::pair<std::string, std::vector<Ring>>>& records)
+    {
+        std::ofstream shp(basePath + ".shp", std::ios::binary), shx(basePath + ".shx", std::ios::binary);
+        std::vector<int32_t> lengths;
+        for (const auto& record : records)
+        {
+            int32_t nPoints = 0;
+            for (const auto& ring : record.second) nPoints += static_cast<int32_t>(ring.size());
+            lengths.push_back(44 + 4 * static_cast<int32_t>(record.second.size()) + 16 * nPoints);
+        }
+        int32_t shpLength = 100;
+        for (const auto length : lengths) shpLength += 8 + length;
+        writeFileHeader(shp, shpLength);
+        writeFileHeader(shx, 100 + 8 * static_cast<int32_t>(records.size()));
+
+        int32_t offset = 100;
+        for (size_t i = 0; i < records.size(); ++i)
+        {
+            writeBigEndian32(shx, offset / 2);
+            writeBigEndian32(shx, lengths[i] / 2);
+            writeBigEndian32(shp, static_cast<int32_t>(i + 1));
+            writeBigEndian32(shp, lengths[i] / 2);
+            offset += 8 + lengths[i];
+
+            const auto& rings = records[i].second;
+            double minX = 1e9, minY = 1e9, maxX = -1e9, maxY = -1e9;
+            for (const auto& ring : rings)
+            {
+                for (const auto& point : ring)
+                {
+                    minX = std::min(minX, point[0]), maxX = std::max(maxX, point[0]);
+                    minY = std::min(minY, point[1]), maxY = std::max(maxY, point[1]);
+                }
+            }
+            writeLittleEndian<int32_t>(shp, 5);
+            for (const auto v : {minX, minY, maxX, maxY}) writeLittleEndian<double>(shp, v);
+            writeLittleEndian<int32_t>(shp, static_cast<int32_t>(rings.size()));
+            writeLittleEndian<int32_t>(shp, (lengths[i] - 44 - 4 * static_cast<int32_t>(rings.size())) / 16);
+            int32_t start = 0;
+            for (const auto& ring : rings)
+            {
+                writeLittleEndian<int32_t>(shp, start);
+                start += static_cast<int32_t>(ring.size());
+            }
+            for (const auto& ring : rings)
+            {
+                for (const auto& point : ring)
+                {
+                    writeLittleEndian<double>(shp, point[0]);
+                    writeLittleEndian<double>(shp, point[1]);
+                }
+            }
+        }
+
+        std::ofstream dbf(basePath + ".dbf", std::ios::binary);
+        constexpr int fieldLength = 8;
+        writeLittleEndian<uint8_t>(dbf, 3);
+        dbf.write("\0\0\0", 3);
+        writeLittleEndian<uint32_t>(dbf, static_cast<uint32_t>(records.size()));
+        writeLittleEndian<uint16_t>(dbf, 32 + 32 + 1);
+        writeLittleEndian<uint16_t>(dbf, 1 + fieldLength);
+        dbf.write(std::string(20, '\0').c_str(), 20);
+        char field[32] = "CODE";
+        field[11] = 'C';
+        field[16] = fieldLength;
+        dbf.write(field, 32);
+        dbf.put(0x0D);
+        for (const auto& record : records)
+        {
+            dbf.put(' ');
+            auto code = record.first;
+            code.resize(fieldLength, ' ');
+            dbf.write(code.c_str(), fieldLength);
+        }
+    }
+}
+
 class DataIngestTests : public testing::Test
 {
 public:
@@ -24,6 +140,40 @@ TEST_F(DataIngestTests, GeometryIngestTest)
     ASSERT_EQ(geoms.size(), 8348);
 }
 
+TEST_F(DataIngestTests, ShapefileBoundsIngestTest)
+{
+    const auto basePath = (std::filesystem::temp_directory_path() / "ugr_shapefile_test").string();
+    // Outer rings are clockwise and holes anticlockwise
+    const Ring square{{0, 0}, {0, 2}, {2, 2}, {2, 0}, {0, 0}};
+    const Ring hole{{0.5, 0.5}, {1.5, 0.5}, {1.5, 1.5}, {0.5, 1.5}, {0.5, 0.5}};
+    const Ring island{{3, 0}, {3, 1}, {4, 1}, {4, 0}, {3, 0}};
+    const Ring farSquare{{50, 50}, {50, 51}, {51, 51}, {51, 50}, {50, 50}};
+    writeShapefile(basePath, {{"E0000001", {square, hole, island}}, {"E0000002", {farSquare}}});
+
+    CensusGeometryIngest geomIngest(geosCtx);
+    auto geoms = geomIngest.readFile(basePath + ".shp");
+    ASSERT_EQ(geoms.size(), 2);
+    for (const auto& pair : geoms)
+    {
+        GEOSGeom_destroy_r(geosCtx, pair.second);
+    }
+
+    // Bounds are [S, W, N, E]
+    geoms = geomIngest.readFile(basePath + ".shp", {-1, -1, 1, 1});
+    ASSERT_EQ(geoms.size(), 1);
+    auto* ward = geoms.at("E0000001");
+    ASSERT_EQ(GEOSGeomTypeId_r(geosCtx, ward), GEOS_MULTIPOLYGON);
+    double area;
+    GEOSArea_r(geosCtx, ward, &area);
+    ASSERT_DOUBLE_EQ(area, 4 - 1 + 1);
+    GEOSGeom_destroy_r(geosCtx, ward);
+
+    for (const auto* extension : {".shp", ".shx", ".dbf"})
+    {
+        std::remove((basePath + extension).c_str());
+    }
+}
+
 TEST_F(DataIngestTests, DensityIngestTest)
 {
     CensusDensityIngest densityIngest(geosCtx);
@@ -48,3 +198,136 @@ TEST_F(DataIngestTests, MergedIngestTest)
 
     ASSERT_EQ(out.size(), 8331);
 }
+
+TEST_F(DataIngestTests, CensusCacheTest)
+{
+    const auto dir = std::filesystem::temp_directory_path();
+    const auto sourcePath = (dir / "ugr_census_cache_source.csv").string();
+    const auto cachePath = (dir / "ugr_census_cache_test.ugrcensus").string();
+    std::remove(cachePath.c_str());
+    std::ofstream(sourcePath) << "code,population,area,density";
+
+    // Two small wards and one spanning several tiles
+    std::map<GEOSGeometry*, double> geomDensityMap{
+        {GEOSGeom_createRectangle_r(geosCtx, 0, 0, 1, 1), 10},
+        {GEOSGeom_createRectangle_r(geosCtx, 5, 5, 6, 6), 20},
+        {GEOSGeom_createRectangle_r(geosCtx, 0.5, 0.5, 5.5, 0.9), 30},
+    };
+    ASSERT_FALSE(CensusCache::isFresh(cachePath, {sourcePath}));
+    CensusCache::write(cachePath, geomDensityMap, geosCtx);
+    ASSERT_TRUE(CensusCache::isFresh(cachePath, {sourcePath}));
+    for (const auto& pair : geomDensityMap)
+    {
+        GEOSGeom_destroy_r(geosCtx, pair.first);
+    }
+
+    const CensusCache cache(cachePath);
+    ASSERT_EQ(cache.size(), 3);
+
+    // Bounds are [S, W, N, E]
+    auto wards = cache.load<double>({0.2, 0.2, 0.4, 0.4}, geosCtx);
+    ASSERT_EQ(wards.size(), 1);
+    ASSERT_EQ(wards.begin()->second, 10);
+    double area;
+    GEOSArea_r(geosCtx, wards.begin()->first, &area);
+    ASSERT_DOUBLE_EQ(area, 1);
+    for (const auto& pair : wards)
+    {
+        GEOSGeom_destroy_r(geosCtx, pair.first);
+    }
+
+    wards = cache.load<double>({0.6, 2, 0.8, 3}, geosCtx);
+    ASSERT_EQ(wards.size(), 1);
+    ASSERT_EQ(wards.begin()->second, 30);
+    for (const auto& pair : wards)
+    {
+        GEOSGeom_destroy_r(geosCtx, pair.first);
+    }
+
+    ASSERT_TRUE(cache.load<double>({-10, -10, -9, -9}, geosCtx).empty());
+    std::remove(cachePath.c_str());
+    std::remove(sourcePath.c_str());
+}
+
+TEST_F(DataIngestTests, CensusIndexTest)
+{
+    // The index takes ownership of its context and geometries
+    auto* indexCtx = initGEOS_r(notice, log_and_exit);
+    const CensusIndex index(indexCtx, {
+                                {GEOSGeom_createRectangle_r(indexCtx, 0, 0, 1, 1), 10},
+                                {GEOSGeom_createRectangle_r(indexCtx, 1, 0, 2, 1), 20},
+                                {GEOSGeom_createRectangle_r(indexCtx, 5, 5, 6, 6), 30},
+                            });
+    ASSERT_EQ(index.size(), 3);
+
+    // Bounds are [S, W, N, E]
+    ASSERT_EQ(index.queryBounds({0.2, 0.2, 0.4, 0.4}, geosCtx).size(), 1);
+    ASSERT_EQ(index.queryBounds({0.2, 0.5, 0.4, 1.5}, geosCtx).size(), 2);
+    ASSERT_TRUE(index.queryBounds({-5, -5, -4, -4}, geosCtx).empty());
+
+    ASSERT_EQ(index.locate(1.5, 0.5, geosCtx).density, 20);
+    ASSERT_EQ(index.locate(5.5, 5.5, geosCtx).density, 30);
+    ASSERT_EQ(index.locate(3, 3, geosCtx).geometry, nullptr);
+
+    // Clipped wards are new geometries owned by the caller
+    const auto clipped = index.clipToBounds<double>({0.5, 0.5, 1, 1.5}, geosCtx);
+    ASSERT_EQ(clipped.size(), 2);
+    double totalArea = 0;
+    for (const auto& pair : clipped)
+    {
+        double area;
+        GEOSArea_r(geosCtx, pair.first, &area);
+        totalArea += area;
+        GEOSGeom_destroy_r(geosCtx, pair.first);
+    }
+    ASSERT_DOUBLE_EQ(totalArea, 0.5);
+}
+
+TEST_F(DataIngestTests, CensusCacheIndexTest)
+{
+    const auto cachePath = (std::filesystem::temp_directory_path() / "ugr_census_index_test.ugrcensus").string();
+    std::map<GEOSGeometry*, double> geomDensityMap{
+        {GEOSGeom_createRectangle_r(geosCtx, 0, 0, 1, 1), 10},
+        {GEOSGeom_createRectangle_r(geosCtx, 1, 0, 2, 1), 20},
+        {GEOSGeom_createRectangle_r(geosCtx, 5, 5, 6, 6), 30},
+    };
+    CensusCache::write(cachePath, geomDensityMap, geosCtx);
+    for (const auto& pair : geomDensityMap)
+    {
+        GEOSGeom_destroy_r(geosCtx, pair.first);
+    }
+
+    // Wards are only decoded from the cache as queries find them, which gives the same results as
+    // indexing them all up front
+    auto* indexCtx = initGEOS_r(notice, log_and_exit);
+    const CensusIndex index(indexCtx, std::make_unique<const CensusCache>(cachePath));
+    ASSERT_EQ(index.size(), 3);
+
+    // Bounds are [S, W, N, E]
+    ASSERT_EQ(index.queryBounds({0.2, 0.2, 0.4, 0.4}, geosCtx).size(), 1);
+    ASSERT_EQ(index.queryBounds({0.2, 0.5, 0.4, 1.5}, geosCtx).size(), 2);
+    ASSERT_TRUE(index.queryBounds({-5, -5, -4, -4}, geosCtx).empty());
+
+    ASSERT_EQ(index.locate(0.5, 0.5, geosCtx).density, 10);
+    ASSERT_EQ(index.locate(1.5, 0.5, geosCtx).density, 20);
+    ASSERT_EQ(index.locate(5.5, 5.5, geosCtx).density, 30);
+    ASSERT_EQ(index.locate(3, 3, geosCtx).geometry, nullptr);
+
+    // Wards found again are not decoded again
+    const auto first = index.queryBounds({0.2, 0.2, 0.4, 0.4}, geosCtx);
+    const auto second = index.queryBounds({0.2, 0.2, 0.4, 0.4}, geosCtx);
+    ASSERT_EQ(first[0].geometry, second[0].geometry);
+
+    const auto clipped = index.clipToBounds<double>({0.5, 0.5, 1, 1.5}, geosCtx);
+    ASSERT_EQ(clipped.size(), 2);
+    double totalArea = 0;
+    for (const auto& pair : clipped)
+    {
+        double area;
+        GEOSArea_r(geosCtx, pair.first, &area);
+        totalArea += area;
+        GEOSGeom_destroy_r(geosCtx, pair.first);
+    }
+    ASSERT_DOUBLE_EQ(totalArea, 0.5);
+    std::remove(cachePath.c_str());
+}
@@ -10,6 +10,8 @@
 #include <osmium/index/map.hpp>
 
 #include <geos_c.h>
+#include <filesystem>
+#include <fstream>
 
 // #define WITHOUT_NUMPY
 // #include <matplotlibcpp.h>
@@ -18,6 +20,7 @@
 
 #include "uasgroundrisk/map_gen/osm/handlers/DefaultNodeLocationsForWaysHandler.h"
 #include "uasgroundrisk/map_gen/osm/OSMOverpassQueryBuilder.h"
+#include "uasgroundrisk/map_gen/osm/OSMFileQuery.h"
 #include "uasgroundrisk/map_gen/osm/OSMTag.h"
 #include "../src/utils/DefaultGEOSMessageHandlers.h"
 #include "uasgroundrisk/map_gen/GeospatialGridMap.h"
@@ -101,6 +104,50 @@ TEST_F(GridMapOSMConstructionTests, OSMDataTest)
 	// plt::show();
 }
 
+TEST_F(GridMapOSMConstructionTests, DensityGeometryTest)
+{
+	const auto path = (std::filesystem::path(testing::TempDir()) / "GridMapOSMConstructionTests.osm").string();
+	{
+		std::ofstream out(path);
+		out << R"(<?xml version="1.0" encoding="UTF-8"?>
+<osm version="0.6">
+ <node id="1" lat="50.920" lon="-1.402"/>
+ <node id="2" lat="50.920" lon="-1.398"/>
+ <node id="3" lat="50.922" lon="-1.398"/>
+ <node id="4" lat="50.922" lon="-1.402"/>
+ <way id="10"><nd ref="1"/><nd ref="2"/><nd ref="3"/><nd ref="4"/><nd ref="1"/><tag k="amenity" v="school"/></way>
+</osm>
+)";
+	}
+
+	ugr::mapping::GeospatialGridMap gridMap({
+		                                        static_cast<float>(southWestCoords.y),
+		                                        static_cast<float>(southWestCoords.x),
+		                                        static_cast<float>(northEastCoords.y),
+		                                        static_cast<float>(northEastCoords.x)
+	                                        }, 20);
+	gridMap.add("Schools", 0.0);
+	tagLayerMap.emplace(OSMTag("amenity", "school"), "Schools");
+	densityTagMap.emplace(OSMTag("amenity", "school"), 10);
+
+	// A density geometry over the west half of the school, the rest of it uses the tag density
+	auto* reader = GEOSWKTReader_create();
+	auto* densityGeom = GEOSWKTReader_read(
+		reader, "POLYGON((-1.403 50.919, -1.400 50.919, -1.400 50.923, -1.403 50.923, -1.403 50.919))");
+	GEOSWKTReader_destroy(reader);
+	popDensityGeomMap.emplace(densityGeom, 50);
+
+	GridMapOSMHandler handler(&gridMap, tagLayerMap, popDensityGeomMap, densityTagMap);
+	OSMFileQuery(path, southWestCoords, northEastCoords, {OSMTag("amenity", "school")}).makeQuery(handler);
+
+	EXPECT_EQ(gridMap.atPosition("Schools", -1.401, 50.921), 50);
+	EXPECT_EQ(gridMap.atPosition("Schools", -1.399, 50.921), 10);
+	EXPECT_EQ(gridMap.atPosition("Schools", -1.410, 50.930), 0);
+
+	GEOSGeom_destroy(densityGeom);
+	std::filesystem::remove(path);
+}
+
 int main(int argc, char** argv)
 {
 	initGEOS(notice, log_and_exit);
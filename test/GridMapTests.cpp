@@ -0,0 +1,484 @@
+#include <gtest/gtest.h>
+#include "uasgroundrisk/gridmap/GridMap.h"
+#include "uasgroundrisk/gridmap/Rasteriser.h"
+#include "uasgroundrisk/gridmap/GeometryArena.h"
+#include <fstream>
+
+using namespace ugr::gridmap;
+
+namespace
+{
+	/**
+	 * @brief Accumulate the coverage of the spans of a rasteriser into a matrix of the given size
+	*/
+	Matrix rasteriseCoverage(const Rasteriser& rasteriser, const int sizeX, const int sizeY)
+	{
+		Matrix coverage = Matrix::Zero(sizeX, sizeY);
+		for (const auto& span : rasteriser.rasterise(Rasteriser::SampleMode::COVERAGE))
+		{
+			for (int y = span.yStart; y < span.yEnd; ++y)
+			{
+				coverage(span.x, y) += span.coverage;
+			}
+		}
+		return coverage;
+	}
+}
+
+TEST(GridMapTests, LayerHandleTest)
+{
+	GridMap gm;
+	gm.setGeometry(20, 30);
+	gm.add("First", 1);
+	gm.add("Second", 2);
+
+	const LayerHandle first = gm.getHandle("First");
+	const LayerHandle second = gm.getHandle("Second");
+	ASSERT_TRUE(first.isValid());
+	ASSERT_TRUE(second.isValid());
+	ASSERT_NE(first, second);
+	ASSERT_EQ(first, gm.getHandle("First"));
+	ASSERT_FALSE(LayerHandle().isValid());
+	ASSERT_THROW(gm.getHandle("Missing"), std::out_of_range);
+
+	// Handles and names must refer to the same data
+	gm.at(first, 3, 4) = 5;
+	ASSERT_EQ(gm.at("First", 3, 4), 5);
+	gm.at("Second", Index(6, 7)) = 8;
+	ASSERT_EQ(gm.at(second, Index(6, 7)), 8);
+	ASSERT_EQ(&gm[first], &gm["First"]);
+
+	// Adding layers must not invalidate handles or references to existing layers
+	const Matrix& firstRef = gm[first];
+	for (int i = 0; i < 100; ++i)
+	{
+		gm.add("Layer " + std::to_string(i), i);
+	}
+	ASSERT_EQ(&firstRef, &gm[first]);
+	ASSERT_EQ(gm.at(first, 3, 4), 5);
+	ASSERT_EQ(gm.at(gm.getHandle("Layer 42"), 0, 0), 42);
+
+	// Adding an existing layer leaves it untouched
+	gm.add("First", 0);
+	ASSERT_EQ(gm.at(first, 3, 4), 5);
+	ASSERT_EQ(gm.getLayers().size(), 102);
+
+	// Copies keep the same layer handles
+	const GridMap copy = gm;
+	ASSERT_EQ(copy.at(second, 6, 7), 8);
+}
+
+TEST(GridMapTests, SharedLayerCopyOnWriteTest)
+{
+	GridMap source;
+	const GridMap& constSource = source;
+	source.setGeometry(20, 30);
+	Matrix data = Matrix::Constant(20, 30, 1);
+	const float* dataPtr = data.data();
+	source.add("Moved", std::move(data));
+	// Moving a layer in must not copy its data
+	ASSERT_EQ(source.view("Moved").data(), dataPtr);
+
+	GridMap target;
+	target.setGeometry(20, 30);
+	target.addShared("Shared", source, "Moved");
+	const GridMap& constTarget = target;
+	ASSERT_EQ(constTarget.get("Shared").data(), dataPtr);
+	ASSERT_EQ(target.view("Shared").data(), dataPtr);
+
+	// Writing to the shared layer copies it, leaving the source untouched
+	target.at("Shared", 1, 2) = 5;
+	ASSERT_NE(target.view("Shared").data(), dataPtr);
+	ASSERT_EQ(source.view("Moved").data(), dataPtr);
+	ASSERT_EQ(constSource.at("Moved", 1, 2), 1);
+	ASSERT_EQ(target.at("Shared", 1, 2), 5);
+
+	// Copies of a gridmap share layers until either is written to
+	GridMap copy = source;
+	ASSERT_EQ(copy.view("Moved").data(), dataPtr);
+	copy[copy.getHandle("Moved")].setZero();
+	ASSERT_EQ(constSource.at("Moved", 0, 0), 1);
+	ASSERT_EQ(copy.at("Moved", 0, 0), 0);
+	// Once no longer shared, writes happen in place
+	const float* copyPtr = copy.view("Moved").data();
+	copy.at("Moved", 0, 0) = 2;
+	ASSERT_EQ(copy.view("Moved").data(), copyPtr);
+}
+
+TEST(GridMapTests, ReferenceOutlivesCopyTest)
+{
+	constexpr int tileSize = TiledLayer::TileSize;
+	GridMap gm;
+	gm.setGeometry(tileSize + 10, 30);
+	gm.add("Dense", 1);
+	gm.addTiled("Tiled", 1);
+
+	// References taken before a copy must keep writing to the original map only
+	Matrix& dense = gm.get("Dense");
+	float& cell = gm.at(gm.getHandle("Dense"), 2, 3);
+	float& tiledCell = gm.at(gm.getHandle("Tiled"), tileSize + 1, 2);
+	const GridMap copy = gm;
+	dense(0, 0) = 5;
+	cell = 6;
+	tiledCell = 7;
+	ASSERT_EQ(gm.at("Dense", 0, 0), 5);
+	ASSERT_EQ(gm.at("Dense", 2, 3), 6);
+	ASSERT_EQ(gm.at("Tiled", tileSize + 1, 2), 7);
+	ASSERT_EQ(copy.at("Dense", 0, 0), 1);
+	ASSERT_EQ(copy.at("Dense", 2, 3), 1);
+	ASSERT_EQ(copy.at("Tiled", tileSize + 1, 2), 1);
+
+	// Further access to the original must not detach the layer from under the references
+	ASSERT_EQ(&gm.get("Dense"), &dense);
+	ASSERT_EQ(&gm.at(gm.getHandle("Tiled"), tileSize + 1, 2), &tiledCell);
+
+	// Assignment copies referenced layers in the same way
+	GridMap assigned;
+	assigned = gm;
+	dense(0, 0) = 8;
+	ASSERT_EQ(assigned.at("Dense", 0, 0), 5);
+	ASSERT_EQ(gm.at("Dense", 0, 0), 8);
+}
+
+TEST(GridMapTests, TiledLayerTest)
+{
+	constexpr int tileSize = TiledLayer::TileSize;
+	GridMap gm;
+	gm.setGeometry(3 * tileSize + 10, 2 * tileSize + 5);
+	gm.addTiled("Tiled", 2);
+	gm.add("Dense", 0);
+	ASSERT_TRUE(gm.isTiled("Tiled"));
+	ASSERT_FALSE(gm.isTiled("Dense"));
+	ASSERT_THROW(gm.get("Tiled"), std::logic_error);
+	ASSERT_THROW(gm.view("Tiled"), std::logic_error);
+	ASSERT_THROW(gm.getTiled("Dense"), std::logic_error);
+
+	// Nothing is allocated until written to, and reads through a const map never allocate
+	const GridMap& constGm = gm;
+	const LayerHandle tiled = gm.getHandle("Tiled");
+	ASSERT_EQ(constGm.at(tiled, 3 * tileSize + 9, 2 * tileSize + 4), 2);
+	ASSERT_EQ(constGm.getTiled("Tiled").getAllocatedTiles(), 0);
+
+	// Write across a tile corner, including the partial edge tiles
+	for (int i = 3 * tileSize - 2; i < 3 * tileSize + 10; ++i)
+	{
+		for (int j = 2 * tileSize - 2; j < 2 * tileSize + 5; ++j)
+		{
+			gm.at(tiled, i, j) = 5;
+			gm.at("Dense", i, j) = 5;
+		}
+	}
+	ASSERT_EQ(constGm.getTiled("Tiled").getAllocatedTiles(), 4);
+	ASSERT_EQ(gm.at("Tiled", 3 * tileSize + 9, 2 * tileSize + 4), 5);
+	ASSERT_EQ(gm.at("Tiled", 0, 0), 2);
+
+	const Matrix dense = constGm.getTiled("Tiled").toDense();
+	ASSERT_EQ(dense.rows(), 3 * tileSize + 10);
+	ASSERT_EQ(dense.cols(), 2 * tileSize + 5);
+	ASSERT_TRUE(((gm.get("Dense").array() == 5) == (dense.array() == 5)).all());
+	ASSERT_EQ((dense.array() == 2).count(), dense.size() - (gm.get("Dense").array() == 5).count());
+
+	Matrix maxed = Matrix::Constant(dense.rows(), dense.cols(), 3);
+	constGm.getTiled("Tiled").cwiseMaxInto(maxed);
+	ASSERT_EQ(maxed.minCoeff(), 3);
+	ASSERT_EQ(maxed(3 * tileSize, 2 * tileSize), 5);
+
+	// Tiles are copy-on-write between copies of the map
+	GridMap copy = gm;
+	copy.at(tiled, 3 * tileSize, 2 * tileSize) = 7;
+	ASSERT_EQ(gm.at(tiled, 3 * tileSize, 2 * tileSize), 5);
+	ASSERT_EQ(copy.at(tiled, 3 * tileSize, 2 * tileSize), 7);
+
+	gm.getTiled("Tiled").setConstant(1);
+	ASSERT_EQ(constGm.getTiled("Tiled").getAllocatedTiles(), 0);
+	ASSERT_EQ(gm.at(tiled, 3 * tileSize, 2 * tileSize), 1);
+	ASSERT_EQ(copy.at(tiled, 3 * tileSize, 2 * tileSize), 7);
+}
+
+TEST(GridMapTests, BinaryRoundTripTest)
+{
+	GridMap gm;
+	gm.setGeometry(300, 70);
+	Matrix data(300, 70);
+	for (int i = 0; i < data.size(); ++i)
+	{
+		data(i) = static_cast<float>(i) * 0.5f;
+	}
+	gm.add("Dense", data);
+	gm.addTiled("Tiled", 3);
+	gm.at("Tiled", 290, 60) = 9;
+
+	const std::string path = testing::TempDir() + "GridMapTests.ugrmap";
+	gm.writeBinary(path);
+	ASSERT_TRUE(GridMap::readBinaryMetadata(path).worldSrs.empty());
+
+	GridMap opened = GridMap::openBinary(path);
+	const GridMap& constOpened = opened;
+	ASSERT_TRUE((opened.getSize() == gm.getSize()).all());
+	ASSERT_EQ(opened.getLayers(), gm.getLayers());
+	ASSERT_TRUE(opened.isMapped("Dense"));
+	ASSERT_TRUE(opened.isMapped("Tiled"));
+	ASSERT_TRUE(opened.view("Dense") == data);
+	ASSERT_TRUE(opened.view("Tiled") == gm.getTiled("Tiled").toDense());
+	ASSERT_EQ(constOpened.at("Tiled", 290, 60), 9);
+	ASSERT_THROW(constOpened.get("Dense"), std::logic_error);
+
+	// Layers are page aligned in the file
+	ASSERT_EQ(reinterpret_cast<uintptr_t>(opened.view("Dense").data()) % 4096, 0);
+
+	// Writing detaches the layer from the file without changing other maps sharing it
+	const GridMap sharing = opened;
+	opened.at("Dense", 1, 2) = -1;
+	ASSERT_FALSE(opened.isMapped("Dense"));
+	ASSERT_EQ(opened.get("Dense")(1, 2), -1);
+	ASSERT_EQ(opened.get("Dense")(2, 1), data(2, 1));
+	ASSERT_TRUE(sharing.isMapped("Dense"));
+	ASSERT_EQ(sharing.at("Dense", 1, 2), data(1, 2));
+
+	// Missing and malformed files are rejected
+	ASSERT_THROW(GridMap::openBinary(testing::TempDir() + "Missing.ugrmap"), std::ios_base::failure);
+	{
+		std::ofstream bad(testing::TempDir() + "Bad.ugrmap", std::ios::binary);
+		bad << "Not a gridmap";
+	}
+	ASSERT_THROW(GridMap::openBinary(testing::TempDir() + "Bad.ugrmap"), std::ios_base::failure);
+}
+
+#ifndef UGR_WITH_NETCDF
+TEST(GridMapTests, NetCDFUnavailableTest)
+{
+	GridMap gm;
+	gm.setGeometry(2, 2);
+	ASSERT_THROW(gm.writeToNetCDF(testing::TempDir() + "GridMapTests.nc"), std::runtime_error);
+}
+#endif
+
+TEST(GridMapTests, RasteriserCentreTest)
+{
+	// The spans of a rectangle cover the cells with centres inside it
+	Rasteriser rasteriser({10, 10});
+	rasteriser.addRing(std::vector<Vector>{{1, 1}, {4, 1}, {4, 3}, {1, 3}});
+	auto spans = rasteriser.rasterise();
+	ASSERT_EQ(spans.size(), 3);
+	for (int i = 0; i < 3; ++i)
+	{
+		ASSERT_EQ(spans[i].x, i + 1);
+		ASSERT_EQ(spans[i].yStart, 1);
+		ASSERT_EQ(spans[i].yEnd, 3);
+		ASSERT_EQ(spans[i].coverage, 1);
+	}
+
+	// Holes are left unfilled
+	rasteriser.clear();
+	rasteriser.addRing(std::vector<Vector>{{0, 0}, {6, 0}, {6, 6}, {0, 6}});
+	rasteriser.addRing(std::vector<Vector>{{2, 2}, {4, 2}, {4, 4}, {2, 4}});
+	spans = rasteriser.rasterise();
+	int cells = 0;
+	for (const auto& span : spans)
+	{
+		cells += span.yEnd - span.yStart;
+		if (span.x == 2 || span.x == 3)
+		{
+			ASSERT_TRUE(span.yEnd <= 2 || span.yStart >= 4);
+		}
+	}
+	ASSERT_EQ(cells, 32);
+
+	// Spans are clipped to the gridmap
+	rasteriser.clear();
+	rasteriser.addRing(std::vector<Vector>{{-5, -5}, {3, -5}, {3, 20}, {-5, 20}});
+	spans = rasteriser.rasterise();
+	ASSERT_EQ(spans.size(), 3);
+	for (const auto& span : spans)
+	{
+		ASSERT_EQ(span.yStart, 0);
+		ASSERT_EQ(span.yEnd, 10);
+	}
+
+	// An irregular polygon matches a point in polygon test of every cell centre
+	const std::vector<Vector> star{
+		{10.2, 1.3}, {12.7, 8.1}, {19.6, 8.4}, {14.1, 12.9}, {16.3, 19.5}, {10.1, 15.2}, {3.8, 19.7}, {6.2, 12.6},
+		{0.4, 8.2}, {7.5, 7.9}
+	};
+	const auto isInside = [&star](const double x, const double y)
+	{
+		bool inside = false;
+		for (size_t i = 0, j = star.size() - 1; i < star.size(); j = i++)
+		{
+			if ((star[i].x() > x) != (star[j].x() > x)
+				&& y < (star[j].y() - star[i].y()) * (x - star[i].x()) / (star[j].x() - star[i].x()) + star[i].y())
+			{
+				inside = !inside;
+			}
+		}
+		return inside;
+	};
+	Rasteriser starRasteriser({20, 20});
+	starRasteriser.addRing(star);
+	Eigen::Array<bool, Eigen::Dynamic, Eigen::Dynamic> filled = Eigen::Array<bool, Eigen::Dynamic, Eigen::Dynamic>::
+		Constant(20, 20, false);
+	for (const auto& span : starRasteriser.rasterise())
+	{
+		for (int y = span.yStart; y < span.yEnd; ++y)
+		{
+			ASSERT_FALSE(filled(span.x, y));
+			filled(span.x, y) = true;
+		}
+	}
+	for (int x = 0; x < 20; ++x)
+	{
+		for (int y = 0; y < 20; ++y)
+		{
+			ASSERT_EQ(filled(x, y), isInside(x + 0.5, y + 0.5)) << x << ", " << y;
+		}
+	}
+}
+
+TEST(GridMapTests, RasteriserCoverageTest)
+{
+	// A rectangle offset by half a cell has quarter covered corners and half covered edges
+	Rasteriser rasteriser({10, 10});
+	rasteriser.addRing(std::vector<Vector>{{0.5, 0.5}, {2.5, 0.5}, {2.5, 1.5}, {0.5, 1.5}});
+	const Matrix coverage = rasteriseCoverage(rasteriser, 10, 10);
+	ASSERT_FLOAT_EQ(coverage.sum(), 2);
+	ASSERT_FLOAT_EQ(coverage(0, 0), 0.25);
+	ASSERT_FLOAT_EQ(coverage(1, 0), 0.5);
+	ASSERT_FLOAT_EQ(coverage(1, 1), 0.5);
+	ASSERT_FLOAT_EQ(coverage(2, 1), 0.25);
+	ASSERT_FLOAT_EQ(coverage(3, 1), 0);
+}
+
+TEST(GridMapTests, RasteriserExactCoverageTest)
+{
+	// A right triangle with a diagonal hypotenuse, cut in half along the diagonal cells
+	Rasteriser triangle({10, 10});
+	triangle.addRing(std::vector<Vector>{{1, 1}, {4, 1}, {1, 4}});
+	Matrix coverage = rasteriseCoverage(triangle, 10, 10);
+	ASSERT_NEAR(coverage.sum(), 4.5, 1e-5);
+	ASSERT_FLOAT_EQ(coverage(1, 1), 1);
+	ASSERT_FLOAT_EQ(coverage(1, 3), 0.5);
+	ASSERT_FLOAT_EQ(coverage(2, 2), 0.5);
+	ASSERT_FLOAT_EQ(coverage(3, 1), 0.5);
+	ASSERT_FLOAT_EQ(coverage(3, 2), 0);
+
+	// A shallow sliver crossing several cells in a row, and a hole with the same orientation
+	Rasteriser holed({10, 10});
+	holed.addRing(std::vector<Vector>{{0.25, 0.5}, {8.25, 0.5}, {8.25, 8.5}, {0.25, 8.5}});
+	holed.addRing(std::vector<Vector>{{2.5, 2.1}, {6.5, 2.1}, {6.5, 6.9}, {2.5, 6.9}});
+	coverage = rasteriseCoverage(holed, 10, 10);
+	ASSERT_NEAR(coverage.sum(), 64 - 4 * 4.8, 1e-4);
+	ASSERT_FLOAT_EQ(coverage(4, 4), 0);
+	ASSERT_FLOAT_EQ(coverage(2, 2), 0.5 * 0.1 + 0.5);
+	ASSERT_FLOAT_EQ(coverage(0, 0), 0.75 * 0.5);
+
+	// Clipped to the gridmap, the coverage is that of the part inside it
+	Rasteriser clipped({10, 10});
+	clipped.addRing(std::vector<Vector>{{-5, -5}, {5, 15}, {15, -5}});
+	coverage = rasteriseCoverage(clipped, 10, 10);
+	ASSERT_NEAR(coverage.sum(), 100 - 2 * 0.5 * 5 * 2.5, 1e-4);
+	ASSERT_FLOAT_EQ(coverage(5, 9), 1);
+	ASSERT_FLOAT_EQ(coverage(0, 9), 0);
+}
+
+TEST(GridMapTests, RasteriserBorderCoverageTest)
+{
+	// An edge running many cells below the map before entering it
+	Rasteriser steep({1, 6});
+	steep.addRing(std::vector<Vector>{{0, -5}, {1, -0.5}, {1, 3.5}, {0, 3.5}});
+	Matrix coverage = rasteriseCoverage(steep, 1, 6);
+	for (int y = 0; y < 3; ++y)
+	{
+		ASSERT_NEAR(coverage(0, y), 1, 1e-5);
+	}
+	ASSERT_NEAR(coverage(0, 3), 0.5, 1e-5);
+	ASSERT_NEAR(coverage(0, 4), 0, 1e-5);
+	ASSERT_NEAR(coverage(0, 5), 0, 1e-5);
+
+	// Edges extending well past both y borders of the map cover all of it
+	Rasteriser covering({10, 10});
+	covering.addRing(std::vector<Vector>{{0, -20}, {10, -3}, {10, 25}, {0, 14}});
+	coverage = rasteriseCoverage(covering, 10, 10);
+	ASSERT_NEAR(coverage.sum(), 100, 1e-4);
+	ASSERT_NEAR(coverage.minCoeff(), 1, 1e-5);
+
+	// A polygon entering the map from far below it, with an exact area of 100 - 10 - 5 within it
+	Rasteriser entering({10, 10});
+	entering.addRing(std::vector<Vector>{{0, -20}, {10, 5}, {10, 10}, {0, 8}});
+	coverage = rasteriseCoverage(entering, 10, 10);
+	ASSERT_NEAR(coverage.sum(), 85, 1e-4);
+	ASSERT_NEAR(coverage(5, 5), 1, 1e-5);
+	ASSERT_NEAR(coverage(0, 9), 0, 1e-5);
+	ASSERT_NEAR(coverage(9, 0), 0, 1e-5);
+}
+
+TEST(GridMapTests, GeometryArenaTest)
+{
+	// Overlapping polygons spanning several bands, with a later polygon overwriting an earlier one
+	const std::vector<std::vector<Vector>> polygons{
+		{{1, 1}, {280, 3}, {270, 40}, {2, 30}},
+		{{20, 5}, {60, 5}, {60, 300}, {20, 300}},
+		{{100.5, 10.5}, {200.5, 10.5}, {150.5, 90.5}},
+		{{-10, 50}, {400, 60}, {390, 70}, {-10, 65}},
+	};
+	GeometryArena<float> arena;
+	for (size_t i = 0; i < polygons.size(); ++i)
+	{
+		arena.beginGeometry(static_cast<float>(i + 1));
+		arena.beginRing();
+		for (const auto& vertex : polygons[i])
+		{
+			arena.addVertex(vertex);
+		}
+	}
+	ASSERT_EQ(arena.size(), 4);
+
+	// Rasterising serially in order gives the expected values
+	GridMap expected;
+	expected.setGeometry(300, 100);
+	expected.add("Value", 0);
+	for (size_t i = 0; i < polygons.size(); ++i)
+	{
+		Rasteriser rasteriser(expected.getSize());
+		rasteriser.addRing(polygons[i]);
+		for (const auto& span : rasteriser.rasterise(Rasteriser::SampleMode::COVERAGE))
+		{
+			for (int y = span.yStart; y < span.yEnd; ++y)
+			{
+				expected.at("Value", span.x, y) = expected.at("Value", span.x, y) * (1 - span.coverage) + (i + 1) * span.coverage;
+			}
+		}
+	}
+
+	for (const bool tiled : {false, true})
+	{
+		GridMap gm;
+		gm.setGeometry(300, 100);
+		if (tiled)
+		{
+			gm.addTiled("Value", 0);
+		}
+		else
+		{
+			gm.add("Value", 0);
+		}
+		const LayerHandle layer = gm.getHandle("Value");
+		const int bandSize = GeometryArena<float>::prepareLayers(gm, {layer});
+		ASSERT_EQ(bandSize, tiled ? TiledLayer::TileSize : GeometryArena<float>::DefaultBandSize);
+		arena.rasterise(gm.getSize(), Rasteriser::SampleMode::COVERAGE, bandSize,
+		                [&gm, layer](const float value, const Index& index, const float coverage)
+		                {
+			                auto& cell = gm.at(layer, index);
+			                cell = cell * (1 - coverage) + value * coverage;
+		                });
+		for (int x = 0; x < 300; ++x)
+		{
+			for (int y = 0; y < 100; ++y)
+			{
+				ASSERT_FLOAT_EQ(gm.at(layer, x, y), expected.at("Value", x, y));
+			}
+		}
+	}
+
+	arena.clear();
+	ASSERT_TRUE(arena.empty());
+}
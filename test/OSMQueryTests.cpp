@@ -7,12 +7,23 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <osmium/geom/coordinates.hpp>
+#include <osmium/osm/node.hpp>
 
+#include "uasgroundrisk/map_gen/osm/OSMOverpassCache.h"
 #include "uasgroundrisk/map_gen/osm/OSMOverpassQueryBuilder.h"
 #include "uasgroundrisk/map_gen/osm/OSMTag.h"
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <thread>
 
 #if __unix__
 #define GTEST_USES_POSIX_RE 1
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
 #endif
 
 class OSMQueryTests : public ::testing::Test
@@ -108,6 +119,245 @@ TEST_F(OSMQLQueryTests, BuilderRelationOverloadTest)
 	EXPECT_EQ(s1, s2);
 }
 
+TEST_F(OSMXMLQueryTests, RelationsPrintedFirstTest)
+{
+	ugr::mapping::osm::OSMOverpassQueryBuilder builder =
+		ugr::mapping::osm::OSMOverpassQuery::create(southWestCoords, northEastCoords);
+	builder.withNodeTag("key", "value").withWayTag("key", "value").withRelationTag("key", "value");
+	const std::string queryString = builder.build().buildQueryString();
+
+	// Responses are parsed in a single pass, which needs relations, then nodes, then ways
+	const auto relationPrint = queryString.find("<query type=\"relation\"><item set=\"all\"/></query><print/>");
+	const auto nodePrint = queryString.find("<query type=\"node\"><item set=\"all\"/></query><print/>");
+	const auto wayPrint = queryString.find("<query type=\"way\"><item set=\"all\"/></query><print/>");
+	ASSERT_NE(relationPrint, std::string::npos);
+	ASSERT_NE(nodePrint, std::string::npos);
+	ASSERT_NE(wayPrint, std::string::npos);
+	EXPECT_LT(relationPrint, nodePrint);
+	EXPECT_LT(nodePrint, wayPrint);
+	EXPECT_LT(queryString.find("</union>"), relationPrint);
+}
+
+TEST(OSMOverpassCacheTests, CacheRoundTripTest)
+{
+	namespace fs = std::filesystem;
+	const fs::path dir = fs::path(testing::TempDir()) / "OSMOverpassCacheTests";
+	fs::remove_all(dir);
+	const ugr::mapping::osm::OSMOverpassCache cache(dir.string(), std::chrono::hours(1), 25, false);
+
+	// FNV-1a reference values
+	EXPECT_EQ(ugr::mapping::osm::OSMOverpassCache::hashKey(""), "cbf29ce484222325");
+	EXPECT_EQ(ugr::mapping::osm::OSMOverpassCache::hashKey("a"), "af63dc4c8601ec8c");
+
+	EXPECT_TRUE(cache.lookup("query a").empty());
+	const auto pathA = cache.store("query a", "response a");
+	EXPECT_EQ(cache.lookup("query a"), pathA);
+	std::ifstream in(pathA);
+	std::string contents;
+	std::getline(in, contents);
+	EXPECT_EQ(contents, "response a");
+
+	// Fill the cache past its size with entries used in a known order, the least recently used is evicted
+	const auto pathB = cache.store("query b", "response b");
+	const auto past = fs::file_time_type::clock::now() - std::chrono::minutes(10);
+	fs::last_write_time(pathA, past - std::chrono::minutes(1));
+	fs::last_write_time(pathB, past);
+	EXPECT_EQ(cache.lookup("query a"), pathA);
+	cache.store("query c", "response c");
+	// Storing never evicts, so responses being read are not removed
+	EXPECT_FALSE(cache.lookup("query b").empty());
+	fs::last_write_time(pathB, past);
+	cache.evict();
+	EXPECT_FALSE(cache.lookup("query a").empty());
+	EXPECT_TRUE(cache.lookup("query b").empty());
+	EXPECT_FALSE(cache.lookup("query c").empty());
+
+	// Entries expire by the time they were stored, regardless of use
+	fs::last_write_time(dir / (ugr::mapping::osm::OSMOverpassCache::hashKey("query c") + ".query"),
+		fs::file_time_type::clock::now() - std::chrono::hours(2));
+	EXPECT_TRUE(cache.lookup("query c").empty());
+
+	// Streamed responses are written to a temporary path in the cache then moved into place
+	const auto tempPath = cache.newTempPath("query d");
+	std::ofstream(tempPath) << "response d";
+	const auto pathD = cache.storeFile("query d", tempPath);
+	EXPECT_FALSE(fs::exists(tempPath));
+	EXPECT_EQ(cache.lookup("query d"), pathD);
+
+	// Converting a response to PBF replaces the XML entry
+	const auto pbfTempPath = cache.newTempPath("query d");
+	std::ofstream(pbfTempPath) << "pbf response d";
+	const auto pbfPathD = cache.storeFile("query d", pbfTempPath, "pbf");
+	EXPECT_FALSE(fs::exists(pathD));
+	EXPECT_EQ(cache.lookup("query d"), pbfPathD);
+	EXPECT_EQ(ugr::mapping::osm::OSMOverpassCache::responseFormat(pbfPathD), "pbf");
+	EXPECT_EQ(ugr::mapping::osm::OSMOverpassCache::responseFormat(pathD), "xml");
+
+	// Temporary files left by a stopped process are evicted, but not those that may still be written to
+	const auto orphanPath = cache.newTempPath("query e");
+	const auto activePath = cache.newTempPath("query f");
+	std::ofstream(orphanPath) << "partial response e";
+	std::ofstream(activePath) << "partial response f";
+	fs::last_write_time(orphanPath, fs::file_time_type::clock::now() - std::chrono::hours(2));
+	cache.evict();
+	EXPECT_FALSE(fs::exists(orphanPath));
+	EXPECT_TRUE(fs::exists(activePath));
+	EXPECT_EQ(cache.lookup("query d"), pbfPathD);
+
+	// A disabled cache never hits
+	const ugr::mapping::osm::OSMOverpassCache disabled("", std::chrono::hours(1), 0, false);
+	EXPECT_FALSE(disabled.isEnabled());
+	EXPECT_TRUE(disabled.lookup("query a").empty());
+	fs::remove_all(dir);
+}
+
+#if __unix__
+TEST_F(OSMQueryTests, CacheOptInTest)
+{
+	// Caching is disabled unless a cache directory is set
+	const char* dirEnv = std::getenv("UGR_OVERPASS_CACHE_DIR");
+	const std::string previousDir = dirEnv != nullptr ? dirEnv : "";
+	unsetenv("UGR_OVERPASS_CACHE_DIR");
+	EXPECT_FALSE(ugr::mapping::osm::OSMOverpassCache::fromEnvironment().isEnabled());
+
+	const auto dir = (std::filesystem::temp_directory_path() / "ugr_overpass_cache_opt_in").string();
+	setenv("UGR_OVERPASS_CACHE_DIR", dir.c_str(), 1);
+	const auto cache = ugr::mapping::osm::OSMOverpassCache::fromEnvironment();
+	EXPECT_TRUE(cache.isEnabled());
+	EXPECT_EQ(cache.getDirectory(), dir);
+
+	if (dirEnv != nullptr)
+		setenv("UGR_OVERPASS_CACHE_DIR", previousDir.c_str(), 1);
+	else
+		unsetenv("UGR_OVERPASS_CACHE_DIR");
+}
+#endif
+
+#if __unix__
+/**
+ * A minimal HTTP server on localhost, which rejects the first request with a 429 rate limit and
+ * answers the rest with a fixed OSM response
+ */
+class MockOverpassServer
+{
+public:
+	MockOverpassServer(std::string response, const int expectedRequests) : response(std::move(response))
+	{
+		listenFd = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = 0;
+		bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+		socklen_t length = sizeof(address);
+		getsockname(listenFd, reinterpret_cast<sockaddr*>(&address), &length);
+		port = ntohs(address.sin_port);
+		listen(listenFd, 16);
+		server = std::thread([this, expectedRequests]()
+		{
+			for (int i = 0; i < expectedRequests; ++i)
+			{
+				const int fd = accept(listenFd, nullptr, nullptr);
+				if (fd < 0) return;
+				serve(fd);
+				close(fd);
+			}
+		});
+	}
+
+	~MockOverpassServer()
+	{
+		shutdown(listenFd, SHUT_RDWR);
+		close(listenFd);
+		if (server.joinable()) server.join();
+	}
+
+	std::string url() const { return "http://127.0.0.1:" + std::to_string(port) + "/api/interpreter"; }
+
+	std::atomic<int> requests{0};
+
+private:
+	std::string response;
+	int listenFd;
+	int port;
+	std::thread server;
+
+	void serve(const int fd)
+	{
+		// Read the headers then the body, so the client is not reset before it reads the response
+		std::string request;
+		char buffer[4096];
+		std::size_t headerEnd;
+		while ((headerEnd = request.find("\r\n\r\n")) == std::string::npos)
+		{
+			const auto n = read(fd, buffer, sizeof(buffer));
+			if (n <= 0) return;
+			request.append(buffer, n);
+		}
+		const auto lengthPos = request.find("Content-Length: ");
+		const std::size_t contentLength = lengthPos == std::string::npos
+			                                  ? 0
+			                                  : std::stoul(request.substr(lengthPos + 16));
+		while (request.size() < headerEnd + 4 + contentLength)
+		{
+			const auto n = read(fd, buffer, sizeof(buffer));
+			if (n <= 0) return;
+			request.append(buffer, n);
+		}
+
+		const std::string reply = requests++ == 0
+			                          ? "HTTP/1.1 429 Too Many Requests\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+			                          : "HTTP/1.1 200 OK\r\nContent-Type: application/osm3s+xml\r\nContent-Length: "
+			                          + std::to_string(response.size()) + "\r\nConnection: close\r\n\r\n" + response;
+		for (std::size_t sent = 0; sent < reply.size();)
+		{
+			const auto n = write(fd, reply.data() + sent, reply.size() - sent);
+			if (n <= 0) return;
+			sent += n;
+		}
+	}
+};
+
+struct NodeCountingHandler : osmium::handler::Handler
+{
+	int nodes = 0;
+
+	void node(const osmium::Node&)
+	{
+		++nodes;
+	}
+};
+
+TEST_F(OSMXMLQueryTests, TiledQueryTest)
+{
+	// Every tile returns the same objects, as if they lay on the tile boundaries
+	const std::string response = R"(<?xml version="1.0" encoding="UTF-8"?>
+<osm version="0.6" generator="Overpass API">
+  <node id="1" lat="0.5" lon="0.5"><tag k="amenity" v="bench"/></node>
+  <node id="2" lat="0.25" lon="0.75"><tag k="amenity" v="bench"/></node>
+</osm>
+)";
+	// One rejected request, then one for each of the four tiles
+	MockOverpassServer server(response, 5);
+
+	auto query = ugr::mapping::osm::OSMOverpassQuery::create(osmium::geom::Coordinates{0.0, 0.0},
+	                                                         osmium::geom::Coordinates{1.0, 1.0})
+	             .withNodeTag("amenity", "bench")
+	             .withEndpoints({server.url()}, std::chrono::milliseconds(10))
+	             .withMaxTileSize(0.5)
+	             .withMaxConcurrentRequests(2)
+	             .build();
+	query.setCache(ugr::mapping::osm::OSMOverpassCache("", std::chrono::hours(1), 0, false));
+	ASSERT_EQ(query.splitTiles().size(), 4);
+
+	NodeCountingHandler handler;
+	query.makeQuery(handler);
+
+	EXPECT_EQ(server.requests, 5);
+	EXPECT_EQ(handler.nodes, 2);
+}
+#endif
+
 int main(int argc, char** argv)
 {
 	::testing::InitGoogleTest(&argc, argv);
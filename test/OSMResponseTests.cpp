@@ -6,6 +6,8 @@
 
 #include "OSMTestHandlers.h"
 #include <bitset>
+#include <filesystem>
+#include <fstream>
 #include <gtest/gtest.h>
 #include <iostream>
 #include <osmium/handler/node_locations_for_ways.hpp>
@@ -15,6 +17,7 @@
 
 #include "osmium/geom/coordinates.hpp"
 #include "uasgroundrisk/map_gen/osm/OSMOverpassQueryBuilder.h"
+#include "uasgroundrisk/map_gen/osm/OSMFileQuery.h"
 #include "uasgroundrisk/map_gen/osm/handlers/DefaultNodeLocationsForWaysHandler.h"
 
 using namespace osmium::memory;
@@ -161,6 +164,96 @@ TEST_F(OSMResponseTests, OsmiumMultipleHandlerResponseTest)
 	ASSERT_TRUE(handlerCalled.all());
 }
 
+TEST_F(OSMResponseTests, LocalFileQueryTest)
+{
+	const auto path = (std::filesystem::path(testing::TempDir()) / "OSMResponseTests.osm").string();
+	{
+		// Tagged features inside and outside the bounds, and untagged features inside
+		std::ofstream out(path);
+		out << R"(<?xml version="1.0" encoding="UTF-8"?>
+<osm version="0.6">
+ <node id="1" lat="50.92" lon="-1.40"><tag k="amenity" v="school"/></node>
+ <node id="2" lat="51.50" lon="-0.10"><tag k="amenity" v="school"/></node>
+ <node id="3" lat="50.92" lon="-1.40"><tag k="amenity" v="cafe"/></node>
+ <node id="4" lat="50.93" lon="-1.41"/>
+ <node id="5" lat="50.93" lon="-1.40"/>
+ <node id="6" lat="50.92" lon="-1.41"/>
+ <way id="10"><nd ref="4"/><nd ref="5"/><nd ref="6"/><nd ref="4"/><tag k="building" v="yes"/></way>
+ <way id="11"><nd ref="4"/><nd ref="5"/></way>
+</osm>
+)";
+	}
+
+	EXPECT_THROW(ugr::mapping::osm::OSMFileQuery("missing.osm.pbf", southWestCoords, northEastCoords, {}),
+	             std::ios_base::failure);
+
+	const ugr::mapping::osm::OSMFileQuery query(path, southWestCoords, northEastCoords,
+	                                            {{"amenity", "school"}, ugr::mapping::osm::OSMTag("building")});
+	std::vector<osmium::object_id_type> nodeIds, wayIds;
+	NodeTestHandler nodeTestHandler;
+	nodeTestHandler.addExpectationFunction([&nodeIds](const Node& obj)
+	{
+		nodeIds.push_back(obj.id());
+		return true;
+	});
+	WayTestHandler wayTestHandler;
+	wayTestHandler.addExpectationFunction([&wayIds](const Way& obj)
+	{
+		wayIds.push_back(obj.id());
+		return obj.nodes().front().location().valid();
+	});
+	query.makeQuery(nodeTestHandler, wayTestHandler);
+
+	EXPECT_EQ(nodeIds, std::vector<osmium::object_id_type>{1});
+	EXPECT_EQ(wayIds, std::vector<osmium::object_id_type>{10});
+	std::filesystem::remove(path);
+}
+
+TEST_F(OSMResponseTests, CachedResponseConvertedToPBFTest)
+{
+	namespace fs = std::filesystem;
+	const fs::path dir = fs::path(testing::TempDir()) / "OSMResponseTestsCache";
+	fs::remove_all(dir);
+	// Offline, so the test never touches the network
+	const ugr::mapping::osm::OSMOverpassCache cache(dir.string(), std::chrono::hours(1), 0, true);
+
+	ugr::mapping::osm::OSMOverpassQuery query =
+		ugr::mapping::osm::OSMOverpassQuery::create(southWestCoords, northEastCoords)
+		.withNodeTag("amenity", "school")
+		.build();
+	query.setCache(cache);
+	cache.store(query.buildQueryString(), R"(<?xml version="1.0" encoding="UTF-8"?>
+<osm version="0.6" generator="Overpass API">
+ <node id="1" lat="50.92" lon="-1.40"><tag k="amenity" v="school"/></node>
+ <node id="2" lat="50.93" lon="-1.41"><tag k="amenity" v="school"/></node>
+</osm>
+)");
+
+	const auto readNodeIds = [&query]()
+	{
+		std::vector<osmium::object_id_type> nodeIds;
+		NodeTestHandler nodeTestHandler;
+		nodeTestHandler.addExpectationFunction([&nodeIds](const Node& obj)
+		{
+			nodeIds.push_back(obj.id());
+			return obj.location().valid();
+		});
+		query.makeQuery(nodeTestHandler);
+		return nodeIds;
+	};
+
+	// The first read converts the cached XML, later reads decode the PBF
+	const std::vector<osmium::object_id_type> expected{1, 2};
+	EXPECT_EQ(readNodeIds(), expected);
+	const auto cachedPath = cache.lookup(query.buildQueryString());
+	EXPECT_EQ(ugr::mapping::osm::OSMOverpassCache::responseFormat(cachedPath), "pbf");
+	EXPECT_EQ(readNodeIds(), expected);
+
+	// The raw response is still XML
+	EXPECT_NE(query.rawResponse().find("<node id=\"2\""), std::string::npos);
+	fs::remove_all(dir);
+}
+
 int main(int argc, char** argv)
 {
 	::testing::InitGoogleTest(&argc, argv);
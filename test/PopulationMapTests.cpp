@@ -9,10 +9,13 @@
 #include <Eigen/Dense>
 #include "TestPlottingUtils.h"
 #include <array>
+#include <filesystem>
 #include <fstream>
 #include <gtest/gtest.h>
 
 #include "uasgroundrisk/map_gen/osm/OSMTag.h"
+#include "uasgroundrisk/map_gen/osm/OSMSession.h"
+#include "uasgroundrisk/risk_analysis/obstacles/ObstacleMap.h"
 
 
 using namespace ugr::mapping;
@@ -99,6 +102,61 @@ TEST_F(PopulationMapTests, MultiLayerTest)
 
 }
 
+TEST_F(PopulationMapTests, SharedSessionTest)
+{
+    const auto path = (std::filesystem::path(testing::TempDir()) / "PopulationMapTests.osm").string();
+    {
+        // A school and a separate building
+        std::ofstream out(path);
+        out << R"(<?xml version="1.0" encoding="UTF-8"?>
+<osm version="0.6">
+ <node id="1" lat="50.920" lon="-1.401"/>
+ <node id="2" lat="50.920" lon="-1.399"/>
+ <node id="3" lat="50.922" lon="-1.399"/>
+ <node id="4" lat="50.922" lon="-1.401"/>
+ <node id="5" lat="50.930" lon="-1.381"/>
+ <node id="6" lat="50.930" lon="-1.379"/>
+ <node id="7" lat="50.932" lon="-1.379"/>
+ <node id="8" lat="50.932" lon="-1.381"/>
+ <way id="10"><nd ref="1"/><nd ref="2"/><nd ref="3"/><nd ref="4"/><nd ref="1"/><tag k="amenity" v="school"/></way>
+ <way id="11"><nd ref="5"/><nd ref="6"/><nd ref="7"/><nd ref="8"/><nd ref="5"/><tag k="building" v="yes"/></way>
+</osm>
+)";
+    }
+
+    PopulationMap popMap(bounds, resolution);
+    popMap.setDataSource(OSMDataSource::file(path));
+    popMap.addOSMLayer("Schools", {OSMTag("amenity", "school")}, 10);
+    ugr::risk::ObstacleMap obstacleMap(bounds, resolution);
+    obstacleMap.setDataSource(OSMDataSource::file(path));
+    obstacleMap.addBuildingHeights();
+
+    OSMSession session;
+    session.addMap(popMap);
+    session.addMap(obstacleMap);
+    session.eval();
+
+    // Each map only receives the features with its own tags
+    const Position schoolPos(-1.400, 50.921);
+    const Position buildingPos(-1.380, 50.931);
+    EXPECT_EQ(popMap.atPosition("Population Density", schoolPos), 10);
+    EXPECT_EQ(popMap.atPosition("Population Density", buildingPos), 0);
+    EXPECT_GT(obstacleMap.atPosition("Building Height", buildingPos), 0);
+    EXPECT_EQ(obstacleMap.atPosition("Building Height", schoolPos), 0);
+
+    // Maps in a session must share a data source
+    PopulationMap overpassMap(bounds, resolution);
+    overpassMap.addOSMLayer("Schools", {OSMTag("amenity", "school")}, 10);
+    PopulationMap fileMap(bounds, resolution);
+    fileMap.setDataSource(OSMDataSource::file(path));
+    fileMap.addOSMLayer("Schools", {OSMTag("amenity", "school")}, 10);
+    OSMSession mixedSession;
+    mixedSession.addMap(overpassMap);
+    mixedSession.addMap(fileMap);
+    EXPECT_THROW(mixedSession.eval(), std::logic_error);
+    std::filesystem::remove(path);
+}
+
 int main(int argc, char** argv)
 {
     ::testing::InitGoogleTest(&argc, argv);
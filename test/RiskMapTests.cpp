@@ -8,6 +8,7 @@
 #include "uasgroundrisk/risk_analysis/RiskMap.h"
 #include <gtest/gtest.h>
 #include <fstream>
+#include <omp.h>
 
 #include "uasgroundrisk/map_gen/osm/OSMTag.h"
 #include "TestPlottingUtils.h"
@@ -52,6 +53,8 @@ class RiskMapExposed : public RiskMap
 	}
 
 	using RiskMap::makePointImpactMap;
+	using RiskMap::makePointImpactKernels;
+	using RiskMap::ImpactKernel;
 };
 
 TEST_F(RiskMapTests, EmptyMapLayerConstructionTest)
@@ -395,6 +398,220 @@ TEST_F(RiskMapTests, WindPointImpactMapTest)
 	outputMat(combined, testing::UnitTest::GetInstance()->current_test_info()->name());
 }
 
+TEST_F(RiskMapTests, TruncatedPointImpactKernelTest)
+{
+	ugr::mapping::PopulationMap population(bounds, resolution);
+	population.eval();
+
+	WeatherMap weather(bounds, resolution);
+	weather.addConstantWind(5, 90);
+	weather.eval();
+
+	// Add an empty building height layer directly to avoid querying OSM for it
+	ObstacleMap obstacleMap(bounds, resolution);
+	obstacleMap.add("Building Height", 0);
+	obstacleMap.eval();
+
+	RiskMapExposed riskMap(population, aircraft, obstacleMap, weather);
+
+	const auto size = riskMap.getSize();
+	const ugr::gridmap::Index idx{ 20, 20 };
+
+	std::vector<GridMapDataType> impactAngles, impactVelocities;
+	std::vector<RiskMapExposed::ImpactKernel, aligned_allocator<RiskMapExposed::ImpactKernel>> impactKernels;
+	riskMap.makePointImpactKernels(idx, 120, 90, 5, impactKernels, impactAngles, impactVelocities);
+
+	std::vector<GridMapDataType> fullImpactAngles, fullImpactVelocities;
+	std::vector<ugr::gridmap::Matrix, aligned_allocator<ugr::gridmap::Matrix>> impactPDFs;
+	riskMap.makePointImpactMap(idx, 120, 90, impactPDFs, fullImpactAngles, fullImpactVelocities);
+
+	ASSERT_EQ(impactKernels.size(), impactPDFs.size());
+	for (int i = 0; i < impactKernels.size(); ++i)
+	{
+		const auto& kernel = impactKernels[i];
+
+		// The kernel window must be a proper subset of the map for this to be of any use
+		ASSERT_LT(kernel.pdf.size(), impactPDFs[i].size());
+		ASSERT_TRUE((kernel.origin >= 0).all());
+		ASSERT_LE(kernel.origin.x() + kernel.pdf.rows(), size.x());
+		ASSERT_LE(kernel.origin.y() + kernel.pdf.cols(), size.y());
+
+		// Make sure they are still PDFs
+		ASSERT_NEAR(kernel.pdf.sum(), 1, 1e-3);
+
+		// The peak of the windowed kernel should land on the peak of the full map PDF,
+		// give or take some sampling noise as the two are sampled independently
+		int kmx, kmy, fmx, fmy;
+		kernel.pdf.maxCoeff(&kmx, &kmy);
+		impactPDFs[i].maxCoeff(&fmx, &fmy);
+		EXPECT_NEAR(kernel.origin.x() + kmx, fmx, 2);
+		EXPECT_NEAR(kernel.origin.y() + kmy, fmy, 2);
+	}
+}
+
+TEST_F(RiskMapTests, OffMapPointImpactKernelTest)
+{
+	ugr::mapping::PopulationMap population(bounds, resolution);
+	population.eval();
+
+	WeatherMap weather(bounds, resolution);
+	weather.addConstantWind(5, 90);
+	weather.eval();
+
+	// Add an empty building height layer directly to avoid querying OSM for it
+	ObstacleMap obstacleMap(bounds, resolution);
+	obstacleMap.add("Building Height", 0);
+	obstacleMap.eval();
+
+	RiskMapExposed riskMap(population, aircraft, obstacleMap, weather);
+	const auto size = riskMap.getSize();
+
+	// From the far corner of the map, some headings put the impact distributions entirely past its
+	// far edges. Kernel windows must still lie within the map, so blocks of the map at them are valid
+	const ugr::gridmap::Index idx{ size.x() - 1, size.y() - 1 };
+	for (const int heading : { 0, 90, 180, 270 })
+	{
+		std::vector<GridMapDataType> impactAngles, impactVelocities;
+		std::vector<RiskMapExposed::ImpactKernel, aligned_allocator<RiskMapExposed::ImpactKernel>> impactKernels;
+		riskMap.makePointImpactKernels(idx, 120, heading, 5, impactKernels, impactAngles, impactVelocities);
+		ASSERT_EQ(impactKernels.size(), aircraft.descents.size());
+		for (const auto& kernel : impactKernels)
+		{
+			ASSERT_TRUE((kernel.origin >= 0).all());
+			ASSERT_LE(kernel.origin.x() + kernel.pdf.rows(), size.x());
+			ASSERT_LE(kernel.origin.y() + kernel.pdf.cols(), size.y());
+		}
+	}
+}
+
+TEST_F(RiskMapTests, ConvolutionStrikeRiskMapTest)
+{
+	ugr::mapping::PopulationMap population(bounds, resolution);
+	population.eval();
+
+	// Constant wind so the conditions are uniform across the map
+	WeatherMap weather(bounds, resolution);
+	weather.addConstantWind(5, 90);
+	weather.eval();
+
+	// Add an empty building height layer directly to avoid querying OSM for it
+	ObstacleMap obstacleMap(bounds, resolution);
+	obstacleMap.add("Building Height", 0);
+	obstacleMap.eval();
+
+	RiskMap convolutionRiskMap(population, aircraft, obstacleMap, weather);
+	RiskMap pointwiseRiskMap(population, aircraft, obstacleMap, weather);
+	convolutionRiskMap.SetConvolutionEnabled(true);
+	pointwiseRiskMap.SetConvolutionEnabled(false);
+
+	// Use a block of uniform population in the middle of the map, so the map edges are also exercised
+	const auto size = convolutionRiskMap.getSize();
+	ugr::gridmap::Matrix populationDensity(size.x(), size.y());
+	populationDensity.setZero();
+	populationDensity.block(size.x() / 4, size.y() / 4, size.x() / 2, size.y() / 2).setConstant(1e-3);
+	convolutionRiskMap.get("Population Density") = populationDensity;
+	pointwiseRiskMap.get("Population Density") = populationDensity;
+
+	convolutionRiskMap.generateMap({ RiskType::STRIKE });
+	pointwiseRiskMap.generateMap({ RiskType::STRIKE });
+
+	for (const auto& descent : aircraft.descents)
+	{
+		const auto layerName = descent->getName() + " Strike Risk";
+		const ugr::gridmap::Matrix& convolutionRisk = convolutionRiskMap.get(layerName);
+		const ugr::gridmap::Matrix& pointwiseRisk = pointwiseRiskMap.get(layerName);
+
+		ASSERT_GT(pointwiseRisk.maxCoeff(), 0);
+		ASSERT_TRUE(convolutionRisk.allFinite());
+
+		// The pointwise path samples and fits a new impact distribution for every cell,
+		// so this can only agree to within the Monte Carlo noise
+		EXPECT_NEAR(convolutionRisk.sum(), pointwiseRisk.sum(), 0.05 * pointwiseRisk.sum());
+		EXPECT_NEAR(convolutionRisk.maxCoeff(), pointwiseRisk.maxCoeff(), 0.05 * pointwiseRisk.maxCoeff());
+		EXPECT_LE((convolutionRisk - pointwiseRisk).cwiseAbs().maxCoeff(), 0.2 * pointwiseRisk.maxCoeff());
+	}
+}
+
+TEST_F(RiskMapTests, SeededStrikeRiskMapTest)
+{
+	ugr::mapping::PopulationMap population(bounds, resolution);
+	population.eval();
+
+	WeatherMap weather(bounds, resolution);
+	weather.addConstantWind(5, 90);
+	weather.eval();
+
+	// Add an empty building height layer directly to avoid querying OSM for it
+	ObstacleMap obstacleMap(bounds, resolution);
+	obstacleMap.add("Building Height", 0);
+	obstacleMap.eval();
+
+	RiskMap riskMap(population, aircraft, obstacleMap, weather);
+	RiskMap otherRiskMap(population, aircraft, obstacleMap, weather);
+
+	const auto size = riskMap.getSize();
+	ugr::gridmap::Matrix populationDensity(size.x(), size.y());
+	populationDensity.setZero();
+	populationDensity.block(size.x() / 4, size.y() / 4, size.x() / 2, size.y() / 2).setConstant(1e-3);
+
+	for (auto* map : { &riskMap, &otherRiskMap })
+	{
+		map->SetSeed(1234);
+		// Force Monte Carlo sampling of every cell
+		map->SetConvolutionEnabled(false);
+		map->get("Population Density") = populationDensity;
+	}
+
+	// The samples of each cell must not depend on how the cells are divided between threads
+	const int maxThreads = omp_get_max_threads();
+	omp_set_num_threads(1);
+	riskMap.generateMap({ RiskType::STRIKE });
+	omp_set_num_threads(std::max(maxThreads, 4));
+	otherRiskMap.generateMap({ RiskType::STRIKE });
+	omp_set_num_threads(maxThreads);
+
+	for (const auto& descent : aircraft.descents)
+	{
+		const auto layerName = descent->getName() + " Strike Risk";
+		ASSERT_GT(riskMap.get(layerName).maxCoeff(), 0);
+		ASSERT_TRUE(riskMap.get(layerName) == otherRiskMap.get(layerName));
+	}
+}
+
+#ifdef UGR_WITH_NETCDF
+TEST_F(RiskMapTests, NetCDFRoundTripTest)
+{
+	ugr::mapping::PopulationMap population(bounds, resolution);
+	population.addOSMLayer("Residential", { OSMTag("landuse", "residential") }, 1000);
+	population.eval();
+
+	WeatherMap weather(bounds, resolution);
+	weather.addConstantWind(5, 90);
+	weather.eval();
+
+	ObstacleMap obstacleMap(bounds, resolution);
+	obstacleMap.addBuildingHeights();
+	obstacleMap.eval();
+
+	RiskMap riskMap(population, aircraft, obstacleMap, weather);
+	riskMap.generateMap({ RiskType::FATALITY });
+
+	const std::string path = testing::TempDir() + "RiskMapTests.nc";
+	riskMap.writeToNetCDF(path);
+
+	const auto readMap = ugr::mapping::GeospatialGridMap::readFromNetCDF(path);
+	ASSERT_TRUE((readMap.getSize() == riskMap.getSize()).all());
+	ASSERT_EQ(readMap.getBounds(), riskMap.getBounds());
+	ASSERT_EQ(readMap.getResolution(), riskMap.getResolution());
+	ASSERT_EQ(readMap.getWorldSrs(), riskMap.getWorldSrs());
+	ASSERT_EQ(readMap.getLayers(), riskMap.getLayers());
+	for (const auto& layer : riskMap.getLayers())
+	{
+		ASSERT_TRUE(readMap.view(layer) == riskMap.view(layer)) << layer;
+	}
+}
+#endif
+
 int main(int argc, char** argv)
 {
 	testing::InitGoogleTest(&argc, argv);
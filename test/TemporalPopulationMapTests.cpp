@@ -3,15 +3,89 @@
 #include <Eigen/Dense>
 #include <array>
 #include <fstream>
+#include <set>
+#include <utility>
 #include <gtest/gtest.h>
 
 #include "uasgroundrisk/map_gen/osm/OSMTag.h"
+#include "../src/map_gen/census/Ingest.h"
 
 
 using namespace ugr::mapping;
 using namespace osm;
 using namespace ugr::gridmap;
 
+/**
+ * Evaluates the population the way it was before the rasterised geometries were reused between hours,
+ * by rasterising every geometry with its density already scaled to the hour
+ */
+class ReferenceTemporalPopulationMap : public TemporalPopulationMap {
+public:
+    using TemporalPopulationMap::TemporalPopulationMap;
+
+    ugr::gridmap::Matrix evalReference(const short hour) {
+        const auto& groupProportions = nhapsProps[hour];
+        for (auto& pair: activeGeomDensityMap) {
+            pair.second *= groupProportions[0];
+        }
+        // Tags in several groups keep the density of their first group
+        std::set<OSMTag> scaledTags;
+        for (int i = 1; i < CensusNHAPSIngest::NHAPS_OSM_MAPPING.size(); ++i) {
+            for (const auto& tag: CensusNHAPSIngest::NHAPS_OSM_MAPPING[i]) {
+                const auto density = densityTagMap.find(tag);
+                if (density != densityTagMap.end() && scaledTags.insert(tag).second) {
+                    density->second *= groupProportions[i];
+                }
+            }
+        }
+
+        for (auto& pair: tagGeomMap) {
+            const auto& layerName = tagLayerMap.at(pair.first);
+            const auto fallbackDensity = densityTagMap.count(pair.first) == 1 ? densityTagMap.at(pair.first) : -1;
+            for (auto* geom: pair.second) {
+                auto geomDensity = fallbackDensity;
+                GEOSGeometry* intersection = nullptr;
+                if (fallbackDensity < 0) {
+                    if (activeGeomDensityMap.count(geom) == 1) {
+                        geomDensity = activeGeomDensityMap.at(geom);
+                    } else {
+                        // Match population geometries the same way as eval, as only the densities are checked
+                        const auto candidates = censusTree != nullptr ? queryTree(censusTree, geom)
+                                                                      : std::vector<GEOSGeometry*>();
+                        for (auto* populationGeom: candidates) {
+                            const auto populationIter = activeGeomDensityMap.find(populationGeom);
+                            if (populationIter == activeGeomDensityMap.end()) continue;
+                            if (GEOSIntersects_r(geosCtx, geom, populationGeom) == 1) {
+                                intersection = GEOSIntersection_r(geosCtx, geom, populationGeom);
+                                geomDensity = populationIter->second;
+                                break;
+                            }
+                        }
+                        if (intersection == nullptr || !GEOSisValid_r(geosCtx, intersection)) continue;
+                        geom = intersection;
+                    }
+                }
+                for (int i = 0; i < GEOSGetNumGeometries_r(geosCtx, geom); ++i) {
+                    const auto* g = GEOSGetGeometryN_r(geosCtx, geom, i);
+                    if (g != nullptr && GEOSisValid_r(geosCtx, g)) {
+                        fillGridMapPoly(layerName, g, geomDensity);
+                    }
+                }
+                if (intersection != nullptr) GEOSGeom_destroy_r(geosCtx, intersection);
+            }
+        }
+
+        ugr::gridmap::Matrix densitySum = ugr::gridmap::Matrix::Zero(getSize().x(), getSize().y());
+        for (const auto& layerName: getLayers()) {
+            if (isTiled(layerName))
+                std::as_const(*this).getTiled(layerName).cwiseMaxInto(densitySum);
+            else
+                densitySum = densitySum.cwiseMax(view(layerName));
+        }
+        return densitySum;
+    }
+};
+
 class TemporalPopulationMapTests : public ::testing::Test {
 protected:
 //    std::array<float, 4> bounds{
@@ -106,6 +180,25 @@ TEST_F(TemporalPopulationMapTests, LongitudeCrossMapTest) {
     return;
 }
 
+TEST_F(TemporalPopulationMapTests, HourSwitchTest) {
+    // Switching hours reuses the rasterised geometries, which must match rasterising the geometries
+    // with their densities scaled to that hour
+    TemporalPopulationMap popMap(bounds, resolution);
+    popMap.eval();
+    for (const short hour : {3, 15}) {
+        popMap.setHourOfDay(hour);
+        popMap.eval();
+
+        ReferenceTemporalPopulationMap referenceMap(bounds, resolution, hour);
+        const ugr::gridmap::Matrix reference = referenceMap.evalReference(hour);
+        const auto& switched = popMap.get("Population Density");
+        ASSERT_EQ(switched.rows(), reference.rows());
+        ASSERT_EQ(switched.cols(), reference.cols());
+        ASSERT_NE(reference.maxCoeff(), 0);
+        ASSERT_TRUE(switched.isApprox(reference, 1e-4f));
+    }
+}
+
 // TEST_F(TemporalPopulationMapTests, MultiLayerTest)
 // {
 //     TemporalPopulationMap popMap(bounds, resolution);
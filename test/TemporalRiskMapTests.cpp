@@ -151,3 +151,41 @@ TEST_F(TemporalRiskMapTests, ResidentialStrikeRiskMapTest)
 	ASSERT_NE(glideRisk.maxCoeff(), 0);
 	ASSERT_NE(ballisticRisk.maxCoeff(), 0);
 }
+
+TEST_F(TemporalRiskMapTests, HourlyRiskMapTest)
+{
+	ugr::mapping::TemporalPopulationMap population(bounds, resolution);
+
+	WeatherMap weather(bounds, resolution);
+	weather.addConstantWind(5, 90);
+	weather.eval();
+
+	ObstacleMap obstacleMap(bounds, resolution);
+	obstacleMap.addBuildingHeights();
+	obstacleMap.eval();
+
+	RiskMap riskMap(population, aircraft, obstacleMap, weather);
+	riskMap.SetSeed(42);
+	const std::vector<short> hours{ 3, 12, 18 };
+	auto& hourlyMap = riskMap.generateHourlyMaps(population, hours);
+
+	// Each hour must match a risk map generated from the population at that hour alone
+	for (const auto hour : hours)
+	{
+		const auto suffix = " " + std::to_string(hour);
+		ASSERT_FALSE(hourlyMap.get("Fatality Risk" + suffix).hasNaN());
+
+		ugr::mapping::TemporalPopulationMap hourPopulation(bounds, resolution, hour);
+		RiskMap hourRiskMap(hourPopulation, aircraft, obstacleMap, weather);
+		hourRiskMap.SetSeed(42);
+		auto& hourMap = hourRiskMap.generateMap({ RiskType::FATALITY });
+
+		ASSERT_TRUE(hourlyMap.get("Population Density" + suffix).isApprox(hourMap.get("Population Density"), 1e-4f));
+		ASSERT_TRUE(hourlyMap.get("Strike Risk" + suffix).isApprox(hourMap.get("Strike Risk"), 1e-4f));
+		ASSERT_TRUE(hourlyMap.get("Fatality Risk" + suffix).isApprox(hourMap.get("Fatality Risk"), 1e-4f));
+	}
+	ASSERT_NE(hourlyMap.get("Fatality Risk 12").maxCoeff(), 0);
+
+	// Repeated hours would accumulate into the same layers
+	ASSERT_THROW(riskMap.generateHourlyMaps(population, { 12, 12 }), std::invalid_argument);
+}
@@ -2,6 +2,7 @@
 
 #include "uasgroundrisk/gridmap/TypeDefs.h"
 #include "../src/utils/GeometryOperations.h"
+#include "../src/utils/RandomStreams.h"
 
 TEST(UtilTests, Bresenham2D1QTest)
 {
@@ -150,3 +151,56 @@ TEST(UtilTests, Bresenham2D4QTest)
 		}
 	}
 }
+
+TEST(UtilTests, Philox4x32KnownAnswerTest)
+{
+	// Known answer vectors from the Random123 reference implementation
+	using ugr::util::Philox4x32;
+	const Philox4x32::Counter zeros = Philox4x32::block({ 0, 0, 0, 0 }, { 0, 0 });
+	const Philox4x32::Counter zerosExpected{ 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 };
+	ASSERT_EQ(zeros, zerosExpected);
+
+	const Philox4x32::Counter ones =
+		Philox4x32::block({ 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff }, { 0xffffffff, 0xffffffff });
+	const Philox4x32::Counter onesExpected{ 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd };
+	ASSERT_EQ(ones, onesExpected);
+
+	const Philox4x32::Counter pi =
+		Philox4x32::block({ 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 }, { 0xa4093822, 0x299f31d0 });
+	const Philox4x32::Counter piExpected{ 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 };
+	ASSERT_EQ(pi, piExpected);
+}
+
+TEST(UtilTests, RandomStreamReproducibilityTest)
+{
+	ugr::util::RandomStream a(1234, 42), b(1234, 42), c(1234, 43), d(1235, 42);
+
+	Eigen::ArrayXd aSamples(101), bSamples(101), cSamples(101), dSamples(101);
+	a.normal(aSamples);
+	b.normal(bSamples);
+	c.normal(cSamples);
+	d.normal(dSamples);
+
+	// The same seed and stream must give the same samples, anything else must not
+	ASSERT_TRUE((aSamples == bSamples).all());
+	ASSERT_FALSE((aSamples == cSamples).any());
+	ASSERT_FALSE((aSamples == dSamples).any());
+}
+
+TEST(UtilTests, RandomStreamDistributionTest)
+{
+	ugr::util::RandomStream stream(0, 0);
+
+	constexpr int N = 100000;
+	Eigen::ArrayXd normals(N), uniforms(N);
+	stream.normal(normals);
+	stream.uniform(uniforms, -1, 3);
+
+	// Standard errors of the mean are ~3e-3 for the normals and ~4e-3 for the uniforms
+	EXPECT_NEAR(normals.mean(), 0, 0.02);
+	EXPECT_NEAR((normals - normals.mean()).square().mean(), 1, 0.02);
+	EXPECT_NEAR(uniforms.mean(), 1, 0.02);
+	EXPECT_NEAR((uniforms - uniforms.mean()).square().mean(), 16.0 / 12, 0.02);
+	EXPECT_GT(uniforms.minCoeff(), -1);
+	EXPECT_LT(uniforms.maxCoeff(), 3);
+}